@@ -21,6 +21,11 @@ namespace LuaRunner2 {
 // Register all SuperTerminal API functions in the Lua state
 void registerBindings(lua_State* L);
 
+// Per-frame work owned by the bindings (async asset completions, hot asset
+// reloads). Called from wait_frame; runners that replace wait_frame must call
+// it after each frame.
+void frameUpdate(lua_State* L);
+
 } // namespace LuaRunner2
 
 #endif // LUARUNNER2_BINDINGS_H
\ No newline at end of file
@@ -18,6 +18,29 @@
 #include <lua.hpp>
 #include <string>
 #include <cstring>
+#include <cstdio>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <chrono>
+#include <ctime>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 using SuperTerminal::ParticleMode;
 
@@ -37,6 +60,560 @@ static void luaL_setglobalnumber(lua_State* L, const char* name, lua_Number valu
     lua_setglobal(L, name);
 }
 
+// LuaJIT reports FFI cdata with this type tag (not defined in lua.h)
+static const int LUA_TCDATA = 10;
+
+// Address of the memory an FFI cdata argument refers to. lua_topointer gives
+// the cdata's own payload, which is the data only for arrays; for a pointer
+// such as ffi.cast("float*", p) it is the pointer variable itself. Casting
+// through ffi.cast("uintptr_t", v) yields the referenced address for both and
+// fails for structs and scalars, which are rejected.
+static void* luaL_checkcdataaddress(lua_State* L, int idx) {
+    if (idx < 0 && idx > LUA_REGISTRYINDEX) {
+        idx = lua_gettop(L) + idx + 1;
+    }
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_getfield(L, -1, "ffi");
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 2);
+        luaL_argerror(L, idx, "cdata buffers need the ffi module");
+    }
+    lua_getfield(L, -1, "cast");
+    lua_pushstring(L, "uintptr_t");
+    lua_pushvalue(L, idx);
+    if (lua_pcall(L, 2, 1, 0) != 0 || lua_type(L, -1) != LUA_TCDATA) {
+        lua_pop(L, 3);
+        luaL_argerror(L, idx, "expected an FFI array or pointer");
+    }
+    uintptr_t address = *static_cast<const uintptr_t*>(lua_topointer(L, -1));
+    lua_pop(L, 3);
+    return reinterpret_cast<void*>(address);
+}
+
+// Whether an argument is a pointer buffer: light userdata or FFI cdata
+static bool lua_isbufferpointer(lua_State* L, int idx) {
+    int type = lua_type(L, idx);
+    return type == LUA_TLIGHTUSERDATA || type == LUA_TCDATA;
+}
+
+// Data address of a pointer buffer argument (see lua_isbufferpointer)
+static void* luaL_checkbufferpointer(lua_State* L, int idx) {
+    if (lua_type(L, idx) == LUA_TCDATA) {
+        return luaL_checkcdataaddress(L, idx);
+    }
+    luaL_checktype(L, idx, LUA_TLIGHTUSERDATA);
+    return lua_touserdata(L, idx);
+}
+
+// View over a numeric buffer argument passed to a bulk API.
+template <typename T>
+struct LuaBufferView {
+    const T* data = nullptr;
+    size_t count = 0;
+};
+
+// Read a bulk buffer argument. Accepts a Lua array table, a packed binary
+// string (string.pack / ffi.string), or a light userdata / FFI array or
+// pointer with an explicit element count. Strings and pointers are read in
+// place; tables are copied into the caller's scratch vector, with booleans
+// read as 0/1.
+template <typename T>
+static LuaBufferView<T> luaL_checkbuffer(lua_State* L, int idx, std::vector<T>& scratch, size_t pointerCount = 0) {
+    LuaBufferView<T> view;
+    int type = lua_type(L, idx);
+
+    if (type == LUA_TTABLE) {
+        size_t n = lua_objlen(L, idx);
+        scratch.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            lua_rawgeti(L, idx, (int)i + 1);
+            scratch[i] = lua_type(L, -1) == LUA_TBOOLEAN ? (T)lua_toboolean(L, -1)
+                                                         : (T)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+        view.data = scratch.data();
+        view.count = n;
+    } else if (type == LUA_TSTRING) {
+        size_t len = 0;
+        const char* bytes = lua_tolstring(L, idx, &len);
+        view.data = reinterpret_cast<const T*>(bytes);
+        view.count = len / sizeof(T);
+    } else if (type == LUA_TLIGHTUSERDATA || type == LUA_TCDATA) {
+        if (pointerCount == 0) {
+            luaL_argerror(L, idx, "element count required for pointer buffers");
+        }
+        view.data = static_cast<const T*>(luaL_checkbufferpointer(L, idx));
+        view.count = pointerCount;
+    } else {
+        luaL_argerror(L, idx, "expected table, packed string or pointer");
+    }
+    return view;
+}
+
+// Growable slot map with generation-tagged handles. Lookup is O(1), freed
+// slots are reused most-recently-freed first, and a handle whose slot has been
+// reused no longer resolves. Handle 0 is never issued.
+template <typename T>
+class SlotMap {
+public:
+    static const uint32_t kIndexBits = 22;
+    static const uint32_t kIndexMask = (1u << kIndexBits) - 1;
+    static const uint32_t kGenerationMask = 0x1FF;
+
+    uint32_t insert(T value) {
+        uint32_t index;
+        if (!freeList.empty()) {
+            index = freeList.back();
+            freeList.pop_back();
+        } else {
+            if (slots.size() > kIndexMask) {
+                return 0;
+            }
+            index = (uint32_t)slots.size();
+            slots.emplace_back();
+        }
+
+        Slot& slot = slots[index];
+        slot.value = std::move(value);
+        slot.alive = true;
+        live++;
+        highWater = std::max(highWater, live);
+        return (slot.generation << kIndexBits) | index;
+    }
+
+    T* get(uint32_t handle) {
+        uint32_t index = handle & kIndexMask;
+        if (index >= slots.size()) {
+            return nullptr;
+        }
+        Slot& slot = slots[index];
+        if (!slot.alive || slot.generation != (handle >> kIndexBits)) {
+            return nullptr;
+        }
+        return &slot.value;
+    }
+
+    bool erase(uint32_t handle) {
+        if (!get(handle)) {
+            return false;
+        }
+        uint32_t index = handle & kIndexMask;
+        Slot& slot = slots[index];
+        slot.value = T();
+        slot.alive = false;
+        slot.generation = (slot.generation + 1) & kGenerationMask;
+        if (slot.generation == 0) {
+            slot.generation = 1;
+        }
+        freeList.push_back(index);
+        live--;
+        return true;
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (slots[i].alive) {
+                f((slots[i].generation << kIndexBits) | i, slots[i].value);
+            }
+        }
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (slots[i].alive) {
+                erase((slots[i].generation << kIndexBits) | i);
+            }
+        }
+    }
+
+    size_t size() const { return live; }
+    size_t capacity() const { return slots.size(); }
+    size_t highWaterMark() const { return highWater; }
+
+    // Fraction of allocated slots that are currently free holes
+    double fragmentation() const {
+        return slots.empty() ? 0.0 : (double)(slots.size() - live) / (double)slots.size();
+    }
+
+private:
+    struct Slot {
+        T value = T();
+        uint32_t generation = 1;
+        bool alive = false;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeList;
+    size_t live = 0;
+    size_t highWater = 0;
+};
+
+// Push occupancy statistics for a slot map as a table
+template <typename T>
+static void lua_pushslotmapstats(lua_State* L, const SlotMap<T>& map) {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer)map.size());
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, (lua_Integer)map.capacity());
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, (lua_Integer)map.highWaterMark());
+    lua_setfield(L, -2, "highWater");
+    lua_pushnumber(L, map.fragmentation());
+    lua_setfield(L, -2, "fragmentation");
+}
+
+// Read-write or read-only memory mapping of a file, unmapped on destruction.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            std::swap(fd, other.fd);
+            std::swap(base, other.base);
+            std::swap(length, other.length);
+            std::swap(writable, other.writable);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { close(); }
+
+    // Map an existing file read-only
+    bool openRead(const char* path) {
+        close();
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close();
+            return false;
+        }
+        return map((size_t)st.st_size, false);
+    }
+
+    // Map a file read-write, creating it or growing it to at least size bytes.
+    // Growth leaves a sparse hole, so untouched regions cost no disk space.
+    bool openWrite(const char* path, size_t size) {
+        close();
+        fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close();
+            return false;
+        }
+        if ((size_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0) {
+            close();
+            return false;
+        }
+        return map(std::max(size, (size_t)st.st_size), true);
+    }
+
+    // Map an unlinked temporary file read-write, sized like openWrite. The
+    // file disappears when the mapping is closed.
+    bool openTemporary(size_t size) {
+        close();
+        FILE* tmp = tmpfile();
+        if (!tmp) {
+            return false;
+        }
+        fd = dup(fileno(tmp));
+        fclose(tmp);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, (off_t)size) != 0) {
+            close();
+            return false;
+        }
+        return map(size, true);
+    }
+
+    void flush() {
+        if (base && writable) {
+            msync(base, length, MS_ASYNC);
+        }
+    }
+
+    // Schedule write-back of [offset, offset + bytes) and drop its pages from
+    // this process; they are read back from the file on next access. Only
+    // whole pages inside the range are released.
+    void release(size_t offset, size_t bytes) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t begin = (offset + page - 1) / page * page;
+        size_t end = std::min(offset + bytes, length) / page * page;
+        if (!base || begin >= end) {
+            return;
+        }
+        uint8_t* p = (uint8_t*)base + begin;
+        if (writable) {
+            msync(p, end - begin, MS_ASYNC);
+        }
+        madvise(p, end - begin, MADV_DONTNEED);
+    }
+
+    void close() {
+        if (base) {
+            flush();
+            munmap(base, length);
+            base = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        length = 0;
+        writable = false;
+    }
+
+    uint8_t* data() const { return (uint8_t*)base; }
+    size_t size() const { return length; }
+    bool isOpen() const { return base != nullptr; }
+
+private:
+    bool map(size_t size, bool write) {
+        void* p = mmap(nullptr, size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close();
+            return false;
+        }
+        base = p;
+        length = size;
+        writable = write;
+        return true;
+    }
+
+    int fd = -1;
+    void* base = nullptr;
+    size_t length = 0;
+    bool writable = false;
+};
+
+// LZ4 block format codec. Blocks carry no framing; callers store the
+// decompressed size alongside. The decoder is bounds-checked against both
+// buffers and fails on malformed input.
+static bool lz4DecodeBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstSize;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // The last sequence has literals only
+        if (ip >= iend) {
+            break;
+        }
+
+        if (iend - ip < 2) return false;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return false;
+        }
+
+        size_t length = token & 15;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += 4;
+        if (length > (size_t)(oend - op)) {
+            return false;
+        }
+
+        // Byte copy: matches may overlap their own output
+        const uint8_t* match = op - offset;
+        while (length--) {
+            *op++ = *match++;
+        }
+    }
+    return op == oend;
+}
+
+static void lz4PutLength(std::vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back((uint8_t)length);
+}
+
+static void lz4PutSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalCount,
+                           size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - 4 : 0;
+    uint8_t token = (uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+    out.push_back(token);
+    if (literalCount >= 15) {
+        lz4PutLength(out, literalCount - 15);
+    }
+    out.insert(out.end(), literals, literals + literalCount);
+    if (matchLength) {
+        out.push_back((uint8_t)(offset & 0xFF));
+        out.push_back((uint8_t)(offset >> 8));
+        if (matchCode >= 15) {
+            lz4PutLength(out, matchCode - 15);
+        }
+    }
+}
+
+// Greedy single-pass LZ4 block compressor. Output decodes with lz4DecodeBlock
+// and with any standard LZ4 block decoder.
+static void lz4EncodeBlock(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+    const int hashBits = 12;
+    int32_t table[1 << hashBits];
+    std::fill(table, table + (1 << hashBits), -1);
+
+    out.clear();
+    size_t anchor = 0;
+    size_t i = 0;
+
+    // The format requires the last match to start 12 bytes before the end and
+    // the final 5 bytes to be literals
+    if (size >= 13) {
+        size_t matchLimit = size - 12;
+        while (i < matchLimit) {
+            uint32_t sequence;
+            memcpy(&sequence, src + i, 4);
+            uint32_t h = (sequence * 2654435761u) >> (32 - hashBits);
+            int32_t ref = table[h];
+            table[h] = (int32_t)i;
+
+            uint32_t candidate = 0;
+            if (ref >= 0) {
+                memcpy(&candidate, src + ref, 4);
+            }
+            if (ref < 0 || i - (size_t)ref > 65535 || candidate != sequence) {
+                i++;
+                continue;
+            }
+
+            size_t length = 4;
+            size_t maxLength = size - 5 - i;
+            while (length < maxLength && src[ref + length] == src[i + length]) {
+                length++;
+            }
+
+            lz4PutSequence(out, src + anchor, i - anchor, i - (size_t)ref, length);
+            i += length;
+            anchor = i;
+        }
+    }
+
+    lz4PutSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+// XXH64 content hash. Matches the reference xxHash 64-bit output.
+static inline uint64_t xxh64Rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64Round(uint64_t acc, uint64_t input) {
+    acc += input * 0xC2B2AE3D27D4EB4FULL;
+    return xxh64Rotl(acc, 31) * 0x9E3779B185EBCA87ULL;
+}
+
+static inline uint64_t xxh64Merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64Round(0, value);
+    return acc * 0x9E3779B185EBCA87ULL + 0x85EBCA77C2B2AE63ULL;
+}
+
+static uint64_t xxh64(const void* data, size_t size, uint64_t seed = 0) {
+    const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t P3 = 0x165667B19E3779F9ULL;
+    const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        do {
+            uint64_t lanes[4];
+            memcpy(lanes, p, 32);
+            v1 = xxh64Round(v1, lanes[0]);
+            v2 = xxh64Round(v2, lanes[1]);
+            v3 = xxh64Round(v3, lanes[2]);
+            v4 = xxh64Round(v4, lanes[3]);
+            p += 32;
+        } while (end - p >= 32);
+
+        h = xxh64Rotl(v1, 1) + xxh64Rotl(v2, 7) + xxh64Rotl(v3, 12) + xxh64Rotl(v4, 18);
+        h = xxh64Merge(h, v1);
+        h = xxh64Merge(h, v2);
+        h = xxh64Merge(h, v3);
+        h = xxh64Merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+
+    h += (uint64_t)size;
+
+    while (end - p >= 8) {
+        uint64_t lane;
+        memcpy(&lane, p, 8);
+        h ^= xxh64Round(0, lane);
+        h = xxh64Rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        uint32_t lane;
+        memcpy(&lane, p, 4);
+        h ^= (uint64_t)lane * P1;
+        h = xxh64Rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (uint64_t)(*p++) * P5;
+        h = xxh64Rotl(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
 // =============================================================================
 // Text API Bindings
 // =============================================================================
@@ -2659,10 +3236,304 @@ static int lua_st_gfx_point(lua_State* L) {
     return 0;
 }
 
+// =============================================================================
+// Retained Shape Store
+// =============================================================================
+
+// Shape kinds accepted by the shapes_* bulk functions
+enum ShapeKind {
+    SHAPE_RECT = 0,
+    SHAPE_CIRCLE,
+    SHAPE_LINE,
+    SHAPE_POLYGON,
+    SHAPE_STAR,
+    SHAPE_KIND_COUNT
+};
+
+template <typename V>
+static void swapRemove(V& column, uint32_t slot) {
+    column[slot] = column.back();
+    column.pop_back();
+}
+
+// Columns of ShapeStore whose value is known to match the renderer.
+enum ShapeField : uint8_t {
+    SHAPE_FIELD_POSITION = 1 << 0,
+    SHAPE_FIELD_ROTATION = 1 << 1,
+    SHAPE_FIELD_COLOR    = 1 << 2,
+    SHAPE_FIELD_VISIBLE  = 1 << 3,
+    SHAPE_FIELD_MODE     = 1 << 4,
+    SHAPE_FIELD_PARAMS   = 1 << 5,
+};
+
+// Structure-of-arrays mirror of the retained shapes driven through the bulk
+// API. Columns are contiguous so a frame's worth of updates is applied in one
+// linear pass. Lines keep their second endpoint in x2/y2. mode and params hold
+// the per-instance procedural pattern (rect gradient mode, circle parameters).
+// known flags the columns that match the renderer; the single-shape setters
+// keep them current, so bulk setters only forward values that changed.
+struct ShapeStore {
+    std::vector<int> ids;
+    std::vector<float> x, y, x2, y2;
+    std::vector<float> rotation;
+    std::vector<uint32_t> color;
+    std::vector<uint8_t> visible;
+    std::vector<int32_t> mode;
+    std::vector<float> param1, param2, param3;
+    std::vector<uint8_t> known;
+    std::unordered_map<int, uint32_t> slotOf;
+    size_t highWater = 0;
+
+    uint32_t slot(int id) {
+        auto it = slotOf.find(id);
+        if (it != slotOf.end()) {
+            return it->second;
+        }
+        uint32_t s = (uint32_t)ids.size();
+        ids.push_back(id);
+        x.push_back(0.0f);
+        y.push_back(0.0f);
+        x2.push_back(0.0f);
+        y2.push_back(0.0f);
+        rotation.push_back(0.0f);
+        color.push_back(0xFFFFFFFF);
+        visible.push_back(1);
+        mode.push_back(0);
+        param1.push_back(0.0f);
+        param2.push_back(0.0f);
+        param3.push_back(0.0f);
+        known.push_back(0);
+        slotOf[id] = s;
+        highWater = std::max(highWater, ids.size());
+        return s;
+    }
+
+    void remove(int id) {
+        auto it = slotOf.find(id);
+        if (it == slotOf.end()) {
+            return;
+        }
+        uint32_t s = it->second;
+        slotOf.erase(it);
+        swapRemove(ids, s);
+        swapRemove(x, s);
+        swapRemove(y, s);
+        swapRemove(x2, s);
+        swapRemove(y2, s);
+        swapRemove(rotation, s);
+        swapRemove(color, s);
+        swapRemove(visible, s);
+        swapRemove(mode, s);
+        swapRemove(param1, s);
+        swapRemove(param2, s);
+        swapRemove(param3, s);
+        swapRemove(known, s);
+        if (s < ids.size()) {
+            slotOf[ids[s]] = s;
+        }
+    }
+
+    void clear() {
+        ids.clear();
+        x.clear();
+        y.clear();
+        x2.clear();
+        y2.clear();
+        rotation.clear();
+        color.clear();
+        visible.clear();
+        mode.clear();
+        param1.clear();
+        param2.clear();
+        param3.clear();
+        known.clear();
+        slotOf.clear();
+    }
+};
+
+static ShapeStore g_shapeStores[SHAPE_KIND_COUNT];
+
+// Slot of a shape the mirror already tracks, or null. A failed setter means
+// the shape is gone, so it is dropped from the mirror.
+static ShapeStore* shapeMirror(int kind, int id, bool ok, uint32_t& s) {
+    ShapeStore& store = g_shapeStores[kind];
+    auto it = store.slotOf.find(id);
+    if (it == store.slotOf.end()) {
+        return nullptr;
+    }
+    if (!ok) {
+        store.remove(id);
+        return nullptr;
+    }
+    s = it->second;
+    return &store;
+}
+
+static void shapeMirrorPosition(int kind, int id, bool ok, float x, float y,
+                                float x2 = 0.0f, float y2 = 0.0f) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->x[s] = x;
+        store->y[s] = y;
+        store->x2[s] = x2;
+        store->y2[s] = y2;
+        store->known[s] |= SHAPE_FIELD_POSITION;
+    }
+}
+
+static void shapeMirrorRotation(int kind, int id, bool ok, float degrees) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->rotation[s] = degrees;
+        store->known[s] |= SHAPE_FIELD_ROTATION;
+    }
+}
+
+static void shapeMirrorColor(int kind, int id, bool ok, uint32_t color) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->color[s] = color;
+        store->known[s] |= SHAPE_FIELD_COLOR;
+    }
+}
+
+static void shapeMirrorVisible(int kind, int id, bool ok, bool visible) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->visible[s] = visible ? 1 : 0;
+        store->known[s] |= SHAPE_FIELD_VISIBLE;
+    }
+}
+
+static void shapeMirrorMode(int kind, int id, bool ok, int32_t mode) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->mode[s] = mode;
+        store->known[s] |= SHAPE_FIELD_MODE;
+    }
+}
+
+static void shapeMirrorParameters(int kind, int id, bool ok, float p1, float p2, float p3) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->param1[s] = p1;
+        store->param2[s] = p2;
+        store->param3[s] = p3;
+        store->known[s] |= SHAPE_FIELD_PARAMS;
+    }
+}
+
+// The renderer changed a column the mirror cannot represent (e.g. multi-stop colors).
+static void shapeMirrorForget(int kind, int id, bool ok, uint8_t fields) {
+    uint32_t s;
+    if (ShapeStore* store = shapeMirror(kind, id, ok, s)) {
+        store->known[s] &= (uint8_t)~fields;
+    }
+}
+
+// Shape IDs handed to Lua are generation-tagged SlotMap handles over the
+// renderer's IDs, which the renderer reuses once a shape is deleted. A handle
+// kept past its shape's deletion stops resolving instead of silently hitting
+// whatever shape reuses the slot.
+struct ShapeHandles {
+    SlotMap<int> handles;
+    std::unordered_map<int, uint32_t> handleOf;
+
+    int wrap(int id) {
+        if (id < 0) {
+            return id;
+        }
+        // An ID reused without passing through our delete retires its old handle
+        retire(id);
+        uint32_t handle = handles.insert(id);
+        if (handle == 0) {
+            return -1;
+        }
+        handleOf[id] = handle;
+        return (int)handle;
+    }
+
+    // Renderer ID for a handle, or -1 once the shape is gone
+    int resolve(lua_Integer handle) {
+        if (handle <= 0 || handle > INT32_MAX) {
+            return -1;
+        }
+        const int* id = handles.get((uint32_t)handle);
+        return id ? *id : -1;
+    }
+
+    void retire(int id) {
+        auto it = handleOf.find(id);
+        if (it != handleOf.end()) {
+            handles.erase(it->second);
+            handleOf.erase(it);
+        }
+    }
+
+    void retireAll() {
+        handles.clear();
+        handleOf.clear();
+    }
+};
+
+static ShapeHandles g_shapeHandles[SHAPE_KIND_COUNT];
+
+static int luaL_checkshapeid(lua_State* L, int idx, int kind) {
+    return g_shapeHandles[kind].resolve(luaL_checkinteger(L, idx));
+}
+
+static int shapeHandle(int kind, int id) {
+    return g_shapeHandles[kind].wrap(id);
+}
+
+// The renderer keeps circles and lines in fixed-size pools. Creation through
+// the bindings doubles a pool before it fills, so it never depends on how the
+// renderer reports a full pool.
+struct ShapePoolStats {
+    size_t highWater = 0;
+    size_t grows = 0;
+};
+
+static ShapePoolStats g_shapePoolStats[SHAPE_KIND_COUNT];
+
+template <typename Create>
+static int createCircleGrowing(Create create) {
+    if (st_circle_count() >= st_circle_get_max()) {
+        st_circle_set_max(std::max<size_t>(st_circle_get_max() * 2, 64));
+        g_shapePoolStats[SHAPE_CIRCLE].grows++;
+    }
+    int id = create();
+    g_shapePoolStats[SHAPE_CIRCLE].highWater =
+        std::max<size_t>(g_shapePoolStats[SHAPE_CIRCLE].highWater, st_circle_count());
+    return id;
+}
+
+template <typename Create>
+static int createLineGrowing(Create create) {
+    if (st_line_count() >= st_line_get_max()) {
+        st_line_set_max(std::max<size_t>(st_line_get_max() * 2, 64));
+        g_shapePoolStats[SHAPE_LINE].grows++;
+    }
+    int id = create();
+    g_shapePoolStats[SHAPE_LINE].highWater =
+        std::max<size_t>(g_shapePoolStats[SHAPE_LINE].highWater, st_line_count());
+    return id;
+}
+
 // =============================================================================
 // Rectangle API Bindings
 // =============================================================================
 
+// Current rect sizes, so group transforms can pivot rects about their centre
+// (the renderer positions rects by their top-left corner).
+static std::unordered_map<int, std::pair<float, float>> g_rectSizes;
+
+static void rectTrackSize(int id, float width, float height) {
+    if (id >= 0) {
+        g_rectSizes[id] = std::make_pair(width, height);
+    }
+}
+
 static int lua_st_rect_create(lua_State* L) {
     float x = luaL_checknumber(L, 1);
     float y = luaL_checknumber(L, 2);
@@ -2671,7 +3542,8 @@ static int lua_st_rect_create(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 5);
 
     int id = st_rect_create(x, y, width, height, color);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2685,7 +3557,8 @@ static int lua_st_rect_create_gradient(lua_State* L) {
     int mode = luaL_checkinteger(L, 7);
 
     int id = st_rect_create_gradient(x, y, width, height, color1, color2, (STRectangleGradientMode)mode);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2700,7 +3573,8 @@ static int lua_st_rect_create_three_point(lua_State* L) {
     int mode = luaL_checkinteger(L, 8);
 
     int id = st_rect_create_three_point(x, y, width, height, color1, color2, color3, (STRectangleGradientMode)mode);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2715,80 +3589,90 @@ static int lua_st_rect_create_four_corner(lua_State* L) {
     uint32_t bottomLeft = luaL_checkinteger(L, 8);
 
     int id = st_rect_create_four_corner(x, y, width, height, topLeft, topRight, bottomRight, bottomLeft);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
 static int lua_st_rect_set_position(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     float x = luaL_checknumber(L, 2);
     float y = luaL_checknumber(L, 3);
 
     bool result = st_rect_set_position(id, x, y);
+    shapeMirrorPosition(SHAPE_RECT, id, result, x, y);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_size(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     float width = luaL_checknumber(L, 2);
     float height = luaL_checknumber(L, 3);
 
     bool result = st_rect_set_size(id, width, height);
+    if (result) {
+        rectTrackSize(id, width, height);
+    }
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_color(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     uint32_t color = luaL_checkinteger(L, 2);
 
     bool result = st_rect_set_color(id, color);
+    shapeMirrorColor(SHAPE_RECT, id, result, color);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_colors(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     uint32_t color1 = luaL_checkinteger(L, 2);
     uint32_t color2 = luaL_checkinteger(L, 3);
     uint32_t color3 = luaL_checkinteger(L, 4);
     uint32_t color4 = luaL_checkinteger(L, 5);
 
     bool result = st_rect_set_colors(id, color1, color2, color3, color4);
+    shapeMirrorForget(SHAPE_RECT, id, result, SHAPE_FIELD_COLOR);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_mode(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     int mode = luaL_checkinteger(L, 2);
 
     bool result = st_rect_set_mode(id, (STRectangleGradientMode)mode);
+    shapeMirrorMode(SHAPE_RECT, id, result, mode);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_rotation(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     double angleDegrees = luaL_checknumber(L, 2);
 
     bool result = st_rect_set_rotation(id, (float)angleDegrees);
+    shapeMirrorRotation(SHAPE_RECT, id, result, (float)angleDegrees);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_set_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
     bool visible = lua_toboolean(L, 2);
 
     bool result = st_rect_set_visible(id, visible);
+    shapeMirrorVisible(SHAPE_RECT, id, result, visible);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_rect_exists(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
 
     bool result = st_rect_exists(id);
     lua_pushboolean(L, result);
@@ -2796,7 +3680,7 @@ static int lua_st_rect_exists(lua_State* L) {
 }
 
 static int lua_st_rect_is_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
 
     bool result = st_rect_is_visible(id);
     lua_pushboolean(L, result);
@@ -2804,9 +3688,12 @@ static int lua_st_rect_is_visible(lua_State* L) {
 }
 
 static int lua_st_rect_delete(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_RECT);
 
     bool result = st_rect_delete(id);
+    g_shapeHandles[SHAPE_RECT].retire(id);
+    g_shapeStores[SHAPE_RECT].remove(id);
+    g_rectSizes.erase(id);
     lua_pushboolean(L, result);
     return 1;
 }
@@ -2814,6 +3701,9 @@ static int lua_st_rect_delete(lua_State* L) {
 static int lua_st_rect_delete_all(lua_State* L) {
     (void)L;
     st_rect_delete_all();
+    g_shapeHandles[SHAPE_RECT].retireAll();
+    g_shapeStores[SHAPE_RECT].clear();
+    g_rectSizes.clear();
     return 0;
 }
 
@@ -2828,7 +3718,8 @@ static int lua_st_rect_create_outline(lua_State* L) {
     uint32_t outlineColor = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, fillColor, outlineColor, ST_PATTERN_OUTLINE);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2841,7 +3732,8 @@ static int lua_st_rect_create_horizontal_stripes(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, color1, color2, ST_PATTERN_HORIZONTAL_STRIPES);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2854,7 +3746,8 @@ static int lua_st_rect_create_vertical_stripes(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, color1, color2, ST_PATTERN_VERTICAL_STRIPES);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2867,7 +3760,8 @@ static int lua_st_rect_create_diagonal_stripes(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, color1, color2, ST_PATTERN_DIAGONAL_STRIPES);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2880,7 +3774,8 @@ static int lua_st_rect_create_checkerboard(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, color1, color2, ST_PATTERN_CHECKERBOARD);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2893,7 +3788,8 @@ static int lua_st_rect_create_dots(lua_State* L) {
     uint32_t backgroundColor = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, dotColor, backgroundColor, ST_PATTERN_DOTS);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2906,7 +3802,8 @@ static int lua_st_rect_create_grid(lua_State* L) {
     uint32_t backgroundColor = luaL_checkinteger(L, 6);
 
     int id = st_rect_create_gradient(x, y, width, height, lineColor, backgroundColor, ST_PATTERN_GRID);
-    lua_pushinteger(L, id);
+    rectTrackSize(id, width, height);
+    lua_pushinteger(L, shapeHandle(SHAPE_RECT, id));
     return 1;
 }
 
@@ -2923,8 +3820,8 @@ static int lua_st_circle_create(lua_State* L) {
     float radius = luaL_checknumber(L, 3);
     uint32_t color = luaL_checkinteger(L, 4);
 
-    int id = st_circle_create(x, y, radius, color);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create(x, y, radius, color); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -2935,8 +3832,8 @@ static int lua_st_circle_create_radial(lua_State* L) {
     uint32_t centerColor = luaL_checkinteger(L, 4);
     uint32_t edgeColor = luaL_checkinteger(L, 5);
 
-    int id = st_circle_create_radial(x, y, radius, centerColor, edgeColor);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_radial(x, y, radius, centerColor, edgeColor); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -2948,8 +3845,8 @@ static int lua_st_circle_create_radial_3(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 5);
     uint32_t color3 = luaL_checkinteger(L, 6);
 
-    int id = st_circle_create_radial_3(x, y, radius, color1, color2, color3);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_radial_3(x, y, radius, color1, color2, color3); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -2962,8 +3859,8 @@ static int lua_st_circle_create_radial_4(lua_State* L) {
     uint32_t color3 = luaL_checkinteger(L, 6);
     uint32_t color4 = luaL_checkinteger(L, 7);
 
-    int id = st_circle_create_radial_4(x, y, radius, color1, color2, color3, color4);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_radial_4(x, y, radius, color1, color2, color3, color4); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -2975,8 +3872,8 @@ static int lua_st_circle_create_outline(lua_State* L) {
     uint32_t outlineColor = luaL_checkinteger(L, 5);
     float lineWidth = luaL_optnumber(L, 6, 2.0);
 
-    int id = st_circle_create_outline(x, y, radius, fillColor, outlineColor, lineWidth);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_outline(x, y, radius, fillColor, outlineColor, lineWidth); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -2989,8 +3886,8 @@ static int lua_st_circle_create_dashed_outline(lua_State* L) {
     float lineWidth = luaL_optnumber(L, 6, 2.0);
     float dashLength = luaL_optnumber(L, 7, 10.0);
 
-    int id = st_circle_create_dashed_outline(x, y, radius, fillColor, outlineColor, lineWidth, dashLength);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_dashed_outline(x, y, radius, fillColor, outlineColor, lineWidth, dashLength); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -3001,8 +3898,8 @@ static int lua_st_circle_create_ring(lua_State* L) {
     float innerRadius = luaL_checknumber(L, 4);
     uint32_t color = luaL_checkinteger(L, 5);
 
-    int id = st_circle_create_ring(x, y, outerRadius, innerRadius, color);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_ring(x, y, outerRadius, innerRadius, color); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -3014,8 +3911,8 @@ static int lua_st_circle_create_pie_slice(lua_State* L) {
     float endAngle = luaL_checknumber(L, 5);
     uint32_t color = luaL_checkinteger(L, 6);
 
-    int id = st_circle_create_pie_slice(x, y, radius, startAngle, endAngle, color);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_pie_slice(x, y, radius, startAngle, endAngle, color); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -3028,8 +3925,8 @@ static int lua_st_circle_create_arc(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 6);
     float lineWidth = luaL_optnumber(L, 7, 2.0);
 
-    int id = st_circle_create_arc(x, y, radius, startAngle, endAngle, color, lineWidth);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_arc(x, y, radius, startAngle, endAngle, color, lineWidth); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -3042,8 +3939,8 @@ static int lua_st_circle_create_dots_ring(lua_State* L) {
     float dotRadius = luaL_checknumber(L, 6);
     int numDots = luaL_checkinteger(L, 7);
 
-    int id = st_circle_create_dots_ring(x, y, radius, dotColor, backgroundColor, dotRadius, numDots);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_dots_ring(x, y, radius, dotColor, backgroundColor, dotRadius, numDots); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
@@ -3055,23 +3952,24 @@ static int lua_st_circle_create_star_burst(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 5);
     int numRays = luaL_checkinteger(L, 6);
 
-    int id = st_circle_create_star_burst(x, y, radius, color1, color2, numRays);
-    lua_pushinteger(L, id);
+    int id = createCircleGrowing([&] { return st_circle_create_star_burst(x, y, radius, color1, color2, numRays); });
+    lua_pushinteger(L, shapeHandle(SHAPE_CIRCLE, id));
     return 1;
 }
 
 static int lua_st_circle_set_position(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     float x = luaL_checknumber(L, 2);
     float y = luaL_checknumber(L, 3);
 
     bool result = st_circle_set_position(id, x, y);
+    shapeMirrorPosition(SHAPE_CIRCLE, id, result, x, y);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_circle_set_radius(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     float radius = luaL_checknumber(L, 2);
 
     bool result = st_circle_set_radius(id, radius);
@@ -3080,61 +3978,67 @@ static int lua_st_circle_set_radius(lua_State* L) {
 }
 
 static int lua_st_circle_set_color(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     uint32_t color = luaL_checkinteger(L, 2);
 
     bool result = st_circle_set_color(id, color);
+    shapeMirrorColor(SHAPE_CIRCLE, id, result, color);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_circle_set_colors(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     uint32_t color1 = luaL_checkinteger(L, 2);
     uint32_t color2 = luaL_checkinteger(L, 3);
     uint32_t color3 = luaL_checkinteger(L, 4);
     uint32_t color4 = luaL_checkinteger(L, 5);
 
     bool result = st_circle_set_colors(id, color1, color2, color3, color4);
+    shapeMirrorForget(SHAPE_CIRCLE, id, result, SHAPE_FIELD_COLOR);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_circle_set_parameters(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     float param1 = luaL_checknumber(L, 2);
     float param2 = luaL_checknumber(L, 3);
     float param3 = luaL_checknumber(L, 4);
 
     bool result = st_circle_set_parameters(id, param1, param2, param3);
+    shapeMirrorParameters(SHAPE_CIRCLE, id, result, param1, param2, param3);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_circle_set_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     bool visible = lua_toboolean(L, 2);
 
     bool result = st_circle_set_visible(id, visible);
+    shapeMirrorVisible(SHAPE_CIRCLE, id, result, visible);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_circle_exists(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     lua_pushboolean(L, st_circle_exists(id));
     return 1;
 }
 
 static int lua_st_circle_is_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     lua_pushboolean(L, st_circle_is_visible(id));
     return 1;
 }
 
 static int lua_st_circle_delete(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_CIRCLE);
     bool result = st_circle_delete(id);
+    g_shapeHandles[SHAPE_CIRCLE].retire(id);
+    g_shapeStores[SHAPE_CIRCLE].remove(id);
     lua_pushboolean(L, result);
     return 1;
 }
@@ -3142,6 +4046,8 @@ static int lua_st_circle_delete(lua_State* L) {
 static int lua_st_circle_delete_all(lua_State* L) {
     (void)L;
     st_circle_delete_all();
+    g_shapeHandles[SHAPE_CIRCLE].retireAll();
+    g_shapeStores[SHAPE_CIRCLE].clear();
     return 0;
 }
 
@@ -3178,8 +4084,8 @@ static int lua_st_line_create(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 5);
     float thickness = luaL_optnumber(L, 6, 1.0);
 
-    int id = st_line_create(x1, y1, x2, y2, color, thickness);
-    lua_pushinteger(L, id);
+    int id = createLineGrowing([&] { return st_line_create(x1, y1, x2, y2, color, thickness); });
+    lua_pushinteger(L, shapeHandle(SHAPE_LINE, id));
     return 1;
 }
 
@@ -3192,8 +4098,8 @@ static int lua_st_line_create_gradient(lua_State* L) {
     uint32_t color2 = luaL_checkinteger(L, 6);
     float thickness = luaL_optnumber(L, 7, 1.0);
 
-    int id = st_line_create_gradient(x1, y1, x2, y2, color1, color2, thickness);
-    lua_pushinteger(L, id);
+    int id = createLineGrowing([&] { return st_line_create_gradient(x1, y1, x2, y2, color1, color2, thickness); });
+    lua_pushinteger(L, shapeHandle(SHAPE_LINE, id));
     return 1;
 }
 
@@ -3207,8 +4113,8 @@ static int lua_st_line_create_dashed(lua_State* L) {
     float dashLength = luaL_optnumber(L, 7, 10.0);
     float gapLength = luaL_optnumber(L, 8, 5.0);
 
-    int id = st_line_create_dashed(x1, y1, x2, y2, color, thickness, dashLength, gapLength);
-    lua_pushinteger(L, id);
+    int id = createLineGrowing([&] { return st_line_create_dashed(x1, y1, x2, y2, color, thickness, dashLength, gapLength); });
+    lua_pushinteger(L, shapeHandle(SHAPE_LINE, id));
     return 1;
 }
 
@@ -3221,25 +4127,26 @@ static int lua_st_line_create_dotted(lua_State* L) {
     float thickness = luaL_optnumber(L, 6, 1.0);
     float dotSpacing = luaL_optnumber(L, 7, 5.0);
 
-    int id = st_line_create_dotted(x1, y1, x2, y2, color, thickness, dotSpacing);
-    lua_pushinteger(L, id);
+    int id = createLineGrowing([&] { return st_line_create_dotted(x1, y1, x2, y2, color, thickness, dotSpacing); });
+    lua_pushinteger(L, shapeHandle(SHAPE_LINE, id));
     return 1;
 }
 
 static int lua_st_line_set_endpoints(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     float x1 = luaL_checknumber(L, 2);
     float y1 = luaL_checknumber(L, 3);
     float x2 = luaL_checknumber(L, 4);
     float y2 = luaL_checknumber(L, 5);
 
     bool result = st_line_set_endpoints(id, x1, y1, x2, y2);
+    shapeMirrorPosition(SHAPE_LINE, id, result, x1, y1, x2, y2);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_line_set_thickness(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     float thickness = luaL_checknumber(L, 2);
 
     bool result = st_line_set_thickness(id, thickness);
@@ -3248,26 +4155,28 @@ static int lua_st_line_set_thickness(lua_State* L) {
 }
 
 static int lua_st_line_set_color(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     uint32_t color = luaL_checkinteger(L, 2);
 
     bool result = st_line_set_color(id, color);
+    shapeMirrorColor(SHAPE_LINE, id, result, color);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_line_set_colors(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     uint32_t color1 = luaL_checkinteger(L, 2);
     uint32_t color2 = luaL_checkinteger(L, 3);
 
     bool result = st_line_set_colors(id, color1, color2);
+    shapeMirrorForget(SHAPE_LINE, id, result, SHAPE_FIELD_COLOR);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_line_set_dash_pattern(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     float dashLength = luaL_checknumber(L, 2);
     float gapLength = luaL_checknumber(L, 3);
 
@@ -3277,29 +4186,32 @@ static int lua_st_line_set_dash_pattern(lua_State* L) {
 }
 
 static int lua_st_line_set_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     bool visible = lua_toboolean(L, 2);
 
     bool result = st_line_set_visible(id, visible);
+    shapeMirrorVisible(SHAPE_LINE, id, result, visible);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_line_exists(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     lua_pushboolean(L, st_line_exists(id));
     return 1;
 }
 
 static int lua_st_line_is_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     lua_pushboolean(L, st_line_is_visible(id));
     return 1;
 }
 
 static int lua_st_line_delete(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_LINE);
     bool result = st_line_delete(id);
+    g_shapeHandles[SHAPE_LINE].retire(id);
+    g_shapeStores[SHAPE_LINE].remove(id);
     lua_pushboolean(L, result);
     return 1;
 }
@@ -3307,6 +4219,8 @@ static int lua_st_line_delete(lua_State* L) {
 static int lua_st_line_delete_all(lua_State* L) {
     (void)L;
     st_line_delete_all();
+    g_shapeHandles[SHAPE_LINE].retireAll();
+    g_shapeStores[SHAPE_LINE].clear();
     return 0;
 }
 
@@ -3345,7 +4259,7 @@ static int lua_st_polygon_create(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 5);
 
     int id = st_polygon_create(x, y, radius, numSides, color);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_POLYGON, id));
     return 1;
 }
 
@@ -3359,21 +4273,22 @@ static int lua_st_polygon_create_gradient(lua_State* L) {
     int mode = luaL_checkinteger(L, 7);
 
     int id = st_polygon_create_gradient(x, y, radius, numSides, color1, color2, (STPolygonGradientMode)mode);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_POLYGON, id));
     return 1;
 }
 
 static int lua_st_polygon_set_position(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     float x = luaL_checknumber(L, 2);
     float y = luaL_checknumber(L, 3);
     bool result = st_polygon_set_position(id, x, y);
+    shapeMirrorPosition(SHAPE_POLYGON, id, result, x, y);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_polygon_set_radius(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     float radius = luaL_checknumber(L, 2);
     bool result = st_polygon_set_radius(id, radius);
     lua_pushboolean(L, result);
@@ -3381,7 +4296,7 @@ static int lua_st_polygon_set_radius(lua_State* L) {
 }
 
 static int lua_st_polygon_set_sides(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     int numSides = luaL_checkinteger(L, 2);
     bool result = st_polygon_set_sides(id, numSides);
     lua_pushboolean(L, result);
@@ -3389,32 +4304,37 @@ static int lua_st_polygon_set_sides(lua_State* L) {
 }
 
 static int lua_st_polygon_set_color(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     uint32_t color = luaL_checkinteger(L, 2);
     bool result = st_polygon_set_color(id, color);
+    shapeMirrorColor(SHAPE_POLYGON, id, result, color);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_polygon_set_rotation(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     double angleDegrees = luaL_checknumber(L, 2);
     bool result = st_polygon_set_rotation(id, (float)angleDegrees);
+    shapeMirrorRotation(SHAPE_POLYGON, id, result, (float)angleDegrees);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_polygon_set_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     bool visible = lua_toboolean(L, 2);
     bool result = st_polygon_set_visible(id, visible);
+    shapeMirrorVisible(SHAPE_POLYGON, id, result, visible);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_polygon_delete(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_POLYGON);
     bool result = st_polygon_delete(id);
+    g_shapeHandles[SHAPE_POLYGON].retire(id);
+    g_shapeStores[SHAPE_POLYGON].remove(id);
     lua_pushboolean(L, result);
     return 1;
 }
@@ -3422,6 +4342,8 @@ static int lua_st_polygon_delete(lua_State* L) {
 static int lua_st_polygon_delete_all(lua_State* L) {
     (void)L;
     st_polygon_delete_all();
+    g_shapeHandles[SHAPE_POLYGON].retireAll();
+    g_shapeStores[SHAPE_POLYGON].clear();
     return 0;
 }
 
@@ -3442,7 +4364,7 @@ static int lua_st_star_create(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 5);
 
     int id = st_star_create(x, y, outerRadius, numPoints, color);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_STAR, id));
     return 1;
 }
 
@@ -3455,7 +4377,7 @@ static int lua_st_star_create_custom(lua_State* L) {
     uint32_t color = luaL_checkinteger(L, 6);
 
     int id = st_star_create_custom(x, y, outerRadius, innerRadius, numPoints, color);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_STAR, id));
     return 1;
 }
 
@@ -3469,7 +4391,7 @@ static int lua_st_star_create_gradient(lua_State* L) {
     int mode = luaL_checkinteger(L, 7);
 
     int id = st_star_create_gradient(x, y, outerRadius, numPoints, color1, color2, (STStarGradientMode)mode);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_STAR, id));
     return 1;
 }
 
@@ -3483,21 +4405,22 @@ static int lua_st_star_create_outline(lua_State* L) {
     float lineWidth = luaL_optnumber(L, 7, 2.0);
 
     int id = st_star_create_outline(x, y, outerRadius, numPoints, fillColor, outlineColor, lineWidth);
-    lua_pushinteger(L, id);
+    lua_pushinteger(L, shapeHandle(SHAPE_STAR, id));
     return 1;
 }
 
 static int lua_st_star_set_position(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     float x = luaL_checknumber(L, 2);
     float y = luaL_checknumber(L, 3);
     bool result = st_star_set_position(id, x, y);
+    shapeMirrorPosition(SHAPE_STAR, id, result, x, y);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_star_set_radius(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     float outerRadius = luaL_checknumber(L, 2);
     bool result = st_star_set_radius(id, outerRadius);
     lua_pushboolean(L, result);
@@ -3505,7 +4428,7 @@ static int lua_st_star_set_radius(lua_State* L) {
 }
 
 static int lua_st_star_set_radii(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     float outerRadius = luaL_checknumber(L, 2);
     float innerRadius = luaL_checknumber(L, 3);
     bool result = st_star_set_radii(id, outerRadius, innerRadius);
@@ -3514,7 +4437,7 @@ static int lua_st_star_set_radii(lua_State* L) {
 }
 
 static int lua_st_star_set_points(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     int numPoints = luaL_checkinteger(L, 2);
     bool result = st_star_set_points(id, numPoints);
     lua_pushboolean(L, result);
@@ -3522,53 +4445,59 @@ static int lua_st_star_set_points(lua_State* L) {
 }
 
 static int lua_st_star_set_color(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     uint32_t color = luaL_checkinteger(L, 2);
     bool result = st_star_set_color(id, color);
+    shapeMirrorColor(SHAPE_STAR, id, result, color);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_star_set_colors(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     uint32_t color1 = luaL_checkinteger(L, 2);
     uint32_t color2 = luaL_checkinteger(L, 3);
     bool result = st_star_set_colors(id, color1, color2);
+    shapeMirrorForget(SHAPE_STAR, id, result, SHAPE_FIELD_COLOR);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_star_set_rotation(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     float angleDegrees = luaL_checknumber(L, 2);
     bool result = st_star_set_rotation(id, angleDegrees);
+    shapeMirrorRotation(SHAPE_STAR, id, result, angleDegrees);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_star_set_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     bool visible = lua_toboolean(L, 2);
     bool result = st_star_set_visible(id, visible);
+    shapeMirrorVisible(SHAPE_STAR, id, result, visible);
     lua_pushboolean(L, result);
     return 1;
 }
 
 static int lua_st_star_exists(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     lua_pushboolean(L, st_star_exists(id));
     return 1;
 }
 
 static int lua_st_star_is_visible(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     lua_pushboolean(L, st_star_is_visible(id));
     return 1;
 }
 
 static int lua_st_star_delete(lua_State* L) {
-    int id = luaL_checkinteger(L, 1);
+    int id = luaL_checkshapeid(L, 1, SHAPE_STAR);
     bool result = st_star_delete(id);
+    g_shapeHandles[SHAPE_STAR].retire(id);
+    g_shapeStores[SHAPE_STAR].remove(id);
     lua_pushboolean(L, result);
     return 1;
 }
@@ -3576,6 +4505,8 @@ static int lua_st_star_delete(lua_State* L) {
 static int lua_st_star_delete_all(lua_State* L) {
     (void)L;
     st_star_delete_all();
+    g_shapeHandles[SHAPE_STAR].retireAll();
+    g_shapeStores[SHAPE_STAR].clear();
     return 0;
 }
 
@@ -3589,6 +4520,726 @@ static int lua_st_star_is_empty(lua_State* L) {
     return 1;
 }
 
+// =============================================================================
+// Shape Bulk Update API Bindings
+// =============================================================================
+
+static std::vector<int32_t> g_bulkIds;
+static std::vector<float> g_bulkValues;
+
+// Per-frame counts for the bulk API: Lua calls made, shape instances they
+// addressed, and per-shape renderer updates actually forwarded (values the
+// mirror already held are skipped). Draw calls are issued by the renderer
+// and are not visible here. Counters roll over when the frame advances.
+struct ShapeSubmitStats {
+    uint64_t frame = 0;
+    int calls = 0, instances = 0, forwarded = 0;
+    int lastCalls = 0, lastInstances = 0, lastForwarded = 0;
+};
+
+static ShapeSubmitStats g_shapeSubmitStats;
+
+static ShapeSubmitStats& shapeSubmitStats() {
+    ShapeSubmitStats& st = g_shapeSubmitStats;
+    uint64_t frame = (uint64_t)st_frame_count();
+    if (frame != st.frame) {
+        bool consecutive = (frame == st.frame + 1);
+        st.lastCalls = consecutive ? st.calls : 0;
+        st.lastInstances = consecutive ? st.instances : 0;
+        st.lastForwarded = consecutive ? st.forwarded : 0;
+        st.calls = 0;
+        st.instances = 0;
+        st.forwarded = 0;
+        st.frame = frame;
+    }
+    return st;
+}
+
+static void shapeSubmitRecord(int instances, int forwarded) {
+    ShapeSubmitStats& st = shapeSubmitStats();
+    st.calls++;
+    st.instances += instances;
+    st.forwarded += forwarded;
+}
+
+static int luaL_checkshapekind(lua_State* L, int idx) {
+    int kind = luaL_checkinteger(L, idx);
+    luaL_argcheck(L, kind >= 0 && kind < SHAPE_KIND_COUNT, idx, "invalid shape kind");
+    return kind;
+}
+
+static bool shapeApplyPosition(int kind, int id, const ShapeStore& store, uint32_t s) {
+    switch (kind) {
+        case SHAPE_RECT:    return st_rect_set_position(id, store.x[s], store.y[s]);
+        case SHAPE_CIRCLE:  return st_circle_set_position(id, store.x[s], store.y[s]);
+        case SHAPE_LINE:    return st_line_set_endpoints(id, store.x[s], store.y[s], store.x2[s], store.y2[s]);
+        case SHAPE_POLYGON: return st_polygon_set_position(id, store.x[s], store.y[s]);
+        case SHAPE_STAR:    return st_star_set_position(id, store.x[s], store.y[s]);
+    }
+    return false;
+}
+
+static bool shapeApplyRotation(int kind, int id, const ShapeStore& store, uint32_t s) {
+    switch (kind) {
+        case SHAPE_RECT:    return st_rect_set_rotation(id, store.rotation[s]);
+        case SHAPE_POLYGON: return st_polygon_set_rotation(id, store.rotation[s]);
+        case SHAPE_STAR:    return st_star_set_rotation(id, store.rotation[s]);
+    }
+    return false;
+}
+
+static bool shapeApplyColor(int kind, int id, const ShapeStore& store, uint32_t s) {
+    switch (kind) {
+        case SHAPE_RECT:    return st_rect_set_color(id, store.color[s]);
+        case SHAPE_CIRCLE:  return st_circle_set_color(id, store.color[s]);
+        case SHAPE_LINE:    return st_line_set_color(id, store.color[s]);
+        case SHAPE_POLYGON: return st_polygon_set_color(id, store.color[s]);
+        case SHAPE_STAR:    return st_star_set_color(id, store.color[s]);
+    }
+    return false;
+}
+
+static bool shapeApplyMode(int kind, int id, const ShapeStore& store, uint32_t s) {
+    switch (kind) {
+        case SHAPE_RECT:    return st_rect_set_mode(id, (STRectangleGradientMode)store.mode[s]);
+    }
+    return false;
+}
+
+static bool shapeApplyParameters(int kind, int id, const ShapeStore& store, uint32_t s) {
+    switch (kind) {
+        case SHAPE_CIRCLE:  return st_circle_set_parameters(id, store.param1[s], store.param2[s], store.param3[s]);
+    }
+    return false;
+}
+
+static bool shapeApplyVisible(int kind, int id, const ShapeStore& store, uint32_t s) {
+    bool visible = store.visible[s] != 0;
+    switch (kind) {
+        case SHAPE_RECT:    return st_rect_set_visible(id, visible);
+        case SHAPE_CIRCLE:  return st_circle_set_visible(id, visible);
+        case SHAPE_LINE:    return st_line_set_visible(id, visible);
+        case SHAPE_POLYGON: return st_polygon_set_visible(id, visible);
+        case SHAPE_STAR:    return st_star_set_visible(id, visible);
+    }
+    return false;
+}
+
+// shapes_set_positions(kind, ids, xy [, count])
+// xy holds x,y pairs per shape (x1,y1,x2,y2 for SHAPE_LINE). ids and xy may be
+// tables, packed strings (int32 ids, float32 values) or FFI arrays with count.
+// Stale or unknown ids are skipped and not counted as updated.
+static int lua_shapes_set_positions(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+    size_t stride = (kind == SHAPE_LINE) ? 4 : 2;
+
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<float> values = luaL_checkbuffer(L, 3, g_bulkValues, count * stride);
+    size_t n = std::min(ids.count, values.count / stride);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        const float* v = values.data + i * stride;
+        uint32_t s = store.slot(id);
+        if ((store.known[s] & SHAPE_FIELD_POSITION) && store.x[s] == v[0] && store.y[s] == v[1] &&
+            (stride == 2 || (store.x2[s] == v[2] && store.y2[s] == v[3]))) {
+            updated++;
+            continue;
+        }
+        store.x[s] = v[0];
+        store.y[s] = v[1];
+        if (stride == 4) {
+            store.x2[s] = v[2];
+            store.y2[s] = v[3];
+        }
+        forwarded++;
+        if (shapeApplyPosition(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_POSITION;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_set_rotations(kind, ids, degrees [, count]) - rects, polygons and stars
+static int lua_shapes_set_rotations(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    luaL_argcheck(L, kind == SHAPE_RECT || kind == SHAPE_POLYGON || kind == SHAPE_STAR, 1,
+                  "shape kind has no rotation");
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<float> values = luaL_checkbuffer(L, 3, g_bulkValues, count);
+    size_t n = std::min(ids.count, values.count);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        uint32_t s = store.slot(id);
+        if ((store.known[s] & SHAPE_FIELD_ROTATION) && store.rotation[s] == values.data[i]) {
+            updated++;
+            continue;
+        }
+        store.rotation[s] = values.data[i];
+        forwarded++;
+        if (shapeApplyRotation(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_ROTATION;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_set_colors(kind, ids, colors [, count]) - colors are packed uint32 RGBA
+static int lua_shapes_set_colors(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+
+    static std::vector<uint32_t> colorScratch;
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<uint32_t> values = luaL_checkbuffer(L, 3, colorScratch, count);
+    size_t n = std::min(ids.count, values.count);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        uint32_t s = store.slot(id);
+        if ((store.known[s] & SHAPE_FIELD_COLOR) && store.color[s] == values.data[i]) {
+            updated++;
+            continue;
+        }
+        store.color[s] = values.data[i];
+        forwarded++;
+        if (shapeApplyColor(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_COLOR;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_set_visible(kind, ids, flags [, count]) - true or non-zero means visible
+static int lua_shapes_set_visible(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+
+    static std::vector<uint8_t> flagScratch;
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<uint8_t> values = luaL_checkbuffer(L, 3, flagScratch, count);
+    size_t n = std::min(ids.count, values.count);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        uint32_t s = store.slot(id);
+        uint8_t flag = values.data[i] ? 1 : 0;
+        if ((store.known[s] & SHAPE_FIELD_VISIBLE) && store.visible[s] == flag) {
+            updated++;
+            continue;
+        }
+        store.visible[s] = flag;
+        forwarded++;
+        if (shapeApplyVisible(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_VISIBLE;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_set_modes(SHAPE_RECT, ids, modes [, count]) - int32 gradient/pattern modes
+static int lua_shapes_set_modes(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    luaL_argcheck(L, kind == SHAPE_RECT, 1, "shape kind has no pattern mode");
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+
+    static std::vector<int32_t> modeScratch;
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<int32_t> values = luaL_checkbuffer(L, 3, modeScratch, count);
+    size_t n = std::min(ids.count, values.count);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        uint32_t s = store.slot(id);
+        if ((store.known[s] & SHAPE_FIELD_MODE) && store.mode[s] == values.data[i]) {
+            updated++;
+            continue;
+        }
+        store.mode[s] = values.data[i];
+        forwarded++;
+        if (shapeApplyMode(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_MODE;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_set_parameters(SHAPE_CIRCLE, ids, params [, count]) - three floats per circle
+static int lua_shapes_set_parameters(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    luaL_argcheck(L, kind == SHAPE_CIRCLE, 1, "shape kind has no pattern parameters");
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
+
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<float> values = luaL_checkbuffer(L, 3, g_bulkValues, count * 3);
+    size_t n = std::min(ids.count, values.count / 3);
+
+    ShapeStore& store = g_shapeStores[kind];
+    int updated = 0;
+    int forwarded = 0;
+    for (size_t i = 0; i < n; i++) {
+        int id = g_shapeHandles[kind].resolve(ids.data[i]);
+        if (id < 0) {
+            continue;
+        }
+        const float* v = values.data + i * 3;
+        uint32_t s = store.slot(id);
+        if ((store.known[s] & SHAPE_FIELD_PARAMS) && store.param1[s] == v[0] &&
+            store.param2[s] == v[1] && store.param3[s] == v[2]) {
+            updated++;
+            continue;
+        }
+        store.param1[s] = v[0];
+        store.param2[s] = v[1];
+        store.param3[s] = v[2];
+        forwarded++;
+        if (shapeApplyParameters(kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_PARAMS;
+            updated++;
+        } else {
+            store.remove(id);
+        }
+    }
+
+    shapeSubmitRecord(updated, forwarded);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+// shapes_get_frame_stats() -> {calls, instances, forwarded, lastCalls, lastInstances, lastForwarded}
+static int lua_shapes_get_frame_stats(lua_State* L) {
+    const ShapeSubmitStats& st = shapeSubmitStats();
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, st.calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushinteger(L, st.instances);
+    lua_setfield(L, -2, "instances");
+    lua_pushinteger(L, st.forwarded);
+    lua_setfield(L, -2, "forwarded");
+    lua_pushinteger(L, st.lastCalls);
+    lua_setfield(L, -2, "lastCalls");
+    lua_pushinteger(L, st.lastInstances);
+    lua_setfield(L, -2, "lastInstances");
+    lua_pushinteger(L, st.lastForwarded);
+    lua_setfield(L, -2, "lastForwarded");
+    return 1;
+}
+
+static int lua_shapes_count(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    lua_pushinteger(L, (lua_Integer)g_shapeStores[kind].ids.size());
+    return 1;
+}
+
+// =============================================================================
+// Shape Group API Bindings
+// =============================================================================
+
+// A shape attached to a group, positioned relative to the group origin.
+// handle is the generation-tagged ID the script passed, resolved on every
+// placement so a deleted shape drops out instead of moving whichever shape
+// the renderer reuses its ID for. localX2/localY2 hold the second endpoint
+// for lines; width/height hold the unscaled size (radius in width for
+// circles, polygons and stars) when given.
+struct ShapeGroupMember {
+    int kind;
+    lua_Integer handle;
+    float localX, localY;
+    float localX2, localY2;
+    float localRotation;
+    float width, height;
+};
+
+struct ShapeGroup {
+    int parent = 0;
+    float x = 0.0f, y = 0.0f, rotation = 0.0f, scale = 1.0f;      // relative to parent
+    float worldX = 0.0f, worldY = 0.0f, worldRotation = 0.0f, worldScale = 1.0f;
+    std::vector<ShapeGroupMember> members;
+    std::vector<int> children;
+};
+
+static SlotMap<ShapeGroup> g_shapeGroups;
+
+static ShapeGroup* findShapeGroup(int id) {
+    return id > 0 ? g_shapeGroups.get((uint32_t)id) : nullptr;
+}
+
+static ShapeGroup& luaL_checkshapegroup(lua_State* L, int idx) {
+    ShapeGroup* group = findShapeGroup(luaL_checkinteger(L, idx));
+    if (!group) {
+        luaL_argerror(L, idx, "invalid group id");
+    }
+    return *group;
+}
+
+static void shapeGroupDetach(int id, ShapeGroup& group) {
+    if (ShapeGroup* parent = findShapeGroup(group.parent)) {
+        auto& siblings = parent->children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), id), siblings.end());
+    }
+    group.parent = 0;
+}
+
+// Place one member using the group's world transform. Rects are positioned
+// by their top-left corner, so their centre is transformed and the corner
+// derived from it; other kinds are already centred. Returns false if the
+// member's shape no longer exists.
+static bool shapeGroupPlaceMember(const ShapeGroup& group, const ShapeGroupMember& m) {
+    int id = g_shapeHandles[m.kind].resolve(m.handle);
+    if (id < 0) {
+        return false;
+    }
+    float radians = group.worldRotation * 3.14159265f / 180.0f;
+    float c = cosf(radians) * group.worldScale;
+    float sn = sinf(radians) * group.worldScale;
+
+    float localX = m.localX;
+    float localY = m.localY;
+    float halfW = 0.0f;
+    float halfH = 0.0f;
+    if (m.kind == SHAPE_RECT) {
+        float w = m.width;
+        float h = m.height;
+        if (w <= 0.0f) {
+            auto size = g_rectSizes.find(id);
+            if (size != g_rectSizes.end()) {
+                w = size->second.first;
+                h = size->second.second;
+            }
+        }
+        localX += w * 0.5f;
+        localY += h * 0.5f;
+        float scale = m.width > 0.0f ? group.worldScale : 1.0f;
+        halfW = w * 0.5f * scale;
+        halfH = h * 0.5f * scale;
+    }
+
+    ShapeStore& store = g_shapeStores[m.kind];
+    uint32_t s = store.slot(id);
+    store.x[s] = group.worldX + localX * c - localY * sn - halfW;
+    store.y[s] = group.worldY + localX * sn + localY * c - halfH;
+    if (m.kind == SHAPE_LINE) {
+        store.x2[s] = group.worldX + m.localX2 * c - m.localY2 * sn;
+        store.y2[s] = group.worldY + m.localX2 * sn + m.localY2 * c;
+    }
+    if (!shapeApplyPosition(m.kind, id, store, s)) {
+        store.remove(id);
+        return false;
+    }
+    store.known[s] |= SHAPE_FIELD_POSITION;
+
+    if (m.kind == SHAPE_RECT || m.kind == SHAPE_POLYGON || m.kind == SHAPE_STAR) {
+        store.rotation[s] = group.worldRotation + m.localRotation;
+        if (shapeApplyRotation(m.kind, id, store, s)) {
+            store.known[s] |= SHAPE_FIELD_ROTATION;
+        }
+    }
+
+    if (m.width > 0.0f) {
+        float w = m.width * group.worldScale;
+        switch (m.kind) {
+            case SHAPE_RECT:
+                if (st_rect_set_size(id, w, m.height * group.worldScale)) {
+                    rectTrackSize(id, w, m.height * group.worldScale);
+                }
+                break;
+            case SHAPE_CIRCLE:  st_circle_set_radius(id, w); break;
+            case SHAPE_POLYGON: st_polygon_set_radius(id, w); break;
+            case SHAPE_STAR:    st_star_set_radius(id, w); break;
+        }
+    }
+    return true;
+}
+
+// Place every member of the group using its world transform, dropping
+// members whose shapes have been deleted.
+static int shapeGroupApplyMembers(ShapeGroup& group) {
+    int updated = 0;
+    auto& members = group.members;
+    members.erase(std::remove_if(members.begin(), members.end(), [&](const ShapeGroupMember& m) {
+        if (g_shapeHandles[m.kind].resolve(m.handle) < 0) {
+            return true;
+        }
+        if (shapeGroupPlaceMember(group, m)) {
+            updated++;
+        }
+        return false;
+    }), members.end());
+    return updated;
+}
+
+// Recompute the world transform of a group and its descendants, then place
+// their members. Returns the number of shapes updated.
+static int shapeGroupUpdate(int id) {
+    ShapeGroup* group = findShapeGroup(id);
+    if (!group) {
+        return 0;
+    }
+
+    if (ShapeGroup* parent = findShapeGroup(group->parent)) {
+        float radians = parent->worldRotation * 3.14159265f / 180.0f;
+        float c = cosf(radians) * parent->worldScale;
+        float sn = sinf(radians) * parent->worldScale;
+        group->worldX = parent->worldX + group->x * c - group->y * sn;
+        group->worldY = parent->worldY + group->x * sn + group->y * c;
+        group->worldRotation = parent->worldRotation + group->rotation;
+        group->worldScale = parent->worldScale * group->scale;
+    } else {
+        group->worldX = group->x;
+        group->worldY = group->y;
+        group->worldRotation = group->rotation;
+        group->worldScale = group->scale;
+    }
+
+    int updated = shapeGroupApplyMembers(*group);
+    for (int child : group->children) {
+        updated += shapeGroupUpdate(child);
+    }
+    return updated;
+}
+
+// group_create([parent]) -> group id
+static int lua_group_create(lua_State* L) {
+    int parent = luaL_optinteger(L, 1, 0);
+    if (parent != 0 && !findShapeGroup(parent)) {
+        return luaL_argerror(L, 1, "invalid parent group id");
+    }
+
+    ShapeGroup group;
+    group.parent = parent;
+    int id = (int)g_shapeGroups.insert(std::move(group));
+    if (id == 0) {
+        return luaL_error(L, "group_create: group limit reached");
+    }
+    if (ShapeGroup* p = findShapeGroup(parent)) {
+        p->children.push_back(id);
+    }
+
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+// group_add(group, kind, shapeId, localX, localY [, localRotation [, width [, height]]])
+// group_add(group, SHAPE_LINE, lineId, x1, y1, x2, y2)
+// Rect offsets name the top-left corner; rects rotate about their centre.
+// The member is placed under the group's current transform immediately.
+static int lua_group_add(lua_State* L) {
+    ShapeGroup& group = luaL_checkshapegroup(L, 1);
+    ShapeGroupMember m = {};
+    m.kind = luaL_checkshapekind(L, 2);
+    m.handle = luaL_checkinteger(L, 3);
+    if (g_shapeHandles[m.kind].resolve(m.handle) < 0) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    m.localX = (float)luaL_checknumber(L, 4);
+    m.localY = (float)luaL_checknumber(L, 5);
+
+    if (m.kind == SHAPE_LINE) {
+        m.localX2 = (float)luaL_checknumber(L, 6);
+        m.localY2 = (float)luaL_checknumber(L, 7);
+    } else {
+        m.localRotation = (float)luaL_optnumber(L, 6, 0.0);
+        m.width = (float)luaL_optnumber(L, 7, 0.0);
+        m.height = (float)luaL_optnumber(L, 8, m.width);
+    }
+
+    bool replaced = false;
+    for (ShapeGroupMember& existing : group.members) {
+        if (existing.kind == m.kind && existing.handle == m.handle) {
+            existing = m;
+            replaced = true;
+            break;
+        }
+    }
+    if (!replaced) {
+        group.members.push_back(m);
+    }
+    // Place the member under the group's current transform right away
+    lua_pushboolean(L, shapeGroupPlaceMember(group, m));
+    return 1;
+}
+
+static int lua_group_remove(lua_State* L) {
+    ShapeGroup& group = luaL_checkshapegroup(L, 1);
+    int kind = luaL_checkshapekind(L, 2);
+    lua_Integer handle = luaL_checkinteger(L, 3);
+
+    auto& members = group.members;
+    size_t before = members.size();
+    members.erase(std::remove_if(members.begin(), members.end(),
+                                 [&](const ShapeGroupMember& m) { return m.kind == kind && m.handle == handle; }),
+                  members.end());
+    lua_pushboolean(L, members.size() != before);
+    return 1;
+}
+
+// group_set_parent(group, parent) - parent 0 makes the group a root
+static int lua_group_set_parent(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    ShapeGroup& group = luaL_checkshapegroup(L, 1);
+    int parent = luaL_checkinteger(L, 2);
+
+    // Reject unknown parents and cycles
+    for (int p = parent; p != 0; ) {
+        ShapeGroup* ancestor = findShapeGroup(p);
+        if (!ancestor || p == id) {
+            lua_pushboolean(L, false);
+            return 1;
+        }
+        p = ancestor->parent;
+    }
+
+    shapeGroupDetach(id, group);
+    group.parent = parent;
+    if (ShapeGroup* p = findShapeGroup(parent)) {
+        p->children.push_back(id);
+    }
+    shapeGroupUpdate(id);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// group_set_transform(group, x, y [, rotation [, scale]]) -> shapes updated
+static int lua_group_set_transform(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    ShapeGroup& group = luaL_checkshapegroup(L, 1);
+    group.x = (float)luaL_checknumber(L, 2);
+    group.y = (float)luaL_checknumber(L, 3);
+    group.rotation = (float)luaL_optnumber(L, 4, 0.0);
+    group.scale = (float)luaL_optnumber(L, 5, 1.0);
+
+    int updated = shapeGroupUpdate(id);
+    shapeSubmitRecord(updated, updated);
+    lua_pushinteger(L, updated);
+    return 1;
+}
+
+static int lua_group_get_transform(lua_State* L) {
+    ShapeGroup& group = luaL_checkshapegroup(L, 1);
+    lua_pushnumber(L, group.x);
+    lua_pushnumber(L, group.y);
+    lua_pushnumber(L, group.rotation);
+    lua_pushnumber(L, group.scale);
+    return 4;
+}
+
+// group_delete(group) - member shapes are left in place, child groups become roots
+static int lua_group_delete(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    ShapeGroup* group = findShapeGroup(id);
+    if (!group) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    shapeGroupDetach(id, *group);
+    for (int child : group->children) {
+        if (ShapeGroup* c = findShapeGroup(child)) {
+            c->parent = 0;
+        }
+    }
+    g_shapeGroups.erase((uint32_t)id);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int lua_group_get_stats(lua_State* L) {
+    lua_pushslotmapstats(L, g_shapeGroups);
+    return 1;
+}
+
+// shapes_get_stats(kind) -> table of store and pool occupancy
+static int lua_shapes_get_stats(lua_State* L) {
+    int kind = luaL_checkshapekind(L, 1);
+    const ShapeStore& store = g_shapeStores[kind];
+    const ShapePoolStats& pool = g_shapePoolStats[kind];
+
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, (lua_Integer)store.ids.size());
+    lua_setfield(L, -2, "storeCount");
+    lua_pushinteger(L, (lua_Integer)store.highWater);
+    lua_setfield(L, -2, "storeHighWater");
+
+    if (kind == SHAPE_CIRCLE || kind == SHAPE_LINE) {
+        size_t count = (kind == SHAPE_CIRCLE) ? st_circle_count() : st_line_count();
+        size_t capacity = (kind == SHAPE_CIRCLE) ? st_circle_get_max() : st_line_get_max();
+        lua_pushinteger(L, (lua_Integer)count);
+        lua_setfield(L, -2, "count");
+        lua_pushinteger(L, (lua_Integer)capacity);
+        lua_setfield(L, -2, "capacity");
+        lua_pushinteger(L, (lua_Integer)pool.highWater);
+        lua_setfield(L, -2, "highWater");
+        lua_pushinteger(L, (lua_Integer)pool.grows);
+        lua_setfield(L, -2, "grows");
+    }
+    return 1;
+}
+
 // =============================================================================
 // Audio API Bindings
 // =============================================================================
@@ -3768,10 +5419,122 @@ static int lua_st_synth_frequency(lua_State* L) {
 // Voice Controller API Bindings
 // =============================================================================
 
+// Offline capture. Between voices_offline_start() and voices_offline_end()
+// voice calls are recorded into a timeline instead of reaching the live voice
+// controller, so the sequence can be rendered headless (see "Offline Voice
+// Rendering" below). voice_wait() advances the capture cursor by tempo.
+enum VoiceEventKind : uint8_t {
+    // Per-voice events; target is the voice number
+    VOICE_EVENT_WAVEFORM,
+    VOICE_EVENT_FREQUENCY,
+    VOICE_EVENT_ENVELOPE,
+    VOICE_EVENT_GATE,
+    VOICE_EVENT_VOLUME,
+    VOICE_EVENT_PULSE_WIDTH,
+    VOICE_EVENT_PAN,
+    VOICE_EVENT_FILTER_ROUTING,
+    VOICE_EVENT_RING_MOD,
+    VOICE_EVENT_SYNC,
+    VOICE_EVENT_PORTAMENTO,
+    VOICE_EVENT_DETUNE,
+    VOICE_EVENT_DELAY_ENABLE,
+    VOICE_EVENT_DELAY_TIME,
+    VOICE_EVENT_DELAY_FEEDBACK,
+    VOICE_EVENT_DELAY_MIX,
+    VOICE_EVENT_LFO_TO_PITCH,
+    VOICE_EVENT_LFO_TO_VOLUME,
+    VOICE_EVENT_LFO_TO_FILTER,
+    VOICE_EVENT_LFO_TO_PULSEWIDTH,
+    // Global events
+    VOICE_EVENT_FILTER_TYPE,
+    VOICE_EVENT_FILTER_CUTOFF,
+    VOICE_EVENT_FILTER_RESONANCE,
+    VOICE_EVENT_FILTER_ENABLED,
+    VOICE_EVENT_MASTER_VOLUME,
+    VOICE_EVENT_RESET_ALL,
+    // LFO events; target is the LFO number
+    VOICE_EVENT_LFO_WAVEFORM,
+    VOICE_EVENT_LFO_RATE,
+    VOICE_EVENT_LFO_RESET,
+};
+
+struct VoiceEvent {
+    double time;        // Seconds from the start of the capture
+    uint8_t kind;
+    int target;
+    int source;         // Ring/sync source voice or routed LFO
+    float value[4];
+};
+
+struct VoiceTimeline {
+    bool capturing = false;
+    double cursor = 0.0;
+    float bpm = 120.0f;
+    float masterVolume = 1.0f;
+    std::vector<VoiceEvent> events;
+};
+
+static VoiceTimeline g_voiceTimeline;
+
+// Tempo last given to the live voice controller, which has no getter; a
+// capture starts from it
+static float g_voiceTempo = 120.0f;
+
+// Returns true when the call was captured and must not reach the controller.
+static bool voiceCapture(uint8_t kind, int target, int source = -1,
+                         float a = 0.0f, float b = 0.0f, float c = 0.0f, float d = 0.0f) {
+    if (!g_voiceTimeline.capturing) {
+        return false;
+    }
+    VoiceEvent event;
+    event.time = g_voiceTimeline.cursor;
+    event.kind = kind;
+    event.target = target;
+    event.source = source;
+    event.value[0] = a;
+    event.value[1] = b;
+    event.value[2] = c;
+    event.value[3] = d;
+    g_voiceTimeline.events.push_back(event);
+    return true;
+}
+
+static float voiceNoteFrequency(int midiNote) {
+    return 440.0f * std::exp2((midiNote - 69) / 12.0f);
+}
+
+// Parses "C4", "F#3", "Bb-1" style note names into a MIDI note number.
+static bool voiceParseNoteName(const char* name, int* midiNote) {
+    static const int kSemitones[] = { 9, 11, 0, 2, 4, 5, 7 };  // A..G
+    char letter = (char)toupper((unsigned char)name[0]);
+    if (letter < 'A' || letter > 'G') {
+        return false;
+    }
+    int semitone = kSemitones[letter - 'A'];
+    const char* p = name + 1;
+    if (*p == '#') {
+        semitone++;
+        p++;
+    } else if (*p == 'b') {
+        semitone--;
+        p++;
+    }
+    char* end = nullptr;
+    long octave = strtol(p, &end, 10);
+    if (end == p || *end != '\0') {
+        return false;
+    }
+    *midiNote = (int)(octave + 1) * 12 + semitone;
+    return true;
+}
+
 // Voice basic controls
 static int lua_st_voice_set_waveform(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int waveform = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_WAVEFORM, voiceNum, -1, (float)waveform)) {
+        return 0;
+    }
     st_voice_set_waveform(voiceNum, waveform);
     return 0;
 }
@@ -3779,6 +5542,9 @@ static int lua_st_voice_set_waveform(lua_State* L) {
 static int lua_st_voice_set_frequency(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float frequency = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_FREQUENCY, voiceNum, -1, frequency)) {
+        return 0;
+    }
     st_voice_set_frequency(voiceNum, frequency);
     return 0;
 }
@@ -3786,6 +5552,9 @@ static int lua_st_voice_set_frequency(lua_State* L) {
 static int lua_st_voice_set_note(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int midiNote = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_FREQUENCY, voiceNum, -1, voiceNoteFrequency(midiNote))) {
+        return 0;
+    }
     st_voice_set_note(voiceNum, midiNote);
     return 0;
 }
@@ -3793,6 +5562,13 @@ static int lua_st_voice_set_note(lua_State* L) {
 static int lua_st_voice_set_note_name(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     const char* noteName = luaL_checkstring(L, 2);
+    if (g_voiceTimeline.capturing) {
+        int midiNote;
+        if (voiceParseNoteName(noteName, &midiNote)) {
+            voiceCapture(VOICE_EVENT_FREQUENCY, voiceNum, -1, voiceNoteFrequency(midiNote));
+        }
+        return 0;
+    }
     st_voice_set_note_name(voiceNum, noteName);
     return 0;
 }
@@ -3803,6 +5579,9 @@ static int lua_st_voice_set_envelope(lua_State* L) {
     float decay = (float)luaL_checknumber(L, 3);
     float sustain = (float)luaL_checknumber(L, 4);
     float release = (float)luaL_checknumber(L, 5);
+    if (voiceCapture(VOICE_EVENT_ENVELOPE, voiceNum, -1, attack, decay, sustain, release)) {
+        return 0;
+    }
     st_voice_set_envelope(voiceNum, attack, decay, sustain, release);
     return 0;
 }
@@ -3810,6 +5589,9 @@ static int lua_st_voice_set_envelope(lua_State* L) {
 static int lua_st_voice_set_gate(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int gateOn = lua_toboolean(L, 2);
+    if (voiceCapture(VOICE_EVENT_GATE, voiceNum, -1, (float)gateOn)) {
+        return 0;
+    }
     st_voice_set_gate(voiceNum, gateOn);
     return 0;
 }
@@ -3817,6 +5599,9 @@ static int lua_st_voice_set_gate(lua_State* L) {
 static int lua_st_voice_set_volume(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float volume = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_VOLUME, voiceNum, -1, volume)) {
+        return 0;
+    }
     st_voice_set_volume(voiceNum, volume);
     return 0;
 }
@@ -3824,6 +5609,9 @@ static int lua_st_voice_set_volume(lua_State* L) {
 static int lua_st_voice_set_pulse_width(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float pulseWidth = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_PULSE_WIDTH, voiceNum, -1, pulseWidth)) {
+        return 0;
+    }
     st_voice_set_pulse_width(voiceNum, pulseWidth);
     return 0;
 }
@@ -3831,6 +5619,9 @@ static int lua_st_voice_set_pulse_width(lua_State* L) {
 static int lua_st_voice_set_pan(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float pan = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_PAN, voiceNum, -1, pan)) {
+        return 0;
+    }
     st_voice_set_pan(voiceNum, pan);
     return 0;
 }
@@ -3839,30 +5630,45 @@ static int lua_st_voice_set_pan(lua_State* L) {
 static int lua_st_voice_set_filter_routing(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int enabled = lua_toboolean(L, 2);
+    if (voiceCapture(VOICE_EVENT_FILTER_ROUTING, voiceNum, -1, (float)enabled)) {
+        return 0;
+    }
     st_voice_set_filter_routing(voiceNum, enabled);
     return 0;
 }
 
 static int lua_st_voice_set_filter_type(lua_State* L) {
     int filterType = luaL_checkinteger(L, 1);
+    if (voiceCapture(VOICE_EVENT_FILTER_TYPE, -1, -1, (float)filterType)) {
+        return 0;
+    }
     st_voice_set_filter_type(filterType);
     return 0;
 }
 
 static int lua_st_voice_set_filter_cutoff(lua_State* L) {
     float cutoff = (float)luaL_checknumber(L, 1);
+    if (voiceCapture(VOICE_EVENT_FILTER_CUTOFF, -1, -1, cutoff)) {
+        return 0;
+    }
     st_voice_set_filter_cutoff(cutoff);
     return 0;
 }
 
 static int lua_st_voice_set_filter_resonance(lua_State* L) {
     float resonance = (float)luaL_checknumber(L, 1);
+    if (voiceCapture(VOICE_EVENT_FILTER_RESONANCE, -1, -1, resonance)) {
+        return 0;
+    }
     st_voice_set_filter_resonance(resonance);
     return 0;
 }
 
 static int lua_st_voice_set_filter_enabled(lua_State* L) {
     int enabled = lua_toboolean(L, 1);
+    if (voiceCapture(VOICE_EVENT_FILTER_ENABLED, -1, -1, (float)enabled)) {
+        return 0;
+    }
     st_voice_set_filter_enabled(enabled);
     return 0;
 }
@@ -3870,32 +5676,47 @@ static int lua_st_voice_set_filter_enabled(lua_State* L) {
 // Voice master controls
 static int lua_st_voice_set_master_volume(lua_State* L) {
     float volume = (float)luaL_checknumber(L, 1);
+    if (voiceCapture(VOICE_EVENT_MASTER_VOLUME, -1, -1, volume)) {
+        g_voiceTimeline.masterVolume = volume;
+        return 0;
+    }
     st_voice_set_master_volume(volume);
     return 0;
 }
 
 static int lua_st_voice_get_master_volume(lua_State* L) {
-    float volume = st_voice_get_master_volume();
+    float volume = g_voiceTimeline.capturing ? g_voiceTimeline.masterVolume
+                                             : st_voice_get_master_volume();
     lua_pushnumber(L, volume);
     return 1;
 }
 
 static int lua_st_voice_reset_all(lua_State* L) {
     (void)L;
+    if (voiceCapture(VOICE_EVENT_RESET_ALL, -1)) {
+        return 0;
+    }
     st_voice_reset_all();
     return 0;
 }
 
 static int lua_st_voice_wait(lua_State* L) {
     float beats = (float)luaL_checknumber(L, 1);
+    if (g_voiceTimeline.capturing) {
+        g_voiceTimeline.cursor += beats * 60.0 / g_voiceTimeline.bpm;
+        return 0;
+    }
     st_voice_wait(beats);
     return 0;
 }
 
-// Physical Modeling
+// Physical Modeling (not captured; physical voices render silent offline)
 static int lua_st_voice_set_physical_model(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int modelType = luaL_checkinteger(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_model(voiceNum, modelType);
     return 0;
 }
@@ -3903,6 +5724,9 @@ static int lua_st_voice_set_physical_model(lua_State* L) {
 static int lua_st_voice_set_physical_damping(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float damping = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_damping(voiceNum, damping);
     return 0;
 }
@@ -3910,6 +5734,9 @@ static int lua_st_voice_set_physical_damping(lua_State* L) {
 static int lua_st_voice_set_physical_brightness(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float brightness = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_brightness(voiceNum, brightness);
     return 0;
 }
@@ -3917,6 +5744,9 @@ static int lua_st_voice_set_physical_brightness(lua_State* L) {
 static int lua_st_voice_set_physical_excitation(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float excitation = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_excitation(voiceNum, excitation);
     return 0;
 }
@@ -3924,6 +5754,9 @@ static int lua_st_voice_set_physical_excitation(lua_State* L) {
 static int lua_st_voice_set_physical_resonance(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float resonance = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_resonance(voiceNum, resonance);
     return 0;
 }
@@ -3931,6 +5764,9 @@ static int lua_st_voice_set_physical_resonance(lua_State* L) {
 static int lua_st_voice_set_physical_tension(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float tension = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_tension(voiceNum, tension);
     return 0;
 }
@@ -3938,12 +5774,18 @@ static int lua_st_voice_set_physical_tension(lua_State* L) {
 static int lua_st_voice_set_physical_pressure(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float pressure = (float)luaL_checknumber(L, 2);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_set_physical_pressure(voiceNum, pressure);
     return 0;
 }
 
 static int lua_st_voice_physical_trigger(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
+    if (g_voiceTimeline.capturing) {
+        return 0;
+    }
     st_voice_physical_trigger(voiceNum);
     return 0;
 }
@@ -3952,6 +5794,9 @@ static int lua_st_voice_physical_trigger(lua_State* L) {
 static int lua_st_voice_set_ring_mod(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int sourceVoice = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_RING_MOD, voiceNum, sourceVoice)) {
+        return 0;
+    }
     st_voice_set_ring_mod(voiceNum, sourceVoice);
     return 0;
 }
@@ -3959,6 +5804,9 @@ static int lua_st_voice_set_ring_mod(lua_State* L) {
 static int lua_st_voice_set_sync(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int sourceVoice = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_SYNC, voiceNum, sourceVoice)) {
+        return 0;
+    }
     st_voice_set_sync(voiceNum, sourceVoice);
     return 0;
 }
@@ -3966,6 +5814,9 @@ static int lua_st_voice_set_sync(lua_State* L) {
 static int lua_st_voice_set_portamento(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float time = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_PORTAMENTO, voiceNum, -1, time)) {
+        return 0;
+    }
     st_voice_set_portamento(voiceNum, time);
     return 0;
 }
@@ -3973,6 +5824,9 @@ static int lua_st_voice_set_portamento(lua_State* L) {
 static int lua_st_voice_set_detune(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float cents = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_DETUNE, voiceNum, -1, cents)) {
+        return 0;
+    }
     st_voice_set_detune(voiceNum, cents);
     return 0;
 }
@@ -3981,6 +5835,9 @@ static int lua_st_voice_set_detune(lua_State* L) {
 static int lua_st_voice_set_delay_enable(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int enabled = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_DELAY_ENABLE, voiceNum, -1, (float)enabled)) {
+        return 0;
+    }
     st_voice_set_delay_enable(voiceNum, enabled);
     return 0;
 }
@@ -3988,6 +5845,9 @@ static int lua_st_voice_set_delay_enable(lua_State* L) {
 static int lua_st_voice_set_delay_time(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float time = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_DELAY_TIME, voiceNum, -1, time)) {
+        return 0;
+    }
     st_voice_set_delay_time(voiceNum, time);
     return 0;
 }
@@ -3995,6 +5855,9 @@ static int lua_st_voice_set_delay_time(lua_State* L) {
 static int lua_st_voice_set_delay_feedback(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float feedback = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_DELAY_FEEDBACK, voiceNum, -1, feedback)) {
+        return 0;
+    }
     st_voice_set_delay_feedback(voiceNum, feedback);
     return 0;
 }
@@ -4002,6 +5865,9 @@ static int lua_st_voice_set_delay_feedback(lua_State* L) {
 static int lua_st_voice_set_delay_mix(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     float mix = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_DELAY_MIX, voiceNum, -1, mix)) {
+        return 0;
+    }
     st_voice_set_delay_mix(voiceNum, mix);
     return 0;
 }
@@ -4010,6 +5876,9 @@ static int lua_st_voice_set_delay_mix(lua_State* L) {
 static int lua_st_lfo_set_waveform(lua_State* L) {
     int lfoNum = luaL_checkinteger(L, 1);
     int waveform = luaL_checkinteger(L, 2);
+    if (voiceCapture(VOICE_EVENT_LFO_WAVEFORM, lfoNum, -1, (float)waveform)) {
+        return 0;
+    }
     st_lfo_set_waveform(lfoNum, waveform);
     return 0;
 }
@@ -4017,12 +5886,18 @@ static int lua_st_lfo_set_waveform(lua_State* L) {
 static int lua_st_lfo_set_rate(lua_State* L) {
     int lfoNum = luaL_checkinteger(L, 1);
     float rateHz = (float)luaL_checknumber(L, 2);
+    if (voiceCapture(VOICE_EVENT_LFO_RATE, lfoNum, -1, rateHz)) {
+        return 0;
+    }
     st_lfo_set_rate(lfoNum, rateHz);
     return 0;
 }
 
 static int lua_st_lfo_reset(lua_State* L) {
     int lfoNum = luaL_checkinteger(L, 1);
+    if (voiceCapture(VOICE_EVENT_LFO_RESET, lfoNum)) {
+        return 0;
+    }
     st_lfo_reset(lfoNum);
     return 0;
 }
@@ -4031,6 +5906,9 @@ static int lua_st_lfo_to_pitch(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int lfoNum = luaL_checkinteger(L, 2);
     float depthCents = (float)luaL_checknumber(L, 3);
+    if (voiceCapture(VOICE_EVENT_LFO_TO_PITCH, voiceNum, lfoNum, depthCents)) {
+        return 0;
+    }
     st_lfo_to_pitch(voiceNum, lfoNum, depthCents);
     return 0;
 }
@@ -4039,6 +5917,9 @@ static int lua_st_lfo_to_volume(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int lfoNum = luaL_checkinteger(L, 2);
     float depth = (float)luaL_checknumber(L, 3);
+    if (voiceCapture(VOICE_EVENT_LFO_TO_VOLUME, voiceNum, lfoNum, depth)) {
+        return 0;
+    }
     st_lfo_to_volume(voiceNum, lfoNum, depth);
     return 0;
 }
@@ -4047,6 +5928,9 @@ static int lua_st_lfo_to_filter(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int lfoNum = luaL_checkinteger(L, 2);
     float depthHz = (float)luaL_checknumber(L, 3);
+    if (voiceCapture(VOICE_EVENT_LFO_TO_FILTER, voiceNum, lfoNum, depthHz)) {
+        return 0;
+    }
     st_lfo_to_filter(voiceNum, lfoNum, depthHz);
     return 0;
 }
@@ -4055,6 +5939,9 @@ static int lua_st_lfo_to_pulsewidth(lua_State* L) {
     int voiceNum = luaL_checkinteger(L, 1);
     int lfoNum = luaL_checkinteger(L, 2);
     float depth = (float)luaL_checknumber(L, 3);
+    if (voiceCapture(VOICE_EVENT_LFO_TO_PULSEWIDTH, voiceNum, lfoNum, depth)) {
+        return 0;
+    }
     st_lfo_to_pulsewidth(voiceNum, lfoNum, depth);
     return 0;
 }
@@ -4068,6 +5955,15 @@ static int lua_st_voices_start(lua_State* L) {
 
 static int lua_st_voices_set_tempo(lua_State* L) {
     float bpm = (float)luaL_checknumber(L, 1);
+    if (g_voiceTimeline.capturing) {
+        if (bpm > 0.0f) {
+            g_voiceTimeline.bpm = bpm;
+        }
+        return 0;
+    }
+    if (bpm > 0.0f) {
+        g_voiceTempo = bpm;
+    }
     st_voices_set_tempo(bpm);
     return 0;
 }
@@ -4129,12 +6025,931 @@ static int lua_st_vscript_save_to_bank(lua_State* L) {
 }
 
 // =============================================================================
-// Input API Bindings
+// Offline Voice Rendering
 // =============================================================================
 
-static int lua_st_key_pressed(lua_State* L) {
-    int key = luaL_checkinteger(L, 1);
-    lua_pushboolean(L, st_key_pressed((STKeyCode)key));
+// Headless renderer for captured voice timelines. It mirrors the live voice
+// graph (oscillators, ADSR, the shared filter settings, LFO routings, ring
+// mod, hard sync, portamento, delay, pan) closely enough to bounce a script
+// to PCM far faster than real time. Voices only depend on each other through
+// ring/sync sources, whose oscillators are re-simulated inside the dependent
+// voice, so each voice renders on its own worker and the mixes are summed.
+//
+// Synthesis runs in blocks of kOfflineBlock samples: LFOs, pitch modulation,
+// filter coefficients and gains are evaluated once per block, and the
+// per-sample kernels are flat loops over float arrays that the compiler can
+// vectorize.
+
+static const int kOfflineMaxLfos = 16;
+static const float kOfflineMaxDelay = 5.0f;
+static const int kOfflineBlock = 128;       // Samples per control-rate block
+
+// Deterministic per-cycle noise in [-1, 1), so sample-and-hold values do not
+// depend on how a worker stepped through the timeline.
+static float offlineNoise(uint64_t n) {
+    n ^= n >> 33;
+    n *= 0xff51afd7ed558ccdULL;
+    n ^= n >> 33;
+    n *= 0xc4ceb9fe1a85ec53ULL;
+    n ^= n >> 33;
+    return (float)((n >> 40) * (1.0 / 8388608.0)) - 1.0f;
+}
+
+static float offlineWave(int waveform, double phase, float pulseWidth, float noise) {
+    switch (waveform) {
+        case 1: return std::sin((float)(phase * 6.283185307179586));
+        case 2: return phase < 0.5 ? 1.0f : -1.0f;
+        case 3: return (float)(2.0 * phase - 1.0);
+        case 4: return (float)(phase < 0.5 ? 4.0 * phase - 1.0 : 3.0 - 4.0 * phase);
+        case 5: return noise;
+        case 6: return phase < pulseWidth ? 1.0f : -1.0f;
+        default: return 0.0f;
+    }
+}
+
+struct OfflineLfo {
+    int waveform = 1;
+    double rate = 1.0;
+    double phase = 0.0;
+    uint64_t cycle = 0;
+    uint64_t seed = 0;
+
+    float value() const {
+        return offlineWave(waveform, phase, 0.5f, offlineNoise(seed + cycle));
+    }
+
+    void advance(double seconds) {
+        phase += rate * seconds;
+        if (phase >= 1.0) {
+            double whole = std::floor(phase);
+            phase -= whole;
+            cycle += (uint64_t)whole;
+        }
+    }
+
+    void reset() {
+        phase = 0.0;
+        cycle = 0;
+    }
+};
+
+// polyBLEP residual for a unit step at phase 0; t is the phase in [0, 1) and
+// dt the per-sample phase increment.
+static inline float offlinePolyBlep(float t, float dt) {
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0f;
+    }
+    if (t > 1.0f - dt) {
+        t = (t - 1.0f) / dt;
+        return t * t + t + t + 1.0f;
+    }
+    return 0.0f;
+}
+
+struct OfflineOsc {
+    int waveform = 1;
+    double freq = 440.0;
+    double target = 440.0;
+    double glideStep = 1.0;
+    int64_t glideLeft = 0;
+    float glideTime = 0.0f;
+    float detune = 0.0f;
+    float pulseWidth = 0.5f;
+    int pitchLfo = -1;
+    float pitchDepth = 0.0f;
+    int pwLfo = -1;
+    float pwDepth = 0.0f;
+    double phase = 0.0;
+    uint64_t cycle = 0;
+    uint64_t seed = 0;
+
+    // Per-block scratch filled by advance()
+    float phases[kOfflineBlock];
+    float increments[kOfflineBlock];
+    float noise[kOfflineBlock];
+    uint8_t wraps[kOfflineBlock];
+
+    void setFrequency(double hz, double sampleRate) {
+        target = std::max(hz, 0.001);
+        glideLeft = (int64_t)(glideTime * sampleRate);
+        if (glideLeft > 0) {
+            glideStep = std::pow(target / freq, 1.0 / (double)glideLeft);
+        } else {
+            freq = target;
+        }
+    }
+
+    // Fast-forward portamento over samples that are not rendered.
+    void skip(int64_t samples) {
+        if (glideLeft > 0) {
+            int64_t n = std::min(samples, glideLeft);
+            freq *= std::pow(glideStep, (double)n);
+            glideLeft -= n;
+            if (glideLeft == 0) {
+                freq = target;
+            }
+        }
+    }
+
+    // Runs the phase accumulator for n samples. Pitch modulation is applied
+    // at block rate; `sync` flags the samples where hard sync restarts it.
+    void advance(int n, double sampleRate, const OfflineLfo* lfos, const uint8_t* sync) {
+        float cents = detune;
+        if (pitchLfo >= 0) {
+            cents += pitchDepth * lfos[pitchLfo].value();
+        }
+        double scale = (cents != 0.0f ? std::exp2(cents / 1200.0) : 1.0) / sampleRate;
+        bool noisy = waveform == 5;
+        for (int i = 0; i < n; i++) {
+            if (glideLeft > 0) {
+                freq = --glideLeft == 0 ? target : freq * glideStep;
+            }
+            if (sync && sync[i]) {
+                phase = 0.0;
+            }
+            double inc = freq * scale;
+            phases[i] = (float)phase;
+            increments[i] = (float)inc;
+            if (noisy) {
+                noise[i] = offlineNoise(seed + cycle);
+            }
+            phase += inc;
+            wraps[i] = phase >= 1.0;
+            if (wraps[i]) {
+                phase -= std::floor(phase);
+                cycle++;
+            }
+        }
+    }
+
+    // Shapes the phases from advance() into band-limited output. Saw, square
+    // and pulse edges are corrected with polyBLEP; the triangle's aliasing is
+    // already low enough to leave naive.
+    void shape(float* out, int n, const OfflineLfo* lfos) const {
+        switch (waveform) {
+            case 1:
+                for (int i = 0; i < n; i++) {
+                    out[i] = std::sin(phases[i] * 6.2831853f);
+                }
+                break;
+            case 2:
+                for (int i = 0; i < n; i++) {
+                    float t = phases[i];
+                    float half = t < 0.5f ? t + 0.5f : t - 0.5f;
+                    out[i] = (t < 0.5f ? 1.0f : -1.0f)
+                           + offlinePolyBlep(t, increments[i])
+                           - offlinePolyBlep(half, increments[i]);
+                }
+                break;
+            case 3:
+                for (int i = 0; i < n; i++) {
+                    out[i] = 2.0f * phases[i] - 1.0f - offlinePolyBlep(phases[i], increments[i]);
+                }
+                break;
+            case 4:
+                for (int i = 0; i < n; i++) {
+                    float t = phases[i];
+                    out[i] = t < 0.5f ? 4.0f * t - 1.0f : 3.0f - 4.0f * t;
+                }
+                break;
+            case 5:
+                std::copy(noise, noise + n, out);
+                break;
+            case 6: {
+                float pw = pulseWidth;
+                if (pwLfo >= 0) {
+                    pw = std::min(0.99f, std::max(0.01f, pw + pwDepth * lfos[pwLfo].value()));
+                }
+                for (int i = 0; i < n; i++) {
+                    float t = phases[i];
+                    float fall = t + 1.0f - pw;
+                    fall -= fall >= 1.0f ? 1.0f : 0.0f;
+                    out[i] = (t < pw ? 1.0f : -1.0f)
+                           + offlinePolyBlep(t, increments[i])
+                           - offlinePolyBlep(fall, increments[i]);
+                }
+                break;
+            }
+            default:
+                std::fill(out, out + n, 0.0f);
+                break;
+        }
+    }
+};
+
+struct OfflineEnvelope {
+    enum Stage { IDLE, ATTACK, DECAY, SUSTAIN, RELEASE };
+
+    float attack = 0.01f;
+    float decay = 0.1f;
+    float sustain = 0.7f;
+    float release = 0.2f;
+    Stage stage = IDLE;
+    float level = 0.0f;
+    float releaseStep = 0.0f;
+
+    void gate(bool on, double sampleRate) {
+        if (on) {
+            stage = ATTACK;
+        } else if (stage != IDLE) {
+            stage = RELEASE;
+            releaseStep = level / (float)std::max(1.0, release * sampleRate);
+        }
+    }
+
+    // Writes n envelope levels, as linear ramps between stage transitions.
+    void render(float* out, int n, double sampleRate) {
+        int i = 0;
+        while (i < n) {
+            float step = 0.0f;
+            float goal = 0.0f;
+            Stage after = stage;
+            switch (stage) {
+                case ATTACK:
+                    step = 1.0f / (float)std::max(1.0, attack * sampleRate);
+                    goal = 1.0f;
+                    after = DECAY;
+                    break;
+                case DECAY:
+                    step = -(1.0f - sustain) / (float)std::max(1.0, decay * sampleRate);
+                    goal = sustain;
+                    after = SUSTAIN;
+                    break;
+                case RELEASE:
+                    step = -releaseStep;
+                    goal = 0.0f;
+                    after = IDLE;
+                    break;
+                case SUSTAIN:
+                    level = sustain;
+                    std::fill(out + i, out + n, level);
+                    return;
+                case IDLE:
+                    std::fill(out + i, out + n, level);
+                    return;
+            }
+            float distance = goal - level;
+            if (step == 0.0f || distance * step <= 0.0f) {
+                level = goal;
+                stage = after;
+                continue;
+            }
+            // A tiny step can make the ramp longer than an int; only whether
+            // it ends inside this block matters
+            double ramp = std::ceil((double)distance / (double)step);
+            bool arrives = ramp <= (double)(n - i);
+            int count = arrives ? (int)ramp : n - i;
+            float start = level;
+            for (int k = 0; k < count; k++) {
+                out[i + k] = start + step * (float)(k + 1);
+            }
+            i += count;
+            if (arrives) {
+                out[i - 1] = goal;
+                level = goal;
+                stage = after;
+            } else {
+                level = start + step * (float)count;
+            }
+        }
+    }
+};
+
+// Topology-preserving state variable filter (trapezoidal integration). The
+// coefficients are updated at block rate and the response is picked by
+// mixing the outputs, so the per-sample loop has no branches.
+struct OfflineFilter {
+    float ic1 = 0.0f;
+    float ic2 = 0.0f;
+    float a1 = 0.0f;
+    float a2 = 0.0f;
+    float a3 = 0.0f;
+    float k = 2.0f;
+    float cutoff = -1.0f;
+    float resonance = -1.0f;
+
+    void setup(float hz, float res, double sampleRate) {
+        hz = std::min((float)(sampleRate * 0.45), std::max(20.0f, hz));
+        res = std::min(1.0f, std::max(0.0f, res));
+        if (hz == cutoff && res == resonance) {
+            return;
+        }
+        cutoff = hz;
+        resonance = res;
+        float g = std::tan((float)(3.141592653589793 * hz / sampleRate));
+        k = 2.0f - 1.96f * res;
+        a1 = 1.0f / (1.0f + g * (g + k));
+        a2 = g * a1;
+        a3 = g * a2;
+    }
+
+    void process(float* x, int n, int type) {
+        float mixInput = type == 2 ? 1.0f : 0.0f;
+        float mixBand = type == 2 ? -k : (type == 3 ? 1.0f : 0.0f);
+        float mixLow = type == 1 ? 1.0f : (type == 2 ? -1.0f : 0.0f);
+        float s1 = ic1;
+        float s2 = ic2;
+        for (int i = 0; i < n; i++) {
+            float v3 = x[i] - s2;
+            float v1 = a1 * s1 + a2 * v3;
+            float v2 = s2 + a2 * s1 + a3 * v3;
+            s1 = 2.0f * v1 - s1;
+            s2 = 2.0f * v2 - s2;
+            x[i] = mixInput * x[i] + mixBand * v1 + mixLow * v2;
+        }
+        ic1 = s1;
+        ic2 = s2;
+    }
+};
+
+struct OfflineGlobals {
+    int filterType = 0;
+    float filterCutoff = 1000.0f;
+    float filterResonance = 0.0f;
+    bool filterEnabled = false;
+    float masterVolume = 1.0f;
+    OfflineLfo lfos[kOfflineMaxLfos];
+};
+
+struct OfflineVoice {
+    OfflineOsc osc;
+    OfflineEnvelope env;
+    OfflineFilter filter;
+    float volume = 1.0f;
+    float pan = 0.0f;
+    bool filterRouted = false;
+    int ringSource = -1;
+    int syncSource = -1;
+    int volumeLfo = -1;
+    float volumeDepth = 0.0f;
+    int filterLfo = -1;
+    float filterDepth = 0.0f;
+    bool delayEnabled = false;
+    float delayTime = 0.25f;
+    float delayFeedback = 0.3f;
+    float delayMix = 0.3f;
+    std::vector<float> delayLine;
+    size_t delayPos = 0;
+};
+
+static int offlineLfoIndex(int lfoNum) {
+    return lfoNum >= 0 && lfoNum < kOfflineMaxLfos ? lfoNum : -1;
+}
+
+static bool offlineIsVoiceEvent(uint8_t kind) {
+    return kind < VOICE_EVENT_FILTER_TYPE;
+}
+
+// Events that shape an oscillator, and so also apply to ring/sync sources.
+static void offlineApplyOsc(OfflineOsc& osc, const VoiceEvent& event, double sampleRate) {
+    switch (event.kind) {
+        case VOICE_EVENT_WAVEFORM: osc.waveform = (int)event.value[0]; break;
+        case VOICE_EVENT_FREQUENCY: osc.setFrequency(event.value[0], sampleRate); break;
+        case VOICE_EVENT_PULSE_WIDTH:
+            osc.pulseWidth = std::min(0.99f, std::max(0.01f, event.value[0]));
+            break;
+        case VOICE_EVENT_PORTAMENTO: osc.glideTime = std::max(0.0f, event.value[0]); break;
+        case VOICE_EVENT_DETUNE: osc.detune = event.value[0]; break;
+        case VOICE_EVENT_LFO_TO_PITCH:
+            osc.pitchLfo = offlineLfoIndex(event.source);
+            osc.pitchDepth = event.value[0];
+            break;
+        case VOICE_EVENT_LFO_TO_PULSEWIDTH:
+            osc.pwLfo = offlineLfoIndex(event.source);
+            osc.pwDepth = event.value[0];
+            break;
+        default: break;
+    }
+}
+
+static void offlineApplyVoice(OfflineVoice& voice, const VoiceEvent& event, double sampleRate) {
+    offlineApplyOsc(voice.osc, event, sampleRate);
+    switch (event.kind) {
+        case VOICE_EVENT_ENVELOPE:
+            voice.env.attack = std::max(0.0f, event.value[0]);
+            voice.env.decay = std::max(0.0f, event.value[1]);
+            voice.env.sustain = std::min(1.0f, std::max(0.0f, event.value[2]));
+            voice.env.release = std::max(0.0f, event.value[3]);
+            break;
+        case VOICE_EVENT_GATE: voice.env.gate(event.value[0] != 0.0f, sampleRate); break;
+        case VOICE_EVENT_VOLUME: voice.volume = std::max(0.0f, event.value[0]); break;
+        case VOICE_EVENT_PAN: voice.pan = std::min(1.0f, std::max(-1.0f, event.value[0])); break;
+        case VOICE_EVENT_FILTER_ROUTING: voice.filterRouted = event.value[0] != 0.0f; break;
+        case VOICE_EVENT_RING_MOD:
+            voice.ringSource = event.source != event.target ? event.source : -1;
+            break;
+        case VOICE_EVENT_SYNC:
+            voice.syncSource = event.source != event.target ? event.source : -1;
+            break;
+        case VOICE_EVENT_DELAY_ENABLE: voice.delayEnabled = event.value[0] != 0.0f; break;
+        case VOICE_EVENT_DELAY_TIME:
+            voice.delayTime = std::min(kOfflineMaxDelay, std::max(0.0f, event.value[0]));
+            break;
+        case VOICE_EVENT_DELAY_FEEDBACK:
+            voice.delayFeedback = std::min(0.99f, std::max(0.0f, event.value[0]));
+            break;
+        case VOICE_EVENT_DELAY_MIX:
+            voice.delayMix = std::min(1.0f, std::max(0.0f, event.value[0]));
+            break;
+        case VOICE_EVENT_LFO_TO_VOLUME:
+            voice.volumeLfo = offlineLfoIndex(event.source);
+            voice.volumeDepth = event.value[0];
+            break;
+        case VOICE_EVENT_LFO_TO_FILTER:
+            voice.filterLfo = offlineLfoIndex(event.source);
+            voice.filterDepth = event.value[0];
+            break;
+        default: break;
+    }
+}
+
+static void offlineApplyGlobal(OfflineGlobals& globals, const VoiceEvent& event) {
+    int lfo = offlineLfoIndex(event.target);
+    switch (event.kind) {
+        case VOICE_EVENT_FILTER_TYPE: globals.filterType = (int)event.value[0]; break;
+        case VOICE_EVENT_FILTER_CUTOFF: globals.filterCutoff = event.value[0]; break;
+        case VOICE_EVENT_FILTER_RESONANCE: globals.filterResonance = event.value[0]; break;
+        case VOICE_EVENT_FILTER_ENABLED: globals.filterEnabled = event.value[0] != 0.0f; break;
+        case VOICE_EVENT_MASTER_VOLUME: globals.masterVolume = std::max(0.0f, event.value[0]); break;
+        case VOICE_EVENT_LFO_WAVEFORM:
+            if (lfo >= 0) globals.lfos[lfo].waveform = (int)event.value[0];
+            break;
+        case VOICE_EVENT_LFO_RATE:
+            if (lfo >= 0) globals.lfos[lfo].rate = std::max(0.0f, event.value[0]);
+            break;
+        case VOICE_EVENT_LFO_RESET:
+            if (lfo >= 0) globals.lfos[lfo].reset();
+            break;
+        default: break;
+    }
+}
+
+static void offlineAdvanceLfos(OfflineGlobals& globals, double seconds) {
+    for (OfflineLfo& lfo : globals.lfos) {
+        lfo.advance(seconds);
+    }
+}
+
+// Interleaved stereo mix shared by every render worker, summed in voice
+// order so the output does not depend on the thread count or on scheduling.
+// Each voice stages its output one stripe of the timeline at a time and adds
+// the stripe to the mix once every earlier voice has added its own, so memory
+// stays at one buffer plus one stripe per voice being rendered.
+class OfflineMixBus {
+public:
+    OfflineMixBus(float* pcm, int64_t frames)
+        : pcm_(pcm), frames_(frames), turns_((size_t)(frames / kStripeFrames + 1), 0) {}
+
+    // Output of the voice at position `order` of the mix. Voices must be
+    // started in order; finish() adds whatever is still staged.
+    class Voice {
+    public:
+        Voice(OfflineMixBus& bus, size_t order)
+            : bus_(bus), order_(order), staged_((size_t)kStripeFrames * 2, 0.0f) {}
+
+        void add(int64_t pos, const float* x, int n, float panL, float panR) {
+            while (n > 0) {
+                size_t stripe = (size_t)(pos / kStripeFrames);
+                while (stripe_ < stripe) {
+                    flush();
+                }
+                int64_t begin = (int64_t)stripe * kStripeFrames;
+                int count = (int)std::min<int64_t>(n, begin + kStripeFrames - pos);
+                float* out = staged_.data() + (pos - begin) * 2;
+                for (int i = 0; i < count; i++) {
+                    out[i * 2] += x[i] * panL;
+                    out[i * 2 + 1] += x[i] * panR;
+                }
+                dirty_ = true;
+                pos += count;
+                x += count;
+                n -= count;
+            }
+        }
+
+        void finish() {
+            while (stripe_ < bus_.turns_.size()) {
+                flush();
+            }
+        }
+
+    private:
+        void flush() {
+            bus_.commit(stripe_++, order_, dirty_ ? staged_.data() : nullptr);
+            if (dirty_) {
+                std::fill(staged_.begin(), staged_.end(), 0.0f);
+                dirty_ = false;
+            }
+        }
+
+        OfflineMixBus& bus_;
+        size_t order_;
+        size_t stripe_ = 0;
+        bool dirty_ = false;
+        std::vector<float> staged_;
+    };
+
+private:
+    static const int64_t kStripeFrames = 8192;
+
+    // Waits for the voices before `order` to add the stripe, then adds this
+    // voice's part (none when staged is null) and passes the turn on
+    void commit(size_t stripe, size_t order, const float* staged) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            turnPassed_.wait(lock, [&] { return turns_[stripe] == order; });
+        }
+        if (staged) {
+            int64_t begin = (int64_t)stripe * kStripeFrames;
+            int64_t n = std::min<int64_t>(kStripeFrames, frames_ - begin) * 2;
+            float* out = pcm_ + begin * 2;
+            for (int64_t i = 0; i < n; i++) {
+                out[i] += staged[i];
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            turns_[stripe]++;
+        }
+        turnPassed_.notify_all();
+    }
+
+    float* pcm_;
+    int64_t frames_;
+    std::vector<size_t> turns_;     // Voices that have added each stripe
+    std::mutex mutex_;
+    std::condition_variable turnPassed_;
+};
+
+// Renders one voice of the timeline and adds it into the shared mix at
+// position `order`.
+static void offlineRenderVoice(const std::vector<VoiceEvent>& events,
+                               const std::vector<int64_t>& eventFrames,
+                               int voiceNum, double sampleRate, int64_t frames,
+                               OfflineMixBus& bus, size_t order) {
+    OfflineMixBus::Voice mix(bus, order);
+    OfflineGlobals globals;
+    for (int i = 0; i < kOfflineMaxLfos; i++) {
+        globals.lfos[i].seed = (uint64_t)(i + 1) << 40;
+    }
+    OfflineVoice voice;
+    voice.osc.seed = (uint64_t)(voiceNum + 1) << 48;
+
+    // Oscillators this voice reads for ring mod or hard sync
+    std::map<int, OfflineOsc> sources;
+    float maxDelay = 0.0f;
+    for (const VoiceEvent& event : events) {
+        if (event.target != voiceNum) continue;
+        if ((event.kind == VOICE_EVENT_RING_MOD || event.kind == VOICE_EVENT_SYNC) &&
+            event.source != voiceNum) {
+            sources[event.source].seed = (uint64_t)(event.source + 1) << 48;
+        } else if (event.kind == VOICE_EVENT_DELAY_TIME) {
+            maxDelay = std::max(maxDelay, std::min(kOfflineMaxDelay, event.value[0]));
+        }
+    }
+    if (maxDelay <= 0.0f) {
+        maxDelay = voice.delayTime;
+    }
+    voice.delayLine.assign((size_t)(maxDelay * sampleRate) + 1, 0.0f);
+
+    size_t next = 0;
+    int64_t pos = 0;
+    float x[kOfflineBlock];
+    float env[kOfflineBlock];
+    while (pos < frames) {
+        while (next < events.size() && eventFrames[next] <= pos) {
+            const VoiceEvent& event = events[next++];
+            if (!offlineIsVoiceEvent(event.kind)) {
+                offlineApplyGlobal(globals, event);
+                if (event.kind == VOICE_EVENT_RESET_ALL) {
+                    OfflineVoice fresh;
+                    fresh.osc.seed = voice.osc.seed;
+                    fresh.delayLine.swap(voice.delayLine);
+                    std::fill(fresh.delayLine.begin(), fresh.delayLine.end(), 0.0f);
+                    voice = std::move(fresh);
+                    for (auto& source : sources) {
+                        OfflineOsc osc;
+                        osc.seed = source.second.seed;
+                        source.second = osc;
+                    }
+                }
+            } else if (event.target == voiceNum) {
+                offlineApplyVoice(voice, event, sampleRate);
+            } else {
+                auto source = sources.find(event.target);
+                if (source != sources.end()) {
+                    offlineApplyOsc(source->second, event, sampleRate);
+                }
+            }
+        }
+        int64_t end = next < events.size() ? std::min(frames, eventFrames[next]) : frames;
+
+        // Silent stretch: nothing audible until the next event
+        if (voice.env.stage == OfflineEnvelope::IDLE && !voice.delayEnabled) {
+            voice.osc.skip(end - pos);
+            for (auto& source : sources) {
+                source.second.skip(end - pos);
+            }
+            offlineAdvanceLfos(globals, (end - pos) / sampleRate);
+            pos = end;
+            continue;
+        }
+
+        // One block; modulation and routing are held for its duration
+        int n = (int)std::min<int64_t>(kOfflineBlock, end - pos);
+        OfflineOsc* ring = nullptr;
+        OfflineOsc* sync = nullptr;
+        if (voice.ringSource >= 0) {
+            auto it = sources.find(voice.ringSource);
+            ring = it != sources.end() ? &it->second : nullptr;
+        }
+        if (voice.syncSource >= 0) {
+            auto it = sources.find(voice.syncSource);
+            sync = it != sources.end() ? &it->second : nullptr;
+        }
+        for (auto& source : sources) {
+            source.second.advance(n, sampleRate, globals.lfos, nullptr);
+        }
+        voice.osc.advance(n, sampleRate, globals.lfos, sync ? sync->wraps : nullptr);
+        voice.osc.shape(x, n, globals.lfos);
+        if (ring) {
+            for (int i = 0; i < n; i++) {
+                x[i] *= ring->phases[i] < 0.5f ? 1.0f : -1.0f;
+            }
+        }
+        if (voice.filterRouted && globals.filterEnabled && globals.filterType != 0) {
+            float cutoff = globals.filterCutoff;
+            if (voice.filterLfo >= 0) {
+                cutoff += voice.filterDepth * globals.lfos[voice.filterLfo].value();
+            }
+            voice.filter.setup(cutoff, globals.filterResonance, sampleRate);
+            voice.filter.process(x, n, globals.filterType);
+        }
+
+        float gain = voice.volume * globals.masterVolume;
+        if (voice.volumeLfo >= 0) {
+            gain *= std::max(0.0f, 1.0f + voice.volumeDepth * globals.lfos[voice.volumeLfo].value());
+        }
+        voice.env.render(env, n, sampleRate);
+        for (int i = 0; i < n; i++) {
+            x[i] *= env[i] * gain;
+        }
+        if (voice.delayEnabled) {
+            size_t size = voice.delayLine.size();
+            size_t delaySamples = (size_t)std::max(1, std::min((int)size - 1,
+                                                               (int)(voice.delayTime * sampleRate)));
+            for (int i = 0; i < n; i++) {
+                size_t read = voice.delayPos >= delaySamples ? voice.delayPos - delaySamples
+                                                             : voice.delayPos + size - delaySamples;
+                float wet = voice.delayLine[read];
+                voice.delayLine[voice.delayPos] = x[i] + wet * voice.delayFeedback;
+                voice.delayPos = voice.delayPos + 1 == size ? 0 : voice.delayPos + 1;
+                x[i] = x[i] * (1.0f - voice.delayMix) + wet * voice.delayMix;
+            }
+        }
+
+        float angle = (voice.pan + 1.0f) * 0.7853981633974483f;
+        float panL = std::cos(angle);
+        float panR = std::sin(angle);
+        mix.add(pos, x, n, panL, panR);
+        offlineAdvanceLfos(globals, n / sampleRate);
+        pos += n;
+    }
+    mix.finish();
+}
+
+// Length of audio left ringing after the last captured event.
+static double offlineTailSeconds(const std::vector<VoiceEvent>& events) {
+    float release = 0.2f;
+    double delay = 0.0;
+    std::unordered_map<int, std::pair<float, float>> delays;  // time, feedback
+    for (const VoiceEvent& event : events) {
+        if (event.kind == VOICE_EVENT_ENVELOPE) {
+            release = std::max(release, event.value[3]);
+        } else if (event.kind == VOICE_EVENT_DELAY_ENABLE && event.value[0] != 0.0f) {
+            delays.emplace(event.target, std::make_pair(0.25f, 0.3f));
+        } else if (event.kind == VOICE_EVENT_DELAY_TIME || event.kind == VOICE_EVENT_DELAY_FEEDBACK) {
+            auto& entry = delays.emplace(event.target, std::make_pair(0.25f, 0.3f)).first->second;
+            if (event.kind == VOICE_EVENT_DELAY_TIME) {
+                entry.first = std::max(entry.first, std::min(kOfflineMaxDelay, event.value[0]));
+            } else {
+                entry.second = std::max(entry.second, std::min(0.99f, event.value[0]));
+            }
+        }
+    }
+    for (const auto& entry : delays) {
+        // Repeats until the echo falls below -60 dB
+        double repeats = std::ceil(std::log(0.001) / std::log(std::max(0.01f, entry.second.second)));
+        delay = std::max(delay, entry.second.first * repeats);
+    }
+    return std::min(30.0, release + delay);
+}
+
+struct VoiceRenderStats {
+    int voices = 0;
+    int threads = 0;
+    double seconds = 0.0;         // Audio rendered
+    double renderSeconds = 0.0;   // Wall clock
+    double voiceSeconds = 0.0;    // Summed CPU time spent inside voices
+};
+
+// CPU time consumed by the calling thread, in seconds. Unlike wall time it
+// does not grow while a worker waits for a core or a mix stripe.
+static double offlineThreadCpuSeconds() {
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0.0;
+    }
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static VoiceRenderStats g_voiceRenderStats;
+
+// Renders the timeline to interleaved stereo float PCM across `threads`
+// workers (0 = one per core). Returns the rendered length in seconds.
+static double offlineRenderTimeline(const VoiceTimeline& timeline, double sampleRate,
+                                    int threads, std::vector<float>& pcm) {
+    const std::vector<VoiceEvent>& events = timeline.events;
+    double seconds = timeline.cursor + offlineTailSeconds(events);
+    int64_t frames = (int64_t)std::ceil(seconds * sampleRate);
+    pcm.assign((size_t)frames * 2, 0.0f);
+
+    std::vector<int64_t> eventFrames(events.size());
+    std::vector<int> voices;
+    for (size_t i = 0; i < events.size(); i++) {
+        eventFrames[i] = (int64_t)std::llround(events[i].time * sampleRate);
+        if (offlineIsVoiceEvent(events[i].kind)) {
+            voices.push_back(events[i].target);
+        }
+    }
+    std::sort(voices.begin(), voices.end());
+    voices.erase(std::unique(voices.begin(), voices.end()), voices.end());
+    g_voiceRenderStats = VoiceRenderStats();
+    g_voiceRenderStats.voices = (int)voices.size();
+    g_voiceRenderStats.seconds = seconds;
+    if (voices.empty()) {
+        return seconds;
+    }
+
+    if (threads <= 0) {
+        threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, (int)voices.size());
+    OfflineMixBus mix(pcm.data(), frames);
+    std::vector<double> busy(threads, 0.0);
+    std::atomic<size_t> nextVoice(0);
+    auto work = [&](double* cpu) {
+        for (size_t v = nextVoice++; v < voices.size(); v = nextVoice++) {
+            double start = offlineThreadCpuSeconds();
+            offlineRenderVoice(events, eventFrames, voices[v], sampleRate, frames, mix, v);
+            *cpu += offlineThreadCpuSeconds() - start;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads - 1; t++) {
+        workers.emplace_back(work, &busy[t + 1]);
+    }
+    work(&busy[0]);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    g_voiceRenderStats.threads = threads;
+    for (double cpu : busy) {
+        g_voiceRenderStats.voiceSeconds += cpu;
+    }
+    return seconds;
+}
+
+// 16-bit stereo PCM WAV.
+static bool offlineWriteWav(const char* filename, const std::vector<float>& pcm, int sampleRate) {
+    // RIFF sizes are 32-bit: the data chunk plus 36 header bytes must fit
+    if (pcm.size() > (UINT32_MAX - 36) / 2) {
+        return false;
+    }
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    uint32_t dataBytes = (uint32_t)(pcm.size() * 2);
+    std::vector<uint8_t> out;
+    out.reserve(44 + dataBytes);
+    auto put = [&out](uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back((uint8_t)(value >> (8 * i)));
+        }
+    };
+    out.insert(out.end(), { 'R', 'I', 'F', 'F' });
+    put(36 + dataBytes, 4);
+    out.insert(out.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    put(16, 4);
+    put(1, 2);                        // PCM
+    put(2, 2);                        // Channels
+    put((uint32_t)sampleRate, 4);
+    put((uint32_t)sampleRate * 4, 4); // Byte rate
+    put(4, 2);                        // Block align
+    put(16, 2);                       // Bits per sample
+    out.insert(out.end(), { 'd', 'a', 't', 'a' });
+    put(dataBytes, 4);
+    for (float sample : pcm) {
+        float clamped = std::min(1.0f, std::max(-1.0f, sample));
+        put((uint32_t)(uint16_t)(int16_t)std::lrint(clamped * 32767.0f), 2);
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+// voices_offline_render([filename[, sampleRate[, threads]]])
+// Renders the captured timeline. Returns true (written to a WAV file) or the
+// interleaved stereo float32 PCM as a string, then the length in seconds and
+// the real-time factor (audio seconds per wall-clock second); nil on failure.
+static int lua_st_voices_offline_render(lua_State* L) {
+    const char* filename = luaL_optstring(L, 1, nullptr);
+    int sampleRate = (int)luaL_optinteger(L, 2, 48000);
+    int threads = (int)luaL_optinteger(L, 3, 0);
+    if (sampleRate < 8000 || sampleRate > 192000 || g_voiceTimeline.capturing) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> pcm;
+    double seconds = offlineRenderTimeline(g_voiceTimeline, sampleRate, threads, pcm);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    g_voiceRenderStats.renderSeconds = elapsed;
+    if (pcm.empty()) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    if (filename) {
+        if (!offlineWriteWav(filename, pcm, sampleRate)) {
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_pushboolean(L, 1);
+    } else {
+        lua_pushlstring(L, (const char*)pcm.data(), pcm.size() * sizeof(float));
+    }
+    lua_pushnumber(L, seconds);
+    lua_pushnumber(L, elapsed > 0.0 ? seconds / elapsed : 0.0);
+    return 3;
+}
+
+static int lua_st_voices_offline_start(lua_State* L) {
+    (void)L;
+    g_voiceTimeline = VoiceTimeline();
+    g_voiceTimeline.bpm = g_voiceTempo;
+    g_voiceTimeline.capturing = true;
+    return 0;
+}
+
+// voices_offline_end([filename[, sampleRate[, threads]]]) - stop capturing and render
+static int lua_st_voices_offline_end(lua_State* L) {
+    g_voiceTimeline.capturing = false;
+    return lua_st_voices_offline_render(L);
+}
+
+static int lua_st_voices_offline_is_capturing(lua_State* L) {
+    lua_pushboolean(L, g_voiceTimeline.capturing);
+    return 1;
+}
+
+// voices_offline_stats() - cost of the last offline render. voiceCost is the
+// CPU seconds one voice takes per second of audio, so voicesPerCore is the
+// polyphony a single core could sustain in real time.
+static int lua_st_voices_offline_stats(lua_State* L) {
+    const VoiceRenderStats& stats = g_voiceRenderStats;
+    double voiceCost = stats.voices > 0 && stats.seconds > 0.0
+        ? stats.voiceSeconds / (stats.voices * stats.seconds) : 0.0;
+    lua_newtable(L);
+    lua_pushinteger(L, stats.voices);
+    lua_setfield(L, -2, "voices");
+    lua_pushinteger(L, stats.threads);
+    lua_setfield(L, -2, "threads");
+    lua_pushinteger(L, kOfflineBlock);
+    lua_setfield(L, -2, "blockSize");
+    lua_pushnumber(L, stats.seconds);
+    lua_setfield(L, -2, "seconds");
+    lua_pushnumber(L, stats.renderSeconds);
+    lua_setfield(L, -2, "renderSeconds");
+    lua_pushnumber(L, stats.renderSeconds > 0.0 ? stats.seconds / stats.renderSeconds : 0.0);
+    lua_setfield(L, -2, "realtimeFactor");
+    lua_pushnumber(L, voiceCost);
+    lua_setfield(L, -2, "voiceCost");
+    lua_pushnumber(L, voiceCost > 0.0 ? 1.0 / voiceCost : 0.0);
+    lua_setfield(L, -2, "voicesPerCore");
+    return 1;
+}
+
+// =============================================================================
+// Input API Bindings
+// =============================================================================
+
+static int lua_st_key_pressed(lua_State* L) {
+    int key = luaL_checkinteger(L, 1);
+    lua_pushboolean(L, st_key_pressed((STKeyCode)key));
     return 1;
 }
 
@@ -4206,14 +7021,15 @@ static int lua_st_mouse_button_just_released(lua_State* L) {
 // =============================================================================
 
 static int lua_st_wait_frame(lua_State* L) {
-    (void)L;
     st_wait_frame();
+    frameUpdate(L);
     return 0;
 }
 
 static int lua_st_wait_frames(lua_State* L) {
     int count = luaL_checkinteger(L, 1);
     st_wait_frames(count);
+    frameUpdate(L);
     return 0;
 }
 
@@ -4769,6 +7585,29 @@ static int lua_st_sprite_set_standard_palette(lua_State* L) {
 // Sprite-based Particle Explosion API (v1 compatible)
 // =============================================================================
 
+// Validation limits for the sprite_explode family. Counts are passed to the
+// particle system as uint16_t, which bounds how far they can be raised.
+static int g_explodeMaxSpriteId = 1024;
+static int g_explodeMaxParticles = 500;
+
+// sprite_explode_set_limits(maxSpriteId, maxParticles)
+static int lua_sprite_explode_set_limits(lua_State* L) {
+    int max_sprite_id = luaL_checkinteger(L, 1);
+    int max_particles = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, max_sprite_id >= 1 && max_sprite_id <= 65535, 1, "must be between 1 and 65535");
+    luaL_argcheck(L, max_particles >= 1 && max_particles <= 65535, 2, "must be between 1 and 65535");
+
+    g_explodeMaxSpriteId = max_sprite_id;
+    g_explodeMaxParticles = max_particles;
+    return 0;
+}
+
+static int lua_sprite_explode_get_limits(lua_State* L) {
+    lua_pushinteger(L, g_explodeMaxSpriteId);
+    lua_pushinteger(L, g_explodeMaxParticles);
+    return 2;
+}
+
 static int lua_sprite_explode(lua_State* L) {
     int sprite_id = luaL_checkinteger(L, 1);
     int particle_count = 32; // Default
@@ -4785,12 +7624,12 @@ static int lua_sprite_explode(lua_State* L) {
     }
 
     // Validate parameters
-    if (sprite_id < 1 || sprite_id > 1024) {
-        return luaL_error(L, "sprite_explode: sprite_id must be between 1 and 1024");
+    if (sprite_id < 1 || sprite_id > g_explodeMaxSpriteId) {
+        return luaL_error(L, "sprite_explode: sprite_id must be between 1 and %d", g_explodeMaxSpriteId);
     }
 
-    if (particle_count < 1 || particle_count > 500) {
-        return luaL_error(L, "sprite_explode: particle_count must be between 1 and 500");
+    if (particle_count < 1 || particle_count > g_explodeMaxParticles) {
+        return luaL_error(L, "sprite_explode: particle_count must be between 1 and %d", g_explodeMaxParticles);
     }
 
     bool result = sprite_explode((uint16_t)sprite_id, (uint16_t)particle_count);
@@ -4819,12 +7658,12 @@ static int lua_sprite_explode_advanced(lua_State* L) {
     }
 
     // Validate parameters
-    if (sprite_id < 1 || sprite_id > 1024) {
-        return luaL_error(L, "sprite_explode_advanced: sprite_id must be between 1 and 1024");
+    if (sprite_id < 1 || sprite_id > g_explodeMaxSpriteId) {
+        return luaL_error(L, "sprite_explode_advanced: sprite_id must be between 1 and %d", g_explodeMaxSpriteId);
     }
 
-    if (particle_count < 1 || particle_count > 500) {
-        return luaL_error(L, "sprite_explode_advanced: particle_count must be between 1 and 500");
+    if (particle_count < 1 || particle_count > g_explodeMaxParticles) {
+        return luaL_error(L, "sprite_explode_advanced: particle_count must be between 1 and %d", g_explodeMaxParticles);
     }
 
     bool result = sprite_explode_advanced((uint16_t)sprite_id, (uint16_t)particle_count,
@@ -4840,12 +7679,12 @@ static int lua_sprite_explode_directional(lua_State* L) {
     float force_y = luaL_checknumber(L, 4);
 
     // Validate parameters
-    if (sprite_id < 1 || sprite_id > 1024) {
-        return luaL_error(L, "sprite_explode_directional: sprite_id must be between 1 and 1024");
+    if (sprite_id < 1 || sprite_id > g_explodeMaxSpriteId) {
+        return luaL_error(L, "sprite_explode_directional: sprite_id must be between 1 and %d", g_explodeMaxSpriteId);
     }
 
-    if (particle_count < 1 || particle_count > 500) {
-        return luaL_error(L, "sprite_explode_directional: particle_count must be between 1 and 500");
+    if (particle_count < 1 || particle_count > g_explodeMaxParticles) {
+        return luaL_error(L, "sprite_explode_directional: particle_count must be between 1 and %d", g_explodeMaxParticles);
     }
 
     bool result = sprite_explode_directional((uint16_t)sprite_id, (uint16_t)particle_count,
@@ -4859,8 +7698,8 @@ static int lua_sprite_explode_mode(lua_State* L) {
     int explosion_mode = luaL_checkinteger(L, 2);
 
     // Validate sprite ID
-    if (sprite_id < 1 || sprite_id > 1024) {
-        return luaL_error(L, "sprite_explode_mode: sprite_id must be between 1 and 1024");
+    if (sprite_id < 1 || sprite_id > g_explodeMaxSpriteId) {
+        return luaL_error(L, "sprite_explode_mode: sprite_id must be between 1 and %d", g_explodeMaxSpriteId);
     }
 
     // Validate explosion mode
@@ -4902,826 +7741,6341 @@ static int lua_sprite_explode_mode(lua_State* L) {
 // Asset Management API Bindings
 // =============================================================================
 
-// Initialization
-static int lua_st_asset_init(lua_State* L) {
-    const char* db_path = luaL_checkstring(L, 1);
-    size_t max_cache_size = luaL_optinteger(L, 2, 0);
-
-    bool result = st_asset_init(db_path, max_cache_size);
-    lua_pushboolean(L, result);
-    return 1;
-}
+// Views handed out by asset.getView. The asset manager may evict or move
+// asset data inside any st_asset_* call, so the pointer is fetched afresh on
+// every getView and is only valid until the next asset call. An entry here
+// pins the asset against the bindings' own residency eviction until the view
+// is released, the asset unloaded or deleted, or the cache cleared or resized.
+struct AssetView {
+    const void* data;
+    size_t size;
+};
 
-static int lua_st_asset_shutdown(lua_State* L) {
-    (void)L;
-    st_asset_shutdown();
-    return 0;
-}
+static std::unordered_map<STAssetID, AssetView> g_assetViews;
 
-static int lua_st_asset_is_initialized(lua_State* L) {
-    (void)L;
-    bool result = st_asset_is_initialized();
-    lua_pushboolean(L, result);
-    return 1;
-}
+// Serializes st_asset_* calls between the script thread and async loaders
+static std::mutex g_assetMutex;
 
-// Loading/Unloading
-static int lua_st_asset_load(lua_State* L) {
-    const char* name = luaL_checkstring(L, 1);
+static void assetStopLoaders();
 
-    STAssetID asset = st_asset_load(name);
-    lua_pushinteger(L, asset);
-    return 1;
-}
+// Access trace recorded between asset.traceStart and asset.traceStop
+struct AssetTrace {
+    bool active = false;
+    std::vector<std::string> order;
+    std::unordered_set<std::string> seen;
 
-static int lua_st_asset_load_file(lua_State* L) {
-    const char* path = luaL_checkstring(L, 1);
-    int type = luaL_checkinteger(L, 2);
+    void record(const char* name) {
+        if (active && seen.insert(name).second) {
+            order.emplace_back(name);
+        }
+    }
+};
 
-    STAssetID asset = st_asset_load_file(path, (STAssetType)type);
-    lua_pushinteger(L, asset);
-    return 1;
-}
+static AssetTrace g_assetTrace;
 
-static int lua_st_asset_unload(lua_State* L) {
-    STAssetID asset = luaL_checkinteger(L, 1);
-    st_asset_unload(asset);
-    return 0;
-}
+// Binding-side residency tracking for loaded assets. Each asset type can have
+// its own byte budget, which bounds the loads the bindings hold on their own
+// (prefetches no script load references). When those exceed the budget,
+// victims of that type are chosen by the eviction policy and unloaded, so a
+// burst of prefetched music cannot push out prefetched sprites.
+//
+// Every script load of an asset counts as a reference until the matching
+// asset.unload, and referenced assets are never evicted, so IDs the script
+// holds stay valid. Their bytes are reported as pinned and do not count
+// against the budget; pinned bytes beyond the budget are reported as
+// pressure for the script to act on. The asset manager's own cache and its
+// global limit (asset.setMaxCacheSize) still decide underneath, across types.
+// All members are guarded by g_assetMutex.
+enum AssetEvictionPolicy {
+    ASSET_EVICT_LRU,
+    ASSET_EVICT_LFU,
+    ASSET_EVICT_ARC,
+    ASSET_EVICT_GDSF
+};
+
+static const char* const kAssetEvictionPolicyNames[] = { "lru", "lfu", "arc", "gdsf" };
+
+struct AssetResident {
+    std::string name;
+    size_t size;
+    uint64_t lastUse;
+    uint32_t hits;
+    double priority;    // GDSF: inflation + hits / size
+    bool frequent;      // ARC: referenced more than once (T2)
+    uint32_t refs;      // script loads not yet unloaded
+    bool prefetched;    // the bindings hold a load of their own
+};
+
+struct AssetTypeCache {
+    std::unordered_map<STAssetID, AssetResident> residents;
+    size_t budget = 0;              // 0 = no limit
+    size_t used = 0;
+    size_t pinned = 0;              // bytes of entries with script references
+
+    // ARC: bytes in the recency list, adaptive target for it, and ghost
+    // lists of recently evicted names
+    size_t recentBytes = 0;
+    double recentTarget = 0;
+    std::deque<std::pair<std::string, size_t>> ghostRecent;
+    std::deque<std::pair<std::string, size_t>> ghostFrequent;
+    size_t ghostRecentBytes = 0;
+    size_t ghostFrequentBytes = 0;
+
+    // GDSF aging: priority of the last victim
+    double inflation = 0;
+
+    uint64_t loads = 0;
+    uint64_t bytesLoaded = 0;
+    uint64_t evictions = 0;
+    uint64_t bytesEvicted = 0;
+};
+
+class AssetResidency {
+public:
+    // Record a load of asset, by the script or (prefetch) by the bindings,
+    // and enforce its type's budget
+    void admit(STAssetID asset, bool prefetch = false) {
+        if (typeOf_.count(asset)) {
+            AssetResident& held = types_[typeOf_[asset]].residents[asset];
+            if (prefetch && held.prefetched) {
+                // The bindings keep one load at most; drop the extra one
+                st_asset_unload(asset);
+            } else if (prefetch) {
+                held.prefetched = true;
+            } else if (held.refs++ == 0) {
+                types_[typeOf_[asset]].pinned += held.size;
+            }
+            touch(asset);
+            return;
+        }
 
-static int lua_st_asset_is_loaded(lua_State* L) {
-    const char* name = luaL_checkstring(L, 1);
+        int type = st_asset_get_type(asset);
+        AssetTypeCache& cache = types_[type];
+        AssetResident entry;
+        const char* name = st_asset_get_name(asset);
+        entry.name = name ? name : "";
+        entry.size = std::max<size_t>(st_asset_get_size(asset), 1);
+        entry.lastUse = ++clock_;
+        entry.hits = 1;
+        entry.frequent = false;
+        entry.refs = prefetch ? 0 : 1;
+        entry.prefetched = prefetch;
+
+        if (policy_ == ASSET_EVICT_ARC && !entry.name.empty()) {
+            entry.frequent = arcReturnFromGhost(cache, entry.name.c_str(), entry.size);
+        }
+        if (!entry.name.empty()) {
+            byName_[entry.name] = asset;
+        }
+        entry.priority = cache.inflation + entry.hits / (double)entry.size;
 
-    bool result = st_asset_is_loaded(name);
-    lua_pushboolean(L, result);
-    return 1;
-}
+        cache.used += entry.size;
+        if (entry.refs > 0) {
+            cache.pinned += entry.size;
+        }
+        if (!entry.frequent) {
+            cache.recentBytes += entry.size;
+        }
+        cache.loads++;
+        cache.bytesLoaded += entry.size;
+        cache.residents.emplace(asset, std::move(entry));
+        typeOf_[asset] = type;
 
-// Import/Export
-static int lua_st_asset_import(lua_State* L) {
-    const char* file_path = luaL_checkstring(L, 1);
-    const char* asset_name = luaL_checkstring(L, 2);
-    int type = luaL_optinteger(L, 3, -1);
+        enforce(cache, asset);
+    }
 
-    bool result = st_asset_import(file_path, asset_name, type);
-    lua_pushboolean(L, result);
-    return 1;
-}
+    void touch(STAssetID asset) {
+        auto type = typeOf_.find(asset);
+        if (type == typeOf_.end()) {
+            return;
+        }
+        AssetTypeCache& cache = types_[type->second];
+        AssetResident& entry = cache.residents[asset];
+        entry.lastUse = ++clock_;
+        entry.hits++;
+        entry.priority = cache.inflation + entry.hits / (double)entry.size;
+        if (!entry.frequent) {
+            entry.frequent = true;
+            cache.recentBytes -= entry.size;
+        }
+    }
 
-static int lua_st_asset_import_directory(lua_State* L) {
-    const char* directory = luaL_checkstring(L, 1);
-    bool recursive = lua_toboolean(L, 2);
+    // Record a script unload. Returns true once the script holds no more
+    // references; a prefetched asset then stays resident but evictable.
+    bool release(STAssetID asset) {
+        auto type = typeOf_.find(asset);
+        if (type == typeOf_.end()) {
+            return true;
+        }
+        AssetTypeCache& cache = types_[type->second];
+        AssetResident& entry = cache.residents[asset];
+        if (entry.refs > 0 && --entry.refs == 0) {
+            cache.pinned -= entry.size;
+            // Unpinned bytes now count against the budget
+            if (entry.prefetched) {
+                enforce(cache, -1);
+                return true;
+            }
+        }
+        if (entry.refs > 0) {
+            return false;
+        }
+        if (!entry.prefetched) {
+            forget(asset);
+        }
+        return true;
+    }
 
-    int count = st_asset_import_directory(directory, recursive);
-    lua_pushinteger(L, count);
-    return 1;
-}
+    // Script references and whether the bindings hold their own load
+    void holds(STAssetID asset, uint32_t& refs, bool& prefetched) const {
+        auto type = typeOf_.find(asset);
+        if (type == typeOf_.end()) {
+            refs = 0;
+            prefetched = false;
+            return;
+        }
+        const AssetResident& entry = types_.at(type->second).residents.at(asset);
+        refs = entry.refs;
+        prefetched = entry.prefetched;
+    }
 
-static int lua_st_asset_export(lua_State* L) {
-    const char* asset_name = luaL_checkstring(L, 1);
-    const char* file_path = luaL_checkstring(L, 2);
-
-    bool result = st_asset_export(asset_name, file_path);
-    lua_pushboolean(L, result);
-    return 1;
-}
+    void forget(STAssetID asset) {
+        auto type = typeOf_.find(asset);
+        if (type == typeOf_.end()) {
+            return;
+        }
+        AssetTypeCache& cache = types_[type->second];
+        auto it = cache.residents.find(asset);
+        byName_.erase(it->second.name);
+        cache.used -= it->second.size;
+        if (it->second.refs > 0) {
+            cache.pinned -= it->second.size;
+        }
+        if (!it->second.frequent) {
+            cache.recentBytes -= it->second.size;
+        }
+        cache.residents.erase(it);
+        typeOf_.erase(type);
+    }
 
-static int lua_st_asset_delete(lua_State* L) {
-    const char* asset_name = luaL_checkstring(L, 1);
+    // Drop all residency records, keeping budgets and statistics
+    void clear() {
+        for (auto& entry : types_) {
+            AssetTypeCache& cache = entry.second;
+            cache.residents.clear();
+            cache.used = 0;
+            cache.pinned = 0;
+            cache.recentBytes = 0;
+        }
+        typeOf_.clear();
+        byName_.clear();
+    }
 
-    bool result = st_asset_delete(asset_name);
-    lua_pushboolean(L, result);
-    return 1;
-}
+    // ID of a resident asset by name, or -1
+    STAssetID find(const std::string& name) const {
+        auto it = byName_.find(name);
+        return it == byName_.end() ? -1 : it->second;
+    }
 
-// Data Access
-static int lua_st_asset_get_data(lua_State* L) {
-    STAssetID asset = luaL_checkinteger(L, 1);
+    void setBudget(int type, size_t budget) {
+        AssetTypeCache& cache = types_[type];
+        cache.budget = budget;
+        enforce(cache, -1);
+    }
 
-    const void* data = st_asset_get_data(asset);
-    size_t size = st_asset_get_size(asset);
+    size_t budget(int type) {
+        auto it = types_.find(type);
+        return it == types_.end() ? 0 : it->second.budget;
+    }
 
-    if (data && size > 0) {
-        lua_pushlstring(L, (const char*)data, size);
-        return 1;
+    void setPolicy(AssetEvictionPolicy policy) {
+        policy_ = policy;
+        for (auto& entry : types_) {
+            AssetTypeCache& cache = entry.second;
+            cache.recentTarget = 0;
+            cache.ghostRecent.clear();
+            cache.ghostFrequent.clear();
+            cache.ghostRecentBytes = 0;
+            cache.ghostFrequentBytes = 0;
+            cache.inflation = 0;
+            for (auto& resident : cache.residents) {
+                resident.second.priority = resident.second.hits / (double)resident.second.size;
+            }
+        }
     }
 
-    lua_pushnil(L);
-    return 1;
-}
+    AssetEvictionPolicy policy() const { return policy_; }
 
-static int lua_st_asset_get_size(lua_State* L) {
-    STAssetID asset = luaL_checkinteger(L, 1);
+    void resetStats() {
+        for (auto& entry : types_) {
+            AssetTypeCache& cache = entry.second;
+            cache.loads = cache.bytesLoaded = 0;
+            cache.evictions = cache.bytesEvicted = 0;
+        }
+    }
 
-    size_t size = st_asset_get_size(asset);
-    lua_pushinteger(L, size);
-    return 1;
-}
+    const std::unordered_map<int, AssetTypeCache>& types() const { return types_; }
+
+private:
+    // ARC: an asset coming back from a ghost list shifts the recency target
+    // toward the list that would have kept it. Returns true if it was a ghost.
+    bool arcReturnFromGhost(AssetTypeCache& cache, const char* name, size_t size) {
+        auto match = [name](const std::pair<std::string, size_t>& ghost) {
+            return ghost.first == name;
+        };
+
+        auto it = std::find_if(cache.ghostRecent.begin(), cache.ghostRecent.end(), match);
+        if (it != cache.ghostRecent.end()) {
+            double delta = std::max(1.0, cache.ghostFrequentBytes / (double)std::max<size_t>(cache.ghostRecentBytes, 1));
+            cache.recentTarget = std::min<double>(cache.recentTarget + delta * size, (double)cache.budget);
+            cache.ghostRecentBytes -= it->second;
+            cache.ghostRecent.erase(it);
+            return true;
+        }
 
-static int lua_st_asset_get_type(lua_State* L) {
-    STAssetID asset = luaL_checkinteger(L, 1);
+        it = std::find_if(cache.ghostFrequent.begin(), cache.ghostFrequent.end(), match);
+        if (it != cache.ghostFrequent.end()) {
+            double delta = std::max(1.0, cache.ghostRecentBytes / (double)std::max<size_t>(cache.ghostFrequentBytes, 1));
+            cache.recentTarget = std::max(cache.recentTarget - delta * size, 0.0);
+            cache.ghostFrequentBytes -= it->second;
+            cache.ghostFrequent.erase(it);
+            return true;
+        }
+        return false;
+    }
 
-    int type = st_asset_get_type(asset);
-    lua_pushinteger(L, type);
-    return 1;
-}
+    // Linear scan over the type's residents; evictions are rare next to loads
+    STAssetID pickVictim(const AssetTypeCache& cache, STAssetID keep) {
+        bool fromRecent = cache.recentBytes > cache.recentTarget;
+        STAssetID victim = -1;
+        const AssetResident* best = nullptr;
+
+        for (int pass = 0; pass < 2 && !best; pass++) {
+            for (const auto& entry : cache.residents) {
+                const AssetResident& r = entry.second;
+                if (entry.first == keep || r.refs > 0 || g_assetViews.count(entry.first)) {
+                    continue;
+                }
+                if (policy_ == ASSET_EVICT_ARC && pass == 0 && r.frequent == fromRecent) {
+                    continue;
+                }
+
+                bool better = !best;
+                if (!better) {
+                    switch (policy_) {
+                        case ASSET_EVICT_LFU:
+                            better = r.hits < best->hits ||
+                                     (r.hits == best->hits && r.lastUse < best->lastUse);
+                            break;
+                        case ASSET_EVICT_GDSF:
+                            better = r.priority < best->priority ||
+                                     (r.priority == best->priority && r.lastUse < best->lastUse);
+                            break;
+                        default:
+                            better = r.lastUse < best->lastUse;
+                            break;
+                    }
+                }
+                if (better) {
+                    best = &r;
+                    victim = entry.first;
+                }
+            }
+            if (policy_ != ASSET_EVICT_ARC) {
+                break;
+            }
+        }
+        return victim;
+    }
 
-static int lua_st_asset_get_name(lua_State* L) {
-    STAssetID asset = luaL_checkinteger(L, 1);
+    // Pinned bytes are left out of the target: script loads over budget must
+    // not flush every prefetch of the type
+    void enforce(AssetTypeCache& cache, STAssetID keep) {
+        if (cache.budget == 0) {
+            return;
+        }
+        while (cache.used - cache.pinned > cache.budget) {
+            STAssetID victim = pickVictim(cache, keep);
+            if (victim < 0) {
+                break;
+            }
+            evict(cache, victim);
+        }
+    }
 
-    const char* name = st_asset_get_name(asset);
-    if (name) {
-        lua_pushstring(L, name);
-    } else {
-        lua_pushnil(L);
+    void evict(AssetTypeCache& cache, STAssetID asset) {
+        const AssetResident entry = cache.residents[asset];
+
+        if (policy_ == ASSET_EVICT_ARC && !entry.name.empty()) {
+            auto& ghosts = entry.frequent ? cache.ghostFrequent : cache.ghostRecent;
+            size_t& ghostBytes = entry.frequent ? cache.ghostFrequentBytes : cache.ghostRecentBytes;
+            ghosts.emplace_back(entry.name, entry.size);
+            ghostBytes += entry.size;
+            while (ghostBytes > cache.budget && !ghosts.empty()) {
+                ghostBytes -= ghosts.front().second;
+                ghosts.pop_front();
+            }
+        } else if (policy_ == ASSET_EVICT_GDSF) {
+            cache.inflation = entry.priority;
+        }
+
+        forget(asset);
+        cache.evictions++;
+        cache.bytesEvicted += entry.size;
+        st_asset_unload(asset);
     }
-    return 1;
-}
 
-// Queries
-static int lua_st_asset_exists(lua_State* L) {
-    const char* name = luaL_checkstring(L, 1);
+    std::unordered_map<int, AssetTypeCache> types_;
+    std::unordered_map<STAssetID, int> typeOf_;
+    std::unordered_map<std::string, STAssetID> byName_;
+    AssetEvictionPolicy policy_ = ASSET_EVICT_LRU;
+    uint64_t clock_ = 0;
+};
 
-    bool result = st_asset_exists(name);
-    lua_pushboolean(L, result);
-    return 1;
-}
+static AssetResidency g_assetResidency;
 
-static int lua_st_asset_list(lua_State* L) {
-    int type = luaL_optinteger(L, 1, -1);
+// Identity of an asset's contents: XXH64 under two seeds plus the size.
+// Equal keys only nominate a pair; callers compare the bytes before sharing.
+struct AssetContentKey {
+    uint64_t hash;
+    uint64_t check;
+    uint64_t size;
 
-    // Get count first
-    int count = st_asset_list(type, nullptr, 0);
+    bool operator==(const AssetContentKey& other) const {
+        return hash == other.hash && check == other.check && size == other.size;
+    }
+};
+
+struct AssetContentKeyHash {
+    size_t operator()(const AssetContentKey& key) const { return (size_t)key.hash; }
+};
+
+static AssetContentKey assetContentKey(const uint8_t* data, size_t size) {
+    return { xxh64(data, size), xxh64(data, size, 0x5354504B), (uint64_t)size };
+}
+
+// Content-addressed storage behind asset.importDirectory(dir, recursive, true).
+// After the framework imports a directory, every newly added asset is hashed.
+// When its bytes match another asset's, one copy is kept in the database
+// under an internal blob name and both names become aliases of it; the
+// originals are deleted. Loads of an alias resolve to the blob, so the
+// database and the cache hold one copy per distinct content. A blob is
+// deleted when its last alias is deleted or re-imported with new contents.
+// Aliases, blobs and the hashes of unshared assets persist in a sidecar file
+// next to the database (<db>.dedup). Guarded by g_assetMutex.
+class AssetDedupStore {
+public:
+    static bool isBlobName(const char* name) {
+        return strncmp(name, kBlobPrefix, sizeof(kBlobPrefix) - 1) == 0;
+    }
 
-    if (count <= 0) {
-        lua_newtable(L);
-        return 1;
+    void open(const std::string& dbPath) {
+        close();
+        path_ = dbPath + ".dedup";
+        FILE* in = fopen(path_.c_str(), "r");
+        if (!in) {
+            return;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), in)) {
+            std::vector<std::string> fields;
+            char* save = nullptr;
+            for (char* field = strtok_r(line, "\t\n", &save); field; field = strtok_r(nullptr, "\t\n", &save)) {
+                fields.emplace_back(field);
+            }
+            if (fields.size() == 3 && fields[0] == "A") {
+                aliases_[fields[1]] = fields[2];
+                blobs_[fields[2]].refs++;
+            } else if (fields.size() == 5 && fields[0] == "B") {
+                Blob& blob = blobs_[fields[1]];
+                blob.type = atoi(fields[2].c_str());
+                blob.size = strtoull(fields[3].c_str(), nullptr, 10);
+                blob.key = parseKey(fields[4]);
+            } else if (fields.size() == 3 && fields[0] == "H") {
+                AssetContentKey key = parseKey(fields[2]);
+                singles_[key] = fields[1];
+            }
+        }
+        fclose(in);
     }
 
-    // Allocate array for names
-    const char** names = new const char*[count];
-    st_asset_list(type, names, count);
+    void close() {
+        path_.clear();
+        aliases_.clear();
+        blobs_.clear();
+        singles_.clear();
+    }
 
-    // Create Lua table
-    lua_createtable(L, count, 0);
-    for (int i = 0; i < count; i++) {
-        lua_pushstring(L, names[i]);
-        lua_rawseti(L, -2, i + 1);  // Lua arrays are 1-indexed
+    // Name to hand to the asset manager for a script-visible name
+    const char* resolve(const char* name) const {
+        auto it = aliases_.find(name);
+        return it == aliases_.end() ? name : it->second.c_str();
     }
 
-    delete[] names;
-    return 1;
-}
+    // Script-visible name of a stored asset: the first alias in name order of
+    // a blob, otherwise the name itself
+    const char* nameFor(const char* stored) const {
+        if (!isBlobName(stored)) {
+            return stored;
+        }
+        const std::string* first = nullptr;
+        for (const auto& alias : aliases_) {
+            if (alias.second == stored && (!first || alias.first < *first)) {
+                first = &alias.first;
+            }
+        }
+        return first ? first->c_str() : stored;
+    }
 
-static int lua_st_asset_search(lua_State* L) {
-    const char* pattern = luaL_checkstring(L, 1);
+    // Visit (alias, type) for every alias, for listings
+    template <typename Visit>
+    void forEachAlias(Visit visit) const {
+        for (const auto& alias : aliases_) {
+            auto blob = blobs_.find(alias.second);
+            visit(alias.first, blob != blobs_.end() ? blob->second.type : -1);
+        }
+    }
 
-    // Get count first
-    int count = st_asset_search(pattern, nullptr, 0);
+    // Drop an alias whose name now has contents of its own, or is being
+    // deleted. Returns true if name was an alias.
+    bool detach(const std::string& name) {
+        auto it = aliases_.find(name);
+        if (it == aliases_.end()) {
+            return false;
+        }
+        std::string blobName = it->second;
+        aliases_.erase(it);
+        auto blob = blobs_.find(blobName);
+        if (blob != blobs_.end() && --blob->second.refs == 0) {
+            blobs_.erase(blob);
+            st_asset_delete(blobName.c_str());
+        }
+        save();
+        return true;
+    }
 
-    if (count <= 0) {
-        lua_newtable(L);
-        return 1;
+    // Fold newly imported assets into the store. Returns the bytes no longer
+    // stored twice.
+    uint64_t absorb(const std::vector<std::string>& added) {
+        uint64_t saved = 0;
+        for (const std::string& name : added) {
+            if (isBlobName(name.c_str())) {
+                continue;
+            }
+            detach(name);
+            saved += absorbOne(name);
+        }
+        save();
+        return saved;
     }
 
-    // Allocate array for names
-    const char** names = new const char*[count];
-    st_asset_search(pattern, names, count);
+    void stats(size_t& blobs, size_t& aliases, uint64_t& bytesSaved) const {
+        blobs = blobs_.size();
+        aliases = aliases_.size();
+        bytesSaved = 0;
+        for (const auto& blob : blobs_) {
+            if (blob.second.refs > 1) {
+                bytesSaved += blob.second.size * (blob.second.refs - 1);
+            }
+        }
+    }
 
-    // Create Lua table
-    lua_createtable(L, count, 0);
-    for (int i = 0; i < count; i++) {
-        lua_pushstring(L, names[i]);
-        lua_rawseti(L, -2, i + 1);
+private:
+    struct Blob {
+        AssetContentKey key = {0, 0, 0};
+        uint64_t size = 0;
+        int type = -1;
+        uint32_t refs = 0;
+    };
+
+    static constexpr char kBlobPrefix[] = "#blob/";
+
+    static std::string keyString(const AssetContentKey& key) {
+        char text[64];
+        snprintf(text, sizeof(text), "%016llx%016llx-%llu", (unsigned long long)key.hash,
+                 (unsigned long long)key.check, (unsigned long long)key.size);
+        return text;
     }
 
-    delete[] names;
-    return 1;
-}
+    static AssetContentKey parseKey(const std::string& text) {
+        AssetContentKey key = {0, 0, 0};
+        if (text.size() > 33 && text[32] == '-') {
+            key.hash = strtoull(text.substr(0, 16).c_str(), nullptr, 16);
+            key.check = strtoull(text.substr(16, 16).c_str(), nullptr, 16);
+            key.size = strtoull(text.c_str() + 33, nullptr, 10);
+        }
+        return key;
+    }
 
-static int lua_st_asset_get_count(lua_State* L) {
-    int type = luaL_optinteger(L, 1, -1);
+    // Whether two loaded assets hold the same bytes
+    static bool sameBytes(STAssetID a, STAssetID b) {
+        size_t size = st_asset_get_size(a);
+        if (size != st_asset_get_size(b)) {
+            return false;
+        }
+        const void* da = st_asset_get_data(a);
+        const void* db = st_asset_get_data(b);
+        return size == 0 || (da && db && memcmp(da, db, size) == 0);
+    }
 
-    int count = st_asset_get_count(type);
-    lua_pushinteger(L, count);
-    return 1;
-}
+    // Store the contents of a loaded asset under blobName
+    static bool storeBlob(STAssetID asset, const std::string& blobName, int type) {
+        std::string tmp = std::string(P_tmpdir) + "/stasset.XXXXXX";
+        int fd = mkstemp(&tmp[0]);
+        if (fd < 0) {
+            return false;
+        }
+        const uint8_t* data = (const uint8_t*)st_asset_get_data(asset);
+        size_t size = st_asset_get_size(asset);
+        bool ok = true;
+        for (size_t done = 0; ok && done < size;) {
+            ssize_t n = write(fd, data + done, size - done);
+            ok = n > 0;
+            done += ok ? (size_t)n : 0;
+        }
+        ::close(fd);
+        ok = ok && st_asset_import(tmp.c_str(), blobName.c_str(), type);
+        unlink(tmp.c_str());
+        return ok;
+    }
 
-// Cache Management
-static int lua_st_asset_clear_cache(lua_State* L) {
-    (void)L;
-    st_asset_clear_cache();
-    return 0;
-}
+    uint64_t absorbOne(const std::string& name) {
+        STAssetID asset = st_asset_load(name.c_str());
+        if (asset < 0) {
+            return 0;
+        }
+        const uint8_t* data = (const uint8_t*)st_asset_get_data(asset);
+        size_t size = st_asset_get_size(asset);
+        int type = st_asset_get_type(asset);
+        if (!data && size > 0) {
+            st_asset_unload(asset);
+            return 0;
+        }
+        AssetContentKey key = assetContentKey(data, size);
+        std::string blobName = kBlobPrefix + keyString(key);
+
+        // Contents already stored as a blob
+        auto blob = blobs_.find(blobName);
+        if (blob != blobs_.end()) {
+            STAssetID stored = st_asset_load(blobName.c_str());
+            bool same = stored >= 0 && sameBytes(asset, stored);
+            if (stored >= 0) {
+                st_asset_unload(stored);
+            }
+            st_asset_unload(asset);
+            if (!same || !st_asset_delete(name.c_str())) {
+                return 0;
+            }
+            aliases_[name] = blobName;
+            blob->second.refs++;
+            return size;
+        }
 
-static int lua_st_asset_get_cache_size(lua_State* L) {
-    (void)L;
-    size_t size = st_asset_get_cache_size();
-    lua_pushinteger(L, size);
-    return 1;
-}
+        // Contents matching an unshared asset: move them to a new blob. An
+        // asset the script has loaded is left alone so its ID stays valid.
+        auto single = singles_.find(key);
+        if (single != singles_.end() && single->second != name && st_asset_exists(single->second.c_str()) &&
+            g_assetResidency.find(single->second) < 0) {
+            std::string other = single->second;
+            STAssetID otherAsset = st_asset_load(other.c_str());
+            bool same = otherAsset >= 0 && sameBytes(asset, otherAsset);
+            if (otherAsset >= 0) {
+                st_asset_unload(otherAsset);
+            }
+            if (same && storeBlob(asset, blobName, type)) {
+                st_asset_unload(asset);
+                st_asset_delete(name.c_str());
+                st_asset_delete(other.c_str());
+                Blob& created = blobs_[blobName];
+                created.key = key;
+                created.size = size;
+                created.type = type;
+                created.refs = 2;
+                aliases_[name] = blobName;
+                aliases_[other] = blobName;
+                singles_.erase(single);
+                return size;
+            }
+        }
 
-static int lua_st_asset_get_cached_count(lua_State* L) {
-    (void)L;
-    int count = st_asset_get_cached_count();
-    lua_pushinteger(L, count);
-    return 1;
-}
+        st_asset_unload(asset);
+        singles_[key] = name;
+        return 0;
+    }
 
-static int lua_st_asset_set_max_cache_size(lua_State* L) {
-    size_t max_size = luaL_checkinteger(L, 1);
-    st_asset_set_max_cache_size(max_size);
-    return 0;
-}
+    void save() const {
+        if (path_.empty()) {
+            return;
+        }
+        std::string tmp = path_ + ".tmp";
+        FILE* out = fopen(tmp.c_str(), "w");
+        if (!out) {
+            return;
+        }
+        for (const auto& blob : blobs_) {
+            fprintf(out, "B\t%s\t%d\t%llu\t%s\n", blob.first.c_str(), blob.second.type,
+                    (unsigned long long)blob.second.size, keyString(blob.second.key).c_str());
+        }
+        for (const auto& alias : aliases_) {
+            fprintf(out, "A\t%s\t%s\n", alias.first.c_str(), alias.second.c_str());
+        }
+        for (const auto& single : singles_) {
+            fprintf(out, "H\t%s\t%s\n", single.second.c_str(), keyString(single.first).c_str());
+        }
+        if (fclose(out) == 0) {
+            rename(tmp.c_str(), path_.c_str());
+        }
+    }
 
-// Statistics
-static int lua_st_asset_get_hit_rate(lua_State* L) {
-    (void)L;
-    double rate = st_asset_get_hit_rate();
-    lua_pushnumber(L, rate);
-    return 1;
-}
+    std::string path_;
+    std::unordered_map<std::string, std::string> aliases_;    // name -> blob name
+    std::unordered_map<std::string, Blob> blobs_;             // blob name -> blob
+    std::unordered_map<AssetContentKey, std::string, AssetContentKeyHash> singles_;
+};
 
-static int lua_st_asset_get_database_size(lua_State* L) {
-    (void)L;
-    size_t size = st_asset_get_database_size();
-    lua_pushinteger(L, size);
-    return 1;
-}
+constexpr char AssetDedupStore::kBlobPrefix[];
 
-// Error Handling
-static int lua_st_asset_get_error(lua_State* L) {
-    (void)L;
-    const char* error = st_asset_get_error();
-    if (error) {
-        lua_pushstring(L, error);
-    } else {
-        lua_pushnil(L);
-    }
-    return 1;
-}
+static AssetDedupStore g_assetDedup;
 
-static int lua_st_asset_clear_error(lua_State* L) {
-    (void)L;
-    st_asset_clear_error();
-    return 0;
-}
+// Snapshot of the database's asset names, sorted, with a trigram index for
+// substring search. Built on first use and rebuilt after imports or deletes.
+// Guarded by g_assetMutex.
+class AssetNameIndex {
+public:
+    struct Entry {
+        uint32_t offset;    // into the name pool
+        uint32_t length;
+        int type;
+    };
 
-// =============================================================================
-// Tilemap API
-// =============================================================================
+    void invalidate() { valid_ = false; }
 
-static int lua_st_tilemap_init(lua_State* L) {
-    float width = (float)luaL_checknumber(L, 1);
-    float height = (float)luaL_checknumber(L, 2);
-    bool result = st_tilemap_init(width, height);
-    lua_pushboolean(L, result);
-    return 1;
-}
+    void ensure() {
+        if (!valid_) {
+            rebuild();
+        }
+    }
 
-static int lua_st_tilemap_shutdown(lua_State* L) {
-    (void)L;
-    st_tilemap_shutdown();
-    return 0;
-}
+    uint32_t generation() const { return generation_; }
+    size_t size() const { return entries_.size(); }
+    const Entry& entry(size_t i) const { return entries_[i]; }
+    const char* name(const Entry& e) const { return pool_.data() + e.offset; }
+
+    // Entries whose name starts with prefix, in name order
+    template<typename Visit>
+    void findPrefix(const char* prefix, size_t length, Visit visit) const {
+        auto first = std::lower_bound(entries_.begin(), entries_.end(), prefix,
+            [this, length](const Entry& e, const char* p) {
+                return compareName(e, p, length) < 0;
+            });
+        for (auto it = first; it != entries_.end(); ++it) {
+            if (it->length < length || memcmp(name(*it), prefix, length) != 0) {
+                break;
+            }
+            if (!visit(*it)) {
+                break;
+            }
+        }
+    }
 
-static int lua_st_tilemap_create(lua_State* L) {
-    int32_t width = (int32_t)luaL_checkinteger(L, 1);
-    int32_t height = (int32_t)luaL_checkinteger(L, 2);
-    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 3);
-    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 4);
-    STTilemapID id = st_tilemap_create(width, height, tileWidth, tileHeight);
-    lua_pushinteger(L, id);
-    return 1;
-}
+    // Entries whose name contains text, in name order. Queries of three or
+    // more characters only check entries holding every trigram of the text.
+    template<typename Visit>
+    void findSubstring(const char* text, size_t length, Visit visit) {
+        if (length < 3) {
+            for (const Entry& e : entries_) {
+                if (contains(e, text, length) && !visit(e)) {
+                    break;
+                }
+            }
+            return;
+        }
 
-static int lua_st_tilemap_destroy(lua_State* L) {
-    STTilemapID id = (STTilemapID)luaL_checkinteger(L, 1);
-    st_tilemap_destroy(id);
-    return 0;
-}
+        // Start from the rarest trigram, then filter by the others
+        const std::vector<uint32_t>* rarest = nullptr;
+        for (size_t i = 0; i + 3 <= length; i++) {
+            auto it = trigrams_.find(trigramKey(text + i));
+            if (it == trigrams_.end()) {
+                return;
+            }
+            if (!rarest || it->second.size() < rarest->size()) {
+                rarest = &it->second;
+            }
+        }
 
-static int lua_st_tilemap_get_size(lua_State* L) {
-    STTilemapID id = (STTilemapID)luaL_checkinteger(L, 1);
-    int32_t width, height;
-    st_tilemap_get_size(id, &width, &height);
-    lua_pushinteger(L, width);
-    lua_pushinteger(L, height);
-    return 2;
-}
+        candidates_.assign(rarest->begin(), rarest->end());
+        for (size_t i = 0; i + 3 <= length && !candidates_.empty(); i++) {
+            const std::vector<uint32_t>& postings = trigrams_[trigramKey(text + i)];
+            if (&postings == rarest) {
+                continue;
+            }
+            auto out = std::remove_if(candidates_.begin(), candidates_.end(),
+                [&postings](uint32_t idx) {
+                    return !std::binary_search(postings.begin(), postings.end(), idx);
+                });
+            candidates_.erase(out, candidates_.end());
+        }
 
-static int lua_st_tilemap_create_layer(lua_State* L) {
-    const char* name = lua_isstring(L, 1) ? lua_tostring(L, 1) : nullptr;
-    STLayerID id = st_tilemap_create_layer(name);
-    lua_pushinteger(L, id);
-    return 1;
-}
+        for (uint32_t idx : candidates_) {
+            const Entry& e = entries_[idx];
+            if (contains(e, text, length) && !visit(e)) {
+                break;
+            }
+        }
+    }
 
-static int lua_st_tilemap_destroy_layer(lua_State* L) {
-    STLayerID id = (STLayerID)luaL_checkinteger(L, 1);
+private:
+    static uint32_t trigramKey(const char* p) {
+        return ((uint32_t)(uint8_t)p[0] << 16) | ((uint32_t)(uint8_t)p[1] << 8) | (uint8_t)p[2];
+    }
+
+    int compareName(const Entry& e, const char* p, size_t length) const {
+        int c = memcmp(name(e), p, std::min<size_t>(e.length, length));
+        if (c != 0) {
+            return c;
+        }
+        return e.length < length ? -1 : (e.length > length ? 1 : 0);
+    }
+
+    bool contains(const Entry& e, const char* text, size_t length) const {
+        if (e.length < length) {
+            return false;
+        }
+        const char* n = name(e);
+        for (size_t i = 0; i + length <= e.length; i++) {
+            if (memcmp(n + i, text, length) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void rebuild() {
+        static const int kTypes[] = {
+            ST_ASSET_IMAGE, ST_ASSET_SOUND, ST_ASSET_MUSIC,
+            ST_ASSET_FONT, ST_ASSET_SPRITE, ST_ASSET_DATA
+        };
+
+        pool_.clear();
+        entries_.clear();
+        trigrams_.clear();
+
+        std::vector<const char*> names;
+        for (int type : kTypes) {
+            int count = st_asset_list(type, nullptr, 0);
+            if (count <= 0) {
+                continue;
+            }
+            names.resize(count);
+            count = st_asset_list(type, names.data(), count);
+            for (int i = 0; i < count; i++) {
+                if (!names[i] || AssetDedupStore::isBlobName(names[i])) {
+                    continue;
+                }
+                size_t length = strlen(names[i]);
+                entries_.push_back({(uint32_t)pool_.size(), (uint32_t)length, type});
+                pool_.append(names[i], length + 1);
+            }
+        }
+        g_assetDedup.forEachAlias([this](const std::string& alias, int type) {
+            entries_.push_back({(uint32_t)pool_.size(), (uint32_t)alias.size(), type});
+            pool_.append(alias.c_str(), alias.size() + 1);
+        });
+
+        std::sort(entries_.begin(), entries_.end(), [this](const Entry& a, const Entry& b) {
+            return compareName(a, name(b), b.length) < 0;
+        });
+
+        for (uint32_t idx = 0; idx < entries_.size(); idx++) {
+            const char* n = name(entries_[idx]);
+            for (uint32_t i = 0; i + 3 <= entries_[idx].length; i++) {
+                std::vector<uint32_t>& postings = trigrams_[trigramKey(n + i)];
+                if (postings.empty() || postings.back() != idx) {
+                    postings.push_back(idx);
+                }
+            }
+        }
+
+        valid_ = true;
+        generation_++;
+    }
+
+    std::string pool_;
+    std::vector<Entry> entries_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams_;
+    std::vector<uint32_t> candidates_;
+    uint32_t generation_ = 0;
+    bool valid_ = false;
+};
+
+static AssetNameIndex g_assetNameIndex;
+
+// Watches imported directories for changed files on its own thread. Once a
+// file has been quiet long enough to be fully written, the thread copies it
+// to a staging file; the re-import itself is applied between frames by
+// applyStaged, so scripts never see an asset change mid-frame. Directories
+// are recorded as they are imported; watching only runs while hot reload is
+// enabled. Uses inotify on Linux and polls file modification times elsewhere.
+class AssetWatcher {
+public:
+    ~AssetWatcher() {
+        setEnabled(false);
+        for (const StagedFile& file : staged_) {
+            unlink(file.staged.c_str());
+        }
+    }
+
+    void addDirectory(const std::string& path, bool recursive) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const AssetWatchRoot& root : roots_) {
+            if (root.path == path && root.recursive == recursive) {
+                return;
+            }
+        }
+        roots_.push_back({path, recursive});
+        rootsChanged_ = true;
+    }
+
+    void setEnabled(bool enabled) {
+        if (enabled == thread_.joinable()) {
+            return;
+        }
+        if (enabled) {
+            stopping_ = false;
+            thread_ = std::thread([this] { run(); });
+        } else {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            thread_.join();
+        }
+    }
+
+    bool enabled() const { return thread_.joinable(); }
+
+    // Import every staged file and append the names re-imported, oldest
+    // first. Caller holds g_assetMutex.
+    void applyStaged(std::vector<std::string>& names) {
+        std::vector<StagedFile> staged;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            staged.swap(staged_);
+        }
+        if (staged.empty()) {
+            return;
+        }
+
+        int reimports = 0;
+        int failures = 0;
+        for (const StagedFile& file : staged) {
+            std::string name = nameForFile(file.root, file.path);
+            if (st_asset_import(file.staged.c_str(), name.c_str(), -1)) {
+                g_assetDedup.detach(name);
+                reimports++;
+                if (std::find(names.begin(), names.end(), name) == names.end()) {
+                    names.push_back(name);
+                }
+            } else {
+                failures++;
+            }
+            unlink(file.staged.c_str());
+        }
+        g_assetNameIndex.invalidate();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        reimports_ += reimports;
+        failures_ += failures;
+    }
+
+    void stats(int& roots, int& reimports, int& failures) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        roots = (int)roots_.size();
+        reimports = reimports_;
+        failures = failures_;
+    }
+
+private:
+    struct AssetWatchRoot {
+        std::string path;
+        bool recursive;
+    };
+
+    struct PendingChange {
+        std::string root;
+        std::chrono::steady_clock::time_point lastEvent;
+    };
+
+    struct StagedFile {
+        std::string root;
+        std::string path;
+        std::string staged;   // private copy, keeping the extension
+    };
+
+    static bool ignoredName(const char* name) {
+        size_t length = strlen(name);
+        return name[0] == '.' || length == 0 || name[length - 1] == '~';
+    }
+
+    // Asset name for a changed file: the existing asset it most likely came
+    // from, or its path relative to the root without extension for new files
+    static std::string nameForFile(const std::string& root, const std::string& path) {
+        std::string relative = path.compare(0, root.size(), root) == 0 ? path.substr(root.size()) : path;
+        while (!relative.empty() && relative[0] == '/') {
+            relative.erase(0, 1);
+        }
+
+        auto stem = [](const std::string& s) {
+            size_t dot = s.rfind('.');
+            size_t slash = s.rfind('/');
+            bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+            return hasExtension ? s.substr(0, dot) : s;
+        };
+        size_t slash = relative.rfind('/');
+        std::string base = slash == std::string::npos ? relative : relative.substr(slash + 1);
+
+        const std::string candidates[] = { stem(relative), relative, stem(base), base };
+        for (const std::string& candidate : candidates) {
+            if (st_asset_exists(candidate.c_str())) {
+                return candidate;
+            }
+        }
+        return candidates[0];
+    }
+
+    void noteChange(const std::string& root, const std::string& path) {
+        pending_[path] = { root, std::chrono::steady_clock::now() };
+    }
+
+    // Copy path to a new temporary file with the same extension, so the
+    // import sees the file as it was when it went quiet. Returns the copy's
+    // path, or an empty string.
+    static std::string stageCopy(const std::string& path) {
+        size_t dot = path.rfind('.');
+        size_t slash = path.rfind('/');
+        std::string extension;
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            extension = path.substr(dot);
+        }
+        std::string staged = std::string(P_tmpdir) + "/streload.XXXXXX" + extension;
+        int out = mkstemps(&staged[0], (int)extension.size());
+        if (out < 0) {
+            return std::string();
+        }
+        int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        bool ok = in >= 0;
+        char buffer[65536];
+        while (ok) {
+            ssize_t n = read(in, buffer, sizeof(buffer));
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            for (ssize_t done = 0; ok && done < n;) {
+                ssize_t written = write(out, buffer + done, (size_t)(n - done));
+                ok = written > 0;
+                done += ok ? written : 0;
+            }
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        ok = (close(out) == 0) && ok;
+        if (!ok) {
+            unlink(staged.c_str());
+            return std::string();
+        }
+        return staged;
+    }
+
+    // Stage files that have been quiet long enough to be fully written. A
+    // file staged again before the next frame replaces its earlier copy.
+    void flushQuiet() {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (now - it->second.lastEvent < std::chrono::milliseconds(150)) {
+                ++it;
+                continue;
+            }
+
+            std::string staged = stageCopy(it->first);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (staged.empty()) {
+                failures_++;
+            } else {
+                auto previous = std::find_if(staged_.begin(), staged_.end(), [&](const StagedFile& file) {
+                    return file.path == it->first;
+                });
+                if (previous != staged_.end()) {
+                    unlink(previous->staged.c_str());
+                    staged_.erase(previous);
+                }
+                staged_.push_back({it->second.root, it->first, staged});
+            }
+            it = pending_.erase(it);
+        }
+    }
+
+    // Visit every file (and, with visitDirs, directory) under dir
+    template <typename Visit>
+    static void walk(const std::string& dir, bool recursive, bool visitDirs, Visit visit) {
+        DIR* handle = opendir(dir.c_str());
+        if (!handle) {
+            return;
+        }
+        while (dirent* entry = readdir(handle)) {
+            if (ignoredName(entry->d_name)) {
+                continue;
+            }
+            std::string path = dir + "/" + entry->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                if (visitDirs) {
+                    visit(path, st);
+                }
+                if (recursive) {
+                    walk(path, recursive, visitDirs, visit);
+                }
+            } else if (S_ISREG(st.st_mode) && !visitDirs) {
+                visit(path, st);
+            }
+        }
+        closedir(handle);
+    }
+
+    bool takeRootsChanged(std::vector<AssetWatchRoot>& roots) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!rootsChanged_) {
+            return false;
+        }
+        rootsChanged_ = false;
+        roots = roots_;
+        return true;
+    }
+
+    bool stopping() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stopping_;
+    }
+
+#ifdef __linux__
+    void run() {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+        std::unordered_map<int, std::pair<std::string, size_t>> watches;   // wd -> dir, root
+        std::vector<AssetWatchRoot> roots;
+
+        auto watchDir = [&](const std::string& dir, size_t root) {
+            int wd = inotify_add_watch(fd, dir.c_str(), mask);
+            if (wd >= 0) {
+                watches[wd] = { dir, root };
+            }
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rootsChanged_ = true;
+        }
+        alignas(inotify_event) char buffer[8192];
+        while (!stopping()) {
+            if (takeRootsChanged(roots)) {
+                for (size_t r = 0; r < roots.size(); r++) {
+                    watchDir(roots[r].path, r);
+                    if (roots[r].recursive) {
+                        walk(roots[r].path, true, true, [&](const std::string& dir, const struct stat&) {
+                            watchDir(dir, r);
+                        });
+                    }
+                }
+            }
+
+            pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 100) > 0) {
+                ssize_t length;
+                while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                    for (char* p = buffer; p < buffer + length;) {
+                        const inotify_event* event = (const inotify_event*)p;
+                        p += sizeof(inotify_event) + event->len;
+
+                        auto watch = watches.find(event->wd);
+                        if (watch == watches.end() || event->len == 0 || ignoredName(event->name)) {
+                            continue;
+                        }
+                        const AssetWatchRoot& root = roots[watch->second.second];
+                        std::string path = watch->second.first + "/" + event->name;
+                        if (event->mask & IN_ISDIR) {
+                            if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && root.recursive) {
+                                // Files (and subdirectories) can land in the
+                                // directory before its watch exists, so
+                                // anything already there counts as changed
+                                size_t rootIndex = watch->second.second;
+                                std::string rootPath = root.path;
+                                watchDir(path, rootIndex);
+                                walk(path, true, true, [&](const std::string& dir, const struct stat&) {
+                                    watchDir(dir, rootIndex);
+                                });
+                                walk(path, true, false, [&](const std::string& file, const struct stat&) {
+                                    noteChange(rootPath, file);
+                                });
+                            }
+                        } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                            noteChange(root.path, path);
+                        }
+                    }
+                }
+            }
+            flushQuiet();
+        }
+        close(fd);
+    }
+#else
+    void run() {
+        struct FileStamp {
+            int64_t mtime;
+            int64_t size;
+        };
+        std::unordered_map<std::string, FileStamp> stamps;
+        std::vector<AssetWatchRoot> roots;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rootsChanged_ = true;
+        }
+        while (!stopping()) {
+            // Files seen for the first time after a root is added are the
+            // baseline, not changes
+            bool baseline = takeRootsChanged(roots);
+            for (const AssetWatchRoot& root : roots) {
+                walk(root.path, root.recursive, false, [&](const std::string& path, const struct stat& st) {
+#ifdef __APPLE__
+                    int64_t mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+                    int64_t mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+                    FileStamp stamp = { mtime, (int64_t)st.st_size };
+                    auto it = stamps.find(path);
+                    if (it == stamps.end()) {
+                        stamps.emplace(path, stamp);
+                        if (!baseline) {
+                            noteChange(root.path, path);
+                        }
+                    } else if (it->second.mtime != stamp.mtime || it->second.size != stamp.size) {
+                        it->second = stamp;
+                        noteChange(root.path, path);
+                    }
+                });
+            }
+            flushQuiet();
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+    }
+#endif
+
+    std::mutex mutex_;
+    std::thread thread_;
+    std::vector<AssetWatchRoot> roots_;
+    std::vector<StagedFile> staged_;
+    std::unordered_map<std::string, PendingChange> pending_;   // watcher thread only
+    int reimports_ = 0;
+    int failures_ = 0;
+    bool rootsChanged_ = false;
+    bool stopping_ = false;
+};
+
+static AssetWatcher g_assetWatcher;
+
+// Initialization
+static int lua_st_asset_init(lua_State* L) {
+    const char* db_path = luaL_checkstring(L, 1);
+    size_t max_cache_size = luaL_optinteger(L, 2, 0);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_init(db_path, max_cache_size);
+    if (result) {
+        g_assetDedup.open(db_path);
+    }
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_st_asset_shutdown(lua_State* L) {
+    (void)L;
+    assetStopLoaders();
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetViews.clear();
+    g_assetResidency.clear();
+    g_assetNameIndex.invalidate();
+    g_assetDedup.close();
+    st_asset_shutdown();
+    return 0;
+}
+
+static int lua_st_asset_is_initialized(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_is_initialized();
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Loading/Unloading
+static int lua_st_asset_load(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+    g_assetTrace.record(name);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    STAssetID asset = st_asset_load(g_assetDedup.resolve(name));
+    if (asset >= 0) {
+        g_assetResidency.admit(asset);
+    }
+    lua_pushinteger(L, asset);
+    return 1;
+}
+
+static int lua_st_asset_load_file(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    int type = luaL_checkinteger(L, 2);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    STAssetID asset = st_asset_load_file(path, (STAssetType)type);
+    if (asset >= 0) {
+        g_assetResidency.admit(asset);
+    }
+    lua_pushinteger(L, asset);
+    return 1;
+}
+
+// asset.unload(id) - release one load; views are dropped with the last one
+static int lua_st_asset_unload(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    if (g_assetResidency.release(asset)) {
+        g_assetViews.erase(asset);
+    }
+    st_asset_unload(asset);
+    return 0;
+}
+
+static int lua_st_asset_is_loaded(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_is_loaded(g_assetDedup.resolve(name));
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Import/Export
+static int lua_st_asset_import(lua_State* L) {
+    const char* file_path = luaL_checkstring(L, 1);
+    const char* asset_name = luaL_checkstring(L, 2);
+    int type = luaL_optinteger(L, 3, -1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_import(file_path, asset_name, type);
+    if (result) {
+        g_assetDedup.detach(asset_name);
+    }
+    g_assetNameIndex.invalidate();
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Every name in the database. Caller holds g_assetMutex.
+static void assetDatabaseNames(std::unordered_set<std::string>& out) {
+    int count = st_asset_list(-1, nullptr, 0);
+    if (count <= 0) {
+        return;
+    }
+    std::vector<const char*> names(count);
+    count = st_asset_list(-1, names.data(), count);
+    for (int i = 0; i < count; i++) {
+        if (names[i]) {
+            out.insert(names[i]);
+        }
+    }
+}
+
+// asset.importDirectory(dir [, recursive [, dedup]]) - import every file in
+// dir. With dedup, assets whose bytes match another asset share one stored
+// copy; returns the count and the bytes saved.
+static int lua_st_asset_import_directory(lua_State* L) {
+    const char* directory = luaL_checkstring(L, 1);
+    bool recursive = lua_toboolean(L, 2);
+    bool dedup = lua_toboolean(L, 3);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    std::unordered_set<std::string> before;
+    if (dedup) {
+        assetDatabaseNames(before);
+    }
+    int count = st_asset_import_directory(directory, recursive);
+    uint64_t saved = 0;
+    if (dedup && count > 0) {
+        std::unordered_set<std::string> after;
+        assetDatabaseNames(after);
+        std::vector<std::string> added;
+        for (const std::string& name : after) {
+            if (!before.count(name)) {
+                added.push_back(name);
+            }
+        }
+        std::sort(added.begin(), added.end());
+        saved = g_assetDedup.absorb(added);
+    }
+    g_assetNameIndex.invalidate();
+    g_assetWatcher.addDirectory(directory, recursive);
+    lua_pushinteger(L, count);
+    if (dedup) {
+        lua_pushinteger(L, (lua_Integer)saved);
+        return 2;
+    }
+    return 1;
+}
+
+// asset.getDedupStats() -> {blobs, aliases, bytesSaved}
+static int lua_st_asset_get_dedup_stats(lua_State* L) {
+    size_t blobs = 0;
+    size_t aliases = 0;
+    uint64_t bytesSaved = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_assetMutex);
+        g_assetDedup.stats(blobs, aliases, bytesSaved);
+    }
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, (lua_Integer)blobs);
+    lua_setfield(L, -2, "blobs");
+    lua_pushinteger(L, (lua_Integer)aliases);
+    lua_setfield(L, -2, "aliases");
+    lua_pushinteger(L, (lua_Integer)bytesSaved);
+    lua_setfield(L, -2, "bytesSaved");
+    return 1;
+}
+
+static int lua_st_asset_export(lua_State* L) {
+    const char* asset_name = luaL_checkstring(L, 1);
+    const char* file_path = luaL_checkstring(L, 2);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_export(g_assetDedup.resolve(asset_name), file_path);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_st_asset_delete(lua_State* L) {
+    const char* asset_name = luaL_checkstring(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    std::string stored = g_assetDedup.resolve(asset_name);
+    STAssetID asset = g_assetResidency.find(stored);
+    // Deleting an alias removes the shared copy only with its last alias
+    bool result = g_assetDedup.detach(asset_name) || st_asset_delete(asset_name);
+    if (asset >= 0 && !st_asset_exists(stored.c_str())) {
+        g_assetViews.erase(asset);
+    }
+    g_assetNameIndex.invalidate();
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Data Access
+static int lua_st_asset_get_data(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    const void* data = st_asset_get_data(asset);
+    size_t size = st_asset_get_size(asset);
+    g_assetResidency.touch(asset);
+
+    if (data && size > 0) {
+        lua_pushlstring(L, (const char*)data, size);
+        return 1;
+    }
+
+    lua_pushnil(L);
+    return 1;
+}
+
+// asset.getView(id) -> pointer, size  (nil if the asset has no data)
+// The pointer is a read-only lightuserdata; with LuaJIT, cast it with
+// ffi.cast("const uint8_t*", ptr). It can also be passed straight to bindings
+// that take a pointer and count, avoiding the copy made by asset.getData.
+// The pointer is valid only until the next asset.* call; call getView again
+// after any other asset call instead of keeping it.
+static int lua_st_asset_get_view(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetResidency.touch(asset);
+    const void* data = st_asset_get_data(asset);
+    size_t size = st_asset_get_size(asset);
+    if (!data || size == 0) {
+        g_assetViews.erase(asset);
+        lua_pushnil(L);
+        return 1;
+    }
+    g_assetViews[asset] = AssetView{data, size};
+
+    lua_pushlightuserdata(L, (void*)data);
+    lua_pushinteger(L, (lua_Integer)size);
+    return 2;
+}
+
+static int lua_st_asset_release_view(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetViews.erase(asset);
+    return 0;
+}
+
+static int lua_st_asset_get_size(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    size_t size = st_asset_get_size(asset);
+    lua_pushinteger(L, size);
+    return 1;
+}
+
+static int lua_st_asset_get_type(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    int type = st_asset_get_type(asset);
+    lua_pushinteger(L, type);
+    return 1;
+}
+
+static int lua_st_asset_get_name(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    const char* name = st_asset_get_name(asset);
+    if (name) {
+        lua_pushstring(L, g_assetDedup.nameFor(name));
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// Queries
+static int lua_st_asset_exists(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    bool result = st_asset_exists(g_assetDedup.resolve(name));
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Visit the script-visible names of a type (-1 for all): database names
+// other than shared copies, then the aliases of those copies. Shared by
+// list, search and getCount so they agree with the name index.
+template <typename Visit>
+static void assetForEachListed(int type, Visit visit) {
+    int count = st_asset_list(type, nullptr, 0);
+    if (count > 0) {
+        std::vector<const char*> names(count);
+        count = st_asset_list(type, names.data(), count);
+        for (int i = 0; i < count; i++) {
+            if (names[i] && !AssetDedupStore::isBlobName(names[i])) {
+                visit(names[i]);
+            }
+        }
+    }
+    g_assetDedup.forEachAlias([type, &visit](const std::string& alias, int aliasType) {
+        if (type < 0 || type == aliasType) {
+            visit(alias.c_str());
+        }
+    });
+}
+
+// SQL LIKE matching of pattern at the start of name: % matches any run, _
+// any one character, other characters match ASCII case-insensitively
+static bool assetLikeMatch(const char* name, const char* pattern) {
+    for (; *pattern; pattern++, name++) {
+        if (*pattern == '%') {
+            do {
+                if (assetLikeMatch(name, pattern + 1)) {
+                    return true;
+                }
+            } while (*name++);
+            return false;
+        }
+        if (!*name || (*pattern != '_' && tolower((unsigned char)*pattern) != tolower((unsigned char)*name))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int lua_st_asset_list(lua_State* L) {
+    int type = luaL_optinteger(L, 1, -1);
+
+    // Shared copies are listed under their aliases
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    lua_newtable(L);
+    int n = 0;
+    assetForEachListed(type, [L, &n](const char* name) {
+        lua_pushstring(L, name);
+        lua_rawseti(L, -2, ++n);  // Lua arrays are 1-indexed
+    });
+    return 1;
+}
+
+// asset.search(pattern) -> names. Database names come from the asset
+// manager's search; aliases of shared copies are matched as names containing
+// pattern, with SQL LIKE wildcards (% and _).
+static int lua_st_asset_search(lua_State* L) {
+    const char* pattern = luaL_checkstring(L, 1);
+
+    // Get count first
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    int count = st_asset_search(pattern, nullptr, 0);
+
+    lua_newtable(L);
+    int n = 0;
+    if (count > 0) {
+        std::vector<const char*> names(count);
+        count = st_asset_search(pattern, names.data(), count);
+        for (int i = 0; i < count; i++) {
+            if (names[i] && !AssetDedupStore::isBlobName(names[i])) {
+                lua_pushstring(L, names[i]);
+                lua_rawseti(L, -2, ++n);
+            }
+        }
+    }
+
+    std::string contains = std::string("%") + pattern + "%";
+    g_assetDedup.forEachAlias([L, &n, &contains](const std::string& alias, int) {
+        if (assetLikeMatch(alias.c_str(), contains.c_str())) {
+            lua_pushstring(L, alias.c_str());
+            lua_rawseti(L, -2, ++n);
+        }
+    });
+    return 1;
+}
+
+// asset.getCount([type]) -> number of names asset.list would return
+static int lua_st_asset_get_count(lua_State* L) {
+    int type = luaL_optinteger(L, 1, -1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    int count = 0;
+    assetForEachListed(type, [&count](const char*) {
+        count++;
+    });
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+// Cache Management
+static int lua_st_asset_clear_cache(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    st_asset_clear_cache();
+    g_assetViews.clear();
+    g_assetResidency.clear();
+    return 0;
+}
+
+static int lua_st_asset_get_cache_size(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    size_t size = st_asset_get_cache_size();
+    lua_pushinteger(L, size);
+    return 1;
+}
+
+static int lua_st_asset_get_cached_count(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    int count = st_asset_get_cached_count();
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int lua_st_asset_set_max_cache_size(lua_State* L) {
+    size_t max_size = luaL_checkinteger(L, 1);
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    st_asset_set_max_cache_size(max_size);
+    // Shrinking the budget may evict viewed data
+    g_assetViews.clear();
+    return 0;
+}
+
+// Statistics
+static int lua_st_asset_get_hit_rate(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    double rate = st_asset_get_hit_rate();
+    lua_pushnumber(L, rate);
+    return 1;
+}
+
+static int lua_st_asset_get_database_size(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    size_t size = st_asset_get_database_size();
+    lua_pushinteger(L, size);
+    return 1;
+}
+
+// Error Handling
+static int lua_st_asset_get_error(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    const char* error = st_asset_get_error();
+    if (error) {
+        lua_pushstring(L, error);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int lua_st_asset_clear_error(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    st_asset_clear_error();
+    return 0;
+}
+
+// =============================================================================
+// Async Asset Loading
+// =============================================================================
+//
+// Loads queued with asset.loadAsync and friends run on a small worker pool.
+// A worker first reads the source file to pull it into the page cache, then
+// makes the st_asset_* call under g_assetMutex, so the script thread only
+// waits if it touches the asset API while a load is in flight. The asset
+// manager is not thread-safe and decodes inside st_asset_load, so such a call
+// waits for the whole of the in-flight decode. Finished jobs are reported by
+// asset.poll, and callbacks run on the script thread from asset.update. The
+// results of the last ASSET_JOB_MAX_UNPOLLED finished jobs without a callback
+// are kept for asset.poll; older ones are released.
+
+enum AssetJobKind {
+    ASSET_JOB_LOAD,
+    ASSET_JOB_LOAD_FILE,
+    ASSET_JOB_IMPORT,
+    ASSET_JOB_IMPORT_DIRECTORY,
+    ASSET_JOB_PREFETCH
+};
+
+enum AssetJobState {
+    ASSET_JOB_PENDING,
+    ASSET_JOB_RUNNING,
+    ASSET_JOB_DONE,
+    ASSET_JOB_FAILED,
+    ASSET_JOB_CANCELLED
+};
+
+static const char* const kAssetJobStateNames[] = {
+    "pending", "running", "done", "failed", "cancelled"
+};
+
+static const size_t ASSET_JOB_MAX_UNPOLLED = 1024;
+
+struct AssetJob {
+    AssetJobKind kind = ASSET_JOB_LOAD;
+    AssetJobState state = ASSET_JOB_PENDING;
+    std::string name;           // asset name, or directory for imports
+    std::string path;           // source file for loadFile/import
+    int type = -1;
+    bool recursive = false;
+    lua_Integer result = 0;     // asset ID, import count or success flag
+    int callbackRef = LUA_NOREF;
+};
+
+// Read a file once so the asset call that follows hits the page cache
+static void assetWarmFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    static thread_local std::vector<char> buffer(256 * 1024);
+    while (read(fd, buffer.data(), buffer.size()) > 0) {
+    }
+    close(fd);
+}
+
+static bool assetRunJob(const AssetJob& job, lua_Integer& result) {
+    if (job.kind == ASSET_JOB_LOAD_FILE || job.kind == ASSET_JOB_IMPORT) {
+        assetWarmFile(job.path);
+    }
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    switch (job.kind) {
+        case ASSET_JOB_LOAD: {
+            STAssetID asset = st_asset_load(g_assetDedup.resolve(job.name.c_str()));
+            result = asset;
+            if (asset < 0) {
+                return false;
+            }
+            g_assetResidency.admit(asset);
+            return true;
+        }
+        case ASSET_JOB_LOAD_FILE: {
+            STAssetID asset = st_asset_load_file(job.path.c_str(), (STAssetType)job.type);
+            result = asset;
+            if (asset < 0) {
+                return false;
+            }
+            g_assetResidency.admit(asset);
+            return true;
+        }
+        case ASSET_JOB_IMPORT: {
+            bool ok = st_asset_import(job.path.c_str(), job.name.c_str(), job.type);
+            if (ok) {
+                g_assetDedup.detach(job.name);
+            }
+            g_assetNameIndex.invalidate();
+            result = ok ? 1 : 0;
+            return ok;
+        }
+        case ASSET_JOB_IMPORT_DIRECTORY: {
+            int count = st_asset_import_directory(job.name.c_str(), job.recursive);
+            g_assetNameIndex.invalidate();
+            g_assetWatcher.addDirectory(job.name, job.recursive);
+            result = count;
+            return count >= 0;
+        }
+        case ASSET_JOB_PREFETCH: {
+            // result is 1 if the asset was loaded, 0 if it was already resident
+            const char* name = g_assetDedup.resolve(job.name.c_str());
+            if (st_asset_is_loaded(name)) {
+                result = 0;
+                return true;
+            }
+            result = 1;
+            STAssetID asset = st_asset_load(name);
+            if (asset < 0) {
+                return false;
+            }
+            g_assetResidency.admit(asset, true);
+            return true;
+        }
+    }
+    return false;
+}
+
+class AssetLoadQueue {
+public:
+    ~AssetLoadQueue() { stop(true); }
+
+    int submit(AssetJob job) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (batchDone_ == batchTotal_) {
+            batchDone_ = 0;
+            batchTotal_ = 0;
+        }
+        int handle = nextHandle_++;
+        jobs_.emplace(handle, std::move(job));
+        pending_.push_back(handle);
+        batchTotal_++;
+        if (workers_.empty()) {
+            startLocked();
+        }
+        wake_.notify_one();
+        return handle;
+    }
+
+    // Queue background loads. Prefetches have no handle and only run when no
+    // explicit job is waiting.
+    void prefetch(const std::vector<std::string>& names) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        prefetch_.insert(prefetch_.end(), names.begin(), names.end());
+        if (workers_.empty()) {
+            startLocked();
+        }
+        wake_.notify_all();
+    }
+
+    int cancelPrefetch() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int count = (int)prefetch_.size();
+        prefetch_.clear();
+        return count;
+    }
+
+    void prefetchStats(int& queued, int& loaded, int& resident, int& failed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued = (int)prefetch_.size();
+        loaded = prefetchLoaded_;
+        resident = prefetchResident_;
+        failed = prefetchFailed_;
+    }
+
+    // Stop the workers after their current job. Pending jobs are either
+    // cancelled or kept for the next start.
+    void stop(bool cancelPending) {
+        std::vector<std::thread> workers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            workers.swap(workers_);
+            if (cancelPending) {
+                for (int handle : pending_) {
+                    finishLocked(handle, ASSET_JOB_CANCELLED, 0);
+                }
+                pending_.clear();
+                prefetch_.clear();
+            }
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+        if (!pending_.empty() || !prefetch_.empty()) {
+            startLocked();
+        }
+    }
+
+    void setWorkerCount(int count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            workerCount_ = count;
+            if (workers_.empty()) {
+                return;
+            }
+        }
+        stop(false);
+    }
+
+    int workerCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return workerCount_;
+    }
+
+    bool cancel(int handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find(pending_.begin(), pending_.end(), handle);
+        if (it == pending_.end()) {
+            return false;
+        }
+        pending_.erase(it);
+        finishLocked(handle, ASSET_JOB_CANCELLED, 0);
+        return true;
+    }
+
+    // Look up a job. Finished jobs without a callback are released once
+    // their result has been read.
+    bool poll(int handle, AssetJobState& state, lua_Integer& result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(handle);
+        if (it == jobs_.end()) {
+            return false;
+        }
+        state = it->second.state;
+        result = it->second.result;
+        if (state >= ASSET_JOB_DONE && it->second.callbackRef == LUA_NOREF) {
+            jobs_.erase(it);
+        }
+        return true;
+    }
+
+    // Take finished jobs that still have a callback to run. Returns how many
+    // jobs finished since the last call. Finished jobs without a callback wait
+    // for asset.poll, up to ASSET_JOB_MAX_UNPOLLED of them.
+    int takeFinished(std::vector<std::pair<int, AssetJob>>& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int handle : finished_) {
+            auto it = jobs_.find(handle);
+            if (it == jobs_.end()) {
+                continue;
+            }
+            if (it->second.callbackRef != LUA_NOREF) {
+                out.emplace_back(handle, std::move(it->second));
+                jobs_.erase(it);
+            } else {
+                unpolled_.push_back(handle);
+            }
+        }
+        // Handles already released by poll are skipped by the erase
+        while (unpolled_.size() > ASSET_JOB_MAX_UNPOLLED) {
+            jobs_.erase(unpolled_.front());
+            unpolled_.pop_front();
+        }
+        int count = (int)finished_.size();
+        finished_.clear();
+        return count;
+    }
+
+    void progress(int& done, int& total) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done = batchDone_;
+        total = batchTotal_;
+    }
+
+private:
+    void startLocked() {
+        for (int i = 0; i < workerCount_; i++) {
+            workers_.emplace_back([this] { workerMain(); });
+        }
+    }
+
+    void finishLocked(int handle, AssetJobState state, lua_Integer result) {
+        auto it = jobs_.find(handle);
+        if (it != jobs_.end()) {
+            it->second.state = state;
+            it->second.result = result;
+        }
+        finished_.push_back(handle);
+        batchDone_++;
+    }
+
+    void workerMain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] {
+                return stopping_ || !pending_.empty() || !prefetch_.empty();
+            });
+            if (stopping_) {
+                return;
+            }
+
+            if (pending_.empty()) {
+                AssetJob job;
+                job.kind = ASSET_JOB_PREFETCH;
+                job.name = std::move(prefetch_.front());
+                prefetch_.pop_front();
+                lock.unlock();
+
+                lua_Integer result = 0;
+                bool ok = assetRunJob(job, result);
+
+                lock.lock();
+                if (!ok) {
+                    prefetchFailed_++;
+                } else if (result) {
+                    prefetchLoaded_++;
+                } else {
+                    prefetchResident_++;
+                }
+                continue;
+            }
+
+            int handle = pending_.front();
+            pending_.pop_front();
+            auto it = jobs_.find(handle);
+            if (it == jobs_.end()) {
+                continue;
+            }
+            it->second.state = ASSET_JOB_RUNNING;
+            AssetJob job = it->second;
+            lock.unlock();
+
+            lua_Integer result = 0;
+            bool ok = assetRunJob(job, result);
+
+            lock.lock();
+            finishLocked(handle, ok ? ASSET_JOB_DONE : ASSET_JOB_FAILED, result);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::unordered_map<int, AssetJob> jobs_;
+    std::deque<int> pending_;
+    std::deque<std::string> prefetch_;
+    std::vector<int> finished_;
+    std::deque<int> unpolled_;
+    std::vector<std::thread> workers_;
+    int workerCount_ = 2;
+    int nextHandle_ = 1;
+    int batchDone_ = 0;
+    int batchTotal_ = 0;
+    int prefetchLoaded_ = 0;
+    int prefetchResident_ = 0;
+    int prefetchFailed_ = 0;
+    bool stopping_ = false;
+};
+
+static AssetLoadQueue g_assetLoadQueue;
+static int g_assetProgressRef = LUA_NOREF;
+
+static void assetStopLoaders() {
+    g_assetLoadQueue.stop(true);
+    g_assetWatcher.setEnabled(false);
+}
+
+// Queue a job, taking an optional callback from stack index callbackIndex
+static int assetSubmitJob(lua_State* L, AssetJob job, int callbackIndex) {
+    if (!lua_isnoneornil(L, callbackIndex)) {
+        luaL_checktype(L, callbackIndex, LUA_TFUNCTION);
+        lua_pushvalue(L, callbackIndex);
+        job.callbackRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_pushinteger(L, g_assetLoadQueue.submit(std::move(job)));
+    return 1;
+}
+
+// asset.loadAsync(name[, callback]) -> handle
+static int lua_st_asset_load_async(lua_State* L) {
+    AssetJob job;
+    job.kind = ASSET_JOB_LOAD;
+    job.name = luaL_checkstring(L, 1);
+    g_assetTrace.record(job.name.c_str());
+    return assetSubmitJob(L, std::move(job), 2);
+}
+
+// asset.loadFileAsync(path, type[, callback]) -> handle
+static int lua_st_asset_load_file_async(lua_State* L) {
+    AssetJob job;
+    job.kind = ASSET_JOB_LOAD_FILE;
+    job.path = luaL_checkstring(L, 1);
+    job.type = luaL_checkinteger(L, 2);
+    return assetSubmitJob(L, std::move(job), 3);
+}
+
+// asset.importAsync(file, name[, type[, callback]]) -> handle
+static int lua_st_asset_import_async(lua_State* L) {
+    AssetJob job;
+    job.kind = ASSET_JOB_IMPORT;
+    job.path = luaL_checkstring(L, 1);
+    job.name = luaL_checkstring(L, 2);
+    job.type = luaL_optinteger(L, 3, -1);
+    return assetSubmitJob(L, std::move(job), 4);
+}
+
+// asset.importDirectoryAsync(dir[, recursive[, callback]]) -> handle
+static int lua_st_asset_import_directory_async(lua_State* L) {
+    AssetJob job;
+    job.kind = ASSET_JOB_IMPORT_DIRECTORY;
+    job.name = luaL_checkstring(L, 1);
+    job.recursive = lua_toboolean(L, 2);
+    return assetSubmitJob(L, std::move(job), 3);
+}
+
+// asset.poll(handle) -> state, result  (nil once the handle is released)
+// result is the asset ID for loads, the file count for directory imports and
+// 1/0 for single imports.
+static int lua_st_asset_poll(lua_State* L) {
+    int handle = luaL_checkinteger(L, 1);
+
+    AssetJobState state;
+    lua_Integer result;
+    if (!g_assetLoadQueue.poll(handle, state, result)) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushstring(L, kAssetJobStateNames[state]);
+    lua_pushinteger(L, result);
+    return 2;
+}
+
+static int lua_st_asset_cancel(lua_State* L) {
+    int handle = luaL_checkinteger(L, 1);
+    lua_pushboolean(L, g_assetLoadQueue.cancel(handle));
+    return 1;
+}
+
+// asset.getAsyncProgress() -> done, total  (for the current batch of jobs)
+static int lua_st_asset_get_async_progress(lua_State* L) {
+    int done, total;
+    g_assetLoadQueue.progress(done, total);
+    lua_pushinteger(L, done);
+    lua_pushinteger(L, total);
+    return 2;
+}
+
+// asset.setProgressCallback(fn(done, total) | nil)
+static int lua_st_asset_set_progress_callback(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, g_assetProgressRef);
+    g_assetProgressRef = LUA_NOREF;
+    if (!lua_isnoneornil(L, 1)) {
+        lua_pushvalue(L, 1);
+        g_assetProgressRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return 0;
+}
+
+static int lua_st_asset_set_async_workers(lua_State* L) {
+    int count = luaL_checkinteger(L, 1);
+    if (count < 1 || count > 16) {
+        return luaL_error(L, "worker count must be 1..16");
+    }
+    g_assetLoadQueue.setWorkerCount(count);
+    return 0;
+}
+
+// Call the function below nargs arguments in protected mode. The first
+// error message of a dispatch is kept in error; later ones are dropped.
+static void assetCallProtected(lua_State* L, int nargs, std::string& error) {
+    if (lua_pcall(L, nargs, 0, 0) != 0) {
+        if (error.empty()) {
+            const char* message = lua_tostring(L, -1);
+            error = message ? message : "error in asset callback";
+        }
+        lua_pop(L, 1);
+    }
+}
+
+// Re-raise the first callback error of a dispatch once every callback has run
+static void assetRaiseCallbackError(lua_State* L, std::string& error) {
+    if (error.empty()) {
+        return;
+    }
+    lua_pushlstring(L, error.data(), error.size());
+    std::string().swap(error);
+    lua_error(L);
+}
+
+// Run completion callbacks fn(handle, ok, result) and the progress callback.
+// Every callback runs even if an earlier one raises; the first error is
+// raised afterwards.
+static void assetDispatchCompletions(lua_State* L) {
+    std::vector<std::pair<int, AssetJob>> finished;
+    int finishedCount = g_assetLoadQueue.takeFinished(finished);
+
+    int done, total;
+    g_assetLoadQueue.progress(done, total);
+
+    std::string error;
+    for (auto& entry : finished) {
+        AssetJob& job = entry.second;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, job.callbackRef);
+        luaL_unref(L, LUA_REGISTRYINDEX, job.callbackRef);
+        lua_pushinteger(L, entry.first);
+        lua_pushboolean(L, job.state == ASSET_JOB_DONE);
+        lua_pushinteger(L, job.result);
+        assetCallProtected(L, 3, error);
+    }
+
+    if (finishedCount > 0 && g_assetProgressRef != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, g_assetProgressRef);
+        lua_pushinteger(L, done);
+        lua_pushinteger(L, total);
+        assetCallProtected(L, 2, error);
+    }
+    assetRaiseCallbackError(L, error);
+}
+
+// =============================================================================
+// Asset Hot Reload
+// =============================================================================
+
+static int g_assetReloadRef = LUA_NOREF;
+
+// Import files staged by the watcher, swap resident copies of the re-imported
+// assets and notify asset.onReload subscribers with fn(name, id). id is the
+// new asset ID, or nil if the asset was not loaded. Views of a swapped asset
+// are released.
+static void assetDispatchReloads(lua_State* L) {
+    std::vector<std::string> names;
+    std::vector<STAssetID> ids;
+    {
+        // Import and swap under one hold of the lock, so no load sees the
+        // new contents before the old copy is replaced
+        std::lock_guard<std::mutex> lock(g_assetMutex);
+        g_assetWatcher.applyStaged(names);
+        ids.assign(names.size(), -1);
+        for (size_t i = 0; i < names.size(); i++) {
+            STAssetID previous = g_assetResidency.find(names[i]);
+            if (previous < 0) {
+                continue;
+            }
+            // Move every load held on the old copy over to the new one
+            uint32_t refs = 0;
+            bool prefetched = false;
+            g_assetResidency.holds(previous, refs, prefetched);
+            g_assetViews.erase(previous);
+            g_assetResidency.forget(previous);
+            for (uint32_t k = 0; k < refs + (prefetched ? 1 : 0); k++) {
+                st_asset_unload(previous);
+            }
+
+            STAssetID asset = -1;
+            for (uint32_t k = 0; k < refs + (prefetched ? 1 : 0); k++) {
+                asset = st_asset_load(names[i].c_str());
+                if (asset < 0) {
+                    break;
+                }
+                g_assetResidency.admit(asset, prefetched && k == 0);
+            }
+            ids[i] = asset;
+        }
+    }
+
+    if (names.empty() || g_assetReloadRef == LUA_NOREF) {
+        return;
+    }
+    // Every name is reported even if a callback fails; the first error is
+    // raised afterwards
+    std::string error;
+    for (size_t i = 0; i < names.size(); i++) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, g_assetReloadRef);
+        lua_pushlstring(L, names[i].data(), names[i].size());
+        if (ids[i] >= 0) {
+            lua_pushinteger(L, ids[i]);
+        } else {
+            lua_pushnil(L);
+        }
+        assetCallProtected(L, 2, error);
+    }
+    assetRaiseCallbackError(L, error);
+}
+
+// Per-frame asset work, run from wait_frame and asset.update
+static void assetFrameUpdate(lua_State* L) {
+    assetDispatchCompletions(L);
+    assetDispatchReloads(L);
+}
+
+// asset.update() - run async completion callbacks, the progress callback and
+// hot reload swaps. wait_frame does this automatically; call it directly from
+// loops that don't wait for frames.
+static int lua_st_asset_update(lua_State* L) {
+    assetFrameUpdate(L);
+    return 0;
+}
+
+// asset.setHotReload(enabled) - watch directories imported with
+// asset.importDirectory (and any added with asset.watch) for changes
+static int lua_st_asset_set_hot_reload(lua_State* L) {
+    g_assetWatcher.setEnabled(lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lua_st_asset_is_hot_reload_enabled(lua_State* L) {
+    lua_pushboolean(L, g_assetWatcher.enabled());
+    return 1;
+}
+
+// asset.watch(dir[, recursive]) - watch a directory that was imported
+// outside the bindings
+static int lua_st_asset_watch(lua_State* L) {
+    const char* directory = luaL_checkstring(L, 1);
+    bool recursive = lua_toboolean(L, 2);
+    g_assetWatcher.addDirectory(directory, recursive);
+    return 0;
+}
+
+// asset.onReload(fn(name, id) | nil)
+static int lua_st_asset_on_reload(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, g_assetReloadRef);
+    g_assetReloadRef = LUA_NOREF;
+    if (!lua_isnoneornil(L, 1)) {
+        lua_pushvalue(L, 1);
+        g_assetReloadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return 0;
+}
+
+// asset.getHotReloadStats() -> watched directories, re-imports, failures
+static int lua_st_asset_get_hot_reload_stats(lua_State* L) {
+    int roots, reimports, failures;
+    g_assetWatcher.stats(roots, reimports, failures);
+    lua_pushinteger(L, roots);
+    lua_pushinteger(L, reimports);
+    lua_pushinteger(L, failures);
+    return 3;
+}
+
+// =============================================================================
+// Asset Prefetch
+// =============================================================================
+//
+// Prefetch groups list the assets a level needs so they can be warmed into
+// the cache on the async workers before the level starts. Groups are defined
+// from Lua, loaded from a manifest file, or recorded with the access trace:
+//
+//   # comment
+//   [level1]
+//   sprites/player
+//   sounds/jump
+
+static std::map<std::string, std::vector<std::string>> g_prefetchGroups;
+
+// Collect asset names from a table argument
+static void luaL_checknamelist(lua_State* L, int idx, std::vector<std::string>& names) {
+    luaL_checktype(L, idx, LUA_TTABLE);
+    int count = (int)lua_objlen(L, idx);
+    names.clear();
+    names.reserve(count);
+    for (int i = 1; i <= count; i++) {
+        lua_rawgeti(L, idx, i);
+        size_t len;
+        const char* name = lua_tolstring(L, -1, &len);
+        if (name && len > 0) {
+            names.emplace_back(name, len);
+        }
+        lua_pop(L, 1);
+    }
+}
+
+static void lua_pushnamelist(lua_State* L, const std::vector<std::string>& names) {
+    lua_createtable(L, (int)names.size(), 0);
+    for (size_t i = 0; i < names.size(); i++) {
+        lua_pushlstring(L, names[i].data(), names[i].size());
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+}
+
+// asset.prefetch(names) -> queued count
+static int lua_st_asset_prefetch(lua_State* L) {
+    std::vector<std::string> names;
+    luaL_checknamelist(L, 1, names);
+    g_assetLoadQueue.prefetch(names);
+    lua_pushinteger(L, (lua_Integer)names.size());
+    return 1;
+}
+
+static int lua_st_asset_cancel_prefetch(lua_State* L) {
+    lua_pushinteger(L, g_assetLoadQueue.cancelPrefetch());
+    return 1;
+}
+
+static int lua_st_asset_define_prefetch_group(lua_State* L) {
+    const char* group = luaL_checkstring(L, 1);
+    luaL_checknamelist(L, 2, g_prefetchGroups[group]);
+    return 0;
+}
+
+// asset.prefetchGroup(group) -> queued count, or nil if the group is unknown
+static int lua_st_asset_prefetch_group(lua_State* L) {
+    const char* group = luaL_checkstring(L, 1);
+
+    auto it = g_prefetchGroups.find(group);
+    if (it == g_prefetchGroups.end()) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    g_assetLoadQueue.prefetch(it->second);
+    lua_pushinteger(L, (lua_Integer)it->second.size());
+    return 1;
+}
+
+static int lua_st_asset_get_prefetch_group(lua_State* L) {
+    const char* group = luaL_checkstring(L, 1);
+
+    auto it = g_prefetchGroups.find(group);
+    if (it == g_prefetchGroups.end()) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushnamelist(L, it->second);
+    return 1;
+}
+
+// asset.loadManifest(path) -> group count, or nil if the file can't be read.
+// Groups in the file replace existing groups of the same name.
+static int lua_st_asset_load_manifest(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    std::vector<std::string>* group = nullptr;
+    int groupCount = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        char* start = line;
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        char* end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' ||
+                               end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        *end = '\0';
+
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (*start == '[' && end[-1] == ']') {
+            group = &g_prefetchGroups[std::string(start + 1, end - 1)];
+            group->clear();
+            groupCount++;
+        } else if (group) {
+            group->emplace_back(start, end);
+        }
+    }
+    fclose(file);
+
+    lua_pushinteger(L, groupCount);
+    return 1;
+}
+
+// asset.saveManifest(path) -> true on success; writes every defined group
+static int lua_st_asset_save_manifest(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    for (const auto& entry : g_prefetchGroups) {
+        fprintf(file, "[%s]\n", entry.first.c_str());
+        for (const std::string& name : entry.second) {
+            fprintf(file, "%s\n", name.c_str());
+        }
+        fprintf(file, "\n");
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    lua_pushboolean(L, ok);
+    return 1;
+}
+
+// asset.traceStart() - record the order in which assets are first loaded
+static int lua_st_asset_trace_start(lua_State* L) {
+    (void)L;
+    g_assetTrace.active = true;
+    g_assetTrace.order.clear();
+    g_assetTrace.seen.clear();
+    return 0;
+}
+
+// asset.traceStop([group]) -> names in first-load order. If a group name is
+// given the trace is also stored as that prefetch group.
+static int lua_st_asset_trace_stop(lua_State* L) {
+    g_assetTrace.active = false;
+    if (!lua_isnoneornil(L, 1)) {
+        g_prefetchGroups[luaL_checkstring(L, 1)] = g_assetTrace.order;
+    }
+    lua_pushnamelist(L, g_assetTrace.order);
+    return 1;
+}
+
+static int lua_st_asset_get_prefetch_stats(lua_State* L) {
+    int queued, loaded, resident, failed;
+    g_assetLoadQueue.prefetchStats(queued, loaded, resident, failed);
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, queued);
+    lua_setfield(L, -2, "queued");
+    lua_pushinteger(L, loaded);
+    lua_setfield(L, -2, "loaded");
+    lua_pushinteger(L, resident);
+    lua_setfield(L, -2, "resident");
+    lua_pushinteger(L, failed);
+    lua_setfield(L, -2, "failed");
+    return 1;
+}
+
+// =============================================================================
+// Asset Cache Policy
+// =============================================================================
+
+// asset.setEvictionPolicy("lru" | "lfu" | "arc" | "gdsf") -> true if known
+static int lua_st_asset_set_eviction_policy(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, kAssetEvictionPolicyNames[i]) == 0) {
+            std::lock_guard<std::mutex> lock(g_assetMutex);
+            g_assetResidency.setPolicy((AssetEvictionPolicy)i);
+            lua_pushboolean(L, true);
+            return 1;
+        }
+    }
+    lua_pushboolean(L, false);
+    return 1;
+}
+
+static int lua_st_asset_get_eviction_policy(lua_State* L) {
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    lua_pushstring(L, kAssetEvictionPolicyNames[g_assetResidency.policy()]);
+    return 1;
+}
+
+// asset.setTypeBudget(type, bytes) - 0 removes the limit. Prefetched assets
+// of the type are evicted immediately if they already exceed the new budget;
+// script loads are never evicted (see asset.getCacheStats pressure).
+static int lua_st_asset_set_type_budget(lua_State* L) {
+    int type = luaL_checkinteger(L, 1);
+    lua_Integer bytes = luaL_checkinteger(L, 2);
+    if (bytes < 0) {
+        return luaL_error(L, "budget must be >= 0");
+    }
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetResidency.setBudget(type, (size_t)bytes);
+    return 0;
+}
+
+static int lua_st_asset_get_type_budget(lua_State* L) {
+    int type = luaL_checkinteger(L, 1);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    lua_pushinteger(L, (lua_Integer)g_assetResidency.budget(type));
+    return 1;
+}
+
+// asset.getCacheStats() -> { [type] = { budget, used, pinned, pressure, count,
+//     loads, bytesLoaded, evictions, bytesEvicted }, ... }
+// pinned is the bytes held by script loads, which are never evicted;
+// pressure is how far pinned alone exceeds the budget.
+static int lua_st_asset_get_cache_stats(lua_State* L) {
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    const auto& types = g_assetResidency.types();
+
+    lua_createtable(L, 0, (int)types.size());
+    for (const auto& entry : types) {
+        const AssetTypeCache& cache = entry.second;
+        lua_createtable(L, 0, 7);
+        lua_pushinteger(L, (lua_Integer)cache.budget);
+        lua_setfield(L, -2, "budget");
+        lua_pushinteger(L, (lua_Integer)cache.used);
+        lua_setfield(L, -2, "used");
+        lua_pushinteger(L, (lua_Integer)cache.pinned);
+        lua_setfield(L, -2, "pinned");
+        size_t pressure = cache.budget > 0 && cache.pinned > cache.budget ? cache.pinned - cache.budget : 0;
+        lua_pushinteger(L, (lua_Integer)pressure);
+        lua_setfield(L, -2, "pressure");
+        lua_pushinteger(L, (lua_Integer)cache.residents.size());
+        lua_setfield(L, -2, "count");
+        lua_pushinteger(L, (lua_Integer)cache.loads);
+        lua_setfield(L, -2, "loads");
+        lua_pushinteger(L, (lua_Integer)cache.bytesLoaded);
+        lua_setfield(L, -2, "bytesLoaded");
+        lua_pushinteger(L, (lua_Integer)cache.evictions);
+        lua_setfield(L, -2, "evictions");
+        lua_pushinteger(L, (lua_Integer)cache.bytesEvicted);
+        lua_setfield(L, -2, "bytesEvicted");
+        lua_rawseti(L, -2, entry.first);
+    }
+    return 1;
+}
+
+static int lua_st_asset_reset_cache_stats(lua_State* L) {
+    (void)L;
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetResidency.resetStats();
+    return 0;
+}
+
+// =============================================================================
+// Asset Index
+// =============================================================================
+
+// Push name, id (nil if not loaded), type, size (nil if not loaded)
+static int lua_pushassetentry(lua_State* L, const AssetNameIndex::Entry& e) {
+    const char* name = g_assetNameIndex.name(e);
+    lua_pushlstring(L, name, e.length);
+
+    STAssetID asset = g_assetResidency.find(g_assetDedup.resolve(std::string(name, e.length).c_str()));
+    if (asset >= 0) {
+        lua_pushinteger(L, asset);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_pushinteger(L, e.type);
+    if (asset >= 0) {
+        lua_pushinteger(L, (lua_Integer)st_asset_get_size(asset));
+    } else {
+        lua_pushnil(L);
+    }
+    return 4;
+}
+
+// Iterator body. Upvalues: type filter, next position, index generation.
+// Iteration ends early if the index is rebuilt by an import or delete.
+static int lua_st_asset_iter_next(lua_State* L) {
+    int type = lua_tointeger(L, lua_upvalueindex(1));
+    size_t pos = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+    uint32_t generation = (uint32_t)lua_tointeger(L, lua_upvalueindex(3));
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    if (generation != g_assetNameIndex.generation()) {
+        return 0;
+    }
+
+    while (pos < g_assetNameIndex.size()) {
+        const AssetNameIndex::Entry& e = g_assetNameIndex.entry(pos++);
+        if (type < 0 || e.type == type) {
+            lua_pushinteger(L, (lua_Integer)pos);
+            lua_replace(L, lua_upvalueindex(2));
+            return lua_pushassetentry(L, e);
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer)pos);
+    lua_replace(L, lua_upvalueindex(2));
+    return 0;
+}
+
+// for name, id, type, size in asset.iter([type]) do ... end
+// id and size are nil for assets that are not loaded.
+static int lua_st_asset_iter(lua_State* L) {
+    int type = luaL_optinteger(L, 1, -1);
+
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(g_assetMutex);
+        g_assetNameIndex.ensure();
+        generation = g_assetNameIndex.generation();
+    }
+
+    lua_pushinteger(L, type);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, generation);
+    lua_pushcclosure(L, lua_st_asset_iter_next, 3);
+    return 1;
+}
+
+// Shared by find and findPrefix: (text[, type[, limit]]) -> {name, ...}
+static int assetIndexQuery(lua_State* L, bool prefix) {
+    size_t length;
+    const char* text = luaL_checklstring(L, 1, &length);
+    int type = luaL_optinteger(L, 2, -1);
+    int limit = luaL_optinteger(L, 3, 0);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetNameIndex.ensure();
+
+    lua_newtable(L);
+    int count = 0;
+    auto visit = [&](const AssetNameIndex::Entry& e) {
+        if (type >= 0 && e.type != type) {
+            return true;
+        }
+        lua_pushlstring(L, g_assetNameIndex.name(e), e.length);
+        lua_rawseti(L, -2, ++count);
+        return limit <= 0 || count < limit;
+    };
+
+    if (prefix) {
+        g_assetNameIndex.findPrefix(text, length, visit);
+    } else {
+        g_assetNameIndex.findSubstring(text, length, visit);
+    }
+    return 1;
+}
+
+// asset.find(text[, type[, limit]]) -> names containing text, sorted
+static int lua_st_asset_find(lua_State* L) {
+    return assetIndexQuery(L, false);
+}
+
+// asset.findPrefix(prefix[, type[, limit]]) -> names starting with prefix
+static int lua_st_asset_find_prefix(lua_State* L) {
+    return assetIndexQuery(L, true);
+}
+
+// asset.refreshIndex() -> asset count; picks up changes made outside the
+// bindings
+static int lua_st_asset_refresh_index(lua_State* L) {
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    g_assetNameIndex.invalidate();
+    g_assetNameIndex.ensure();
+    lua_pushinteger(L, (lua_Integer)g_assetNameIndex.size());
+    return 1;
+}
+
+// =============================================================================
+// Asset Archive
+// =============================================================================
+
+// Read-only packed archive, little-endian:
+//   AssetArchiveHeader
+//   AssetArchiveEntry[entryCount], sorted by name (byte order)
+//   name blob
+//   payloads, 16-byte aligned, raw or LZ4
+// Archives are memory-mapped. Raw entries are served straight from the
+// mapping; LZ4 entries are decoded once on first access and kept until the
+// archive is closed. Each entry carries an XXH64 hash of its raw bytes.
+// Payloads are content-addressed: entries with identical contents share one
+// payload, and a shared payload is decoded once. Entries sharing a payload
+// must agree on its stored size, raw size and encoding.
+
+static const uint32_t ASSET_ARCHIVE_VERSION = 1;
+
+// An LZ4 block expands at most about 255:1, so a larger claimed raw size is
+// corrupt and is rejected before anything is allocated for it
+static const uint64_t ASSET_ARCHIVE_MAX_LZ4_RATIO = 255;
+
+enum AssetArchiveEncoding {
+    ASSET_ARCHIVE_RAW = 0,
+    ASSET_ARCHIVE_LZ4 = 1
+};
+
+struct AssetArchiveHeader {
+    char magic[4];          // "STPK"
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+struct AssetArchiveEntry {
+    uint32_t nameOffset;    // into the name blob
+    uint32_t nameLength;
+    uint64_t dataOffset;
+    uint64_t storedSize;
+    uint64_t rawSize;
+    uint64_t hash;          // XXH64 of the raw bytes
+    int32_t type;
+    uint32_t encoding;
+};
+
+static_assert(sizeof(AssetArchiveHeader) == 32, "archive header layout");
+static_assert(sizeof(AssetArchiveEntry) == 48, "archive entry layout");
+
+struct AssetArchive {
+    MappedFile file;
+    const AssetArchiveEntry* entries = nullptr;
+    const char* names = nullptr;
+    uint32_t entryCount = 0;
+    std::unordered_map<uint64_t, std::vector<uint8_t>> decoded;   // by dataOffset
+
+    const AssetArchiveEntry* find(const char* name, size_t length) const {
+        const AssetArchiveEntry* first = entries;
+        const AssetArchiveEntry* last = entries + entryCount;
+        first = std::lower_bound(first, last, name,
+            [this, length](const AssetArchiveEntry& e, const char* key) {
+                int c = memcmp(names + e.nameOffset, key, std::min<size_t>(e.nameLength, length));
+                return c < 0 || (c == 0 && e.nameLength < length);
+            });
+        if (first == last || first->nameLength != length ||
+            memcmp(names + first->nameOffset, name, length) != 0) {
+            return nullptr;
+        }
+        return first;
+    }
+
+    // Raw bytes of an entry, decoding LZ4 entries on first use
+    const uint8_t* data(const AssetArchiveEntry& e) {
+        const uint8_t* stored = file.data() + e.dataOffset;
+        if (e.encoding == ASSET_ARCHIVE_RAW) {
+            return stored;
+        }
+
+        auto it = decoded.find(e.dataOffset);
+        if (it == decoded.end()) {
+            std::vector<uint8_t> raw(e.rawSize);
+            if (!lz4DecodeBlock(stored, e.storedSize, raw.data(), raw.size())) {
+                return nullptr;
+            }
+            it = decoded.emplace(e.dataOffset, std::move(raw)).first;
+        }
+        return it->second.data();
+    }
+};
+
+static SlotMap<AssetArchive> g_assetArchives;
+
+static AssetArchive& luaL_checkassetarchive(lua_State* L, int idx) {
+    AssetArchive* archive = g_assetArchives.get((uint32_t)luaL_checkinteger(L, idx));
+    if (!archive) {
+        luaL_argerror(L, idx, "invalid archive");
+    }
+    return *archive;
+}
+
+// asset.openArchive(path) -> archive handle, or nil
+static int lua_st_asset_open_archive(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+
+    AssetArchive archive;
+    if (!archive.file.openRead(path) || archive.file.size() < sizeof(AssetArchiveHeader)) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    const uint8_t* base = archive.file.data();
+    size_t fileSize = archive.file.size();
+    AssetArchiveHeader header;
+    memcpy(&header, base, sizeof(header));
+    size_t tableEnd = sizeof(header) + (size_t)header.entryCount * sizeof(AssetArchiveEntry);
+    if (memcmp(header.magic, "STPK", 4) != 0 || header.version != ASSET_ARCHIVE_VERSION ||
+        tableEnd > fileSize || header.namesOffset > fileSize ||
+        header.namesSize > fileSize - header.namesOffset) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    archive.entries = (const AssetArchiveEntry*)(base + sizeof(header));
+    archive.names = (const char*)(base + header.namesOffset);
+    archive.entryCount = header.entryCount;
+    for (uint32_t i = 0; i < archive.entryCount; i++) {
+        const AssetArchiveEntry& e = archive.entries[i];
+        if ((uint64_t)e.nameOffset + e.nameLength > header.namesSize ||
+            e.dataOffset > fileSize || e.storedSize > fileSize - e.dataOffset ||
+            (e.encoding == ASSET_ARCHIVE_RAW && e.storedSize != e.rawSize) ||
+            (e.encoding == ASSET_ARCHIVE_LZ4 && e.rawSize > e.storedSize * ASSET_ARCHIVE_MAX_LZ4_RATIO + 16) ||
+            e.encoding > ASSET_ARCHIVE_LZ4) {
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+
+    // The decode cache is keyed by payload offset, so every entry pointing
+    // at one payload must describe it the same way
+    std::vector<const AssetArchiveEntry*> byOffset(archive.entryCount);
+    for (uint32_t i = 0; i < archive.entryCount; i++) {
+        byOffset[i] = &archive.entries[i];
+    }
+    std::sort(byOffset.begin(), byOffset.end(), [](const AssetArchiveEntry* a, const AssetArchiveEntry* b) {
+        return a->dataOffset < b->dataOffset;
+    });
+    for (size_t i = 1; i < byOffset.size(); i++) {
+        const AssetArchiveEntry& a = *byOffset[i - 1];
+        const AssetArchiveEntry& b = *byOffset[i];
+        if (a.dataOffset == b.dataOffset &&
+            (a.storedSize != b.storedSize || a.rawSize != b.rawSize || a.encoding != b.encoding)) {
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+
+    uint32_t handle = g_assetArchives.insert(std::move(archive));
+    if (handle == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, handle);
+    return 1;
+}
+
+static int lua_st_asset_close_archive(lua_State* L) {
+    g_assetArchives.erase((uint32_t)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+// asset.archiveGetView(archive, name) -> pointer, size, type  (or nil)
+// Raw entries point into the mapping; the pointer is valid until the archive
+// is closed.
+static int lua_st_asset_archive_get_view(lua_State* L) {
+    AssetArchive& archive = luaL_checkassetarchive(L, 1);
+    size_t length;
+    const char* name = luaL_checklstring(L, 2, &length);
+
+    const AssetArchiveEntry* e = archive.find(name, length);
+    const uint8_t* data = e ? archive.data(*e) : nullptr;
+    if (!data) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushlightuserdata(L, (void*)data);
+    lua_pushinteger(L, (lua_Integer)e->rawSize);
+    lua_pushinteger(L, e->type);
+    return 3;
+}
+
+// asset.archiveGetData(archive, name) -> data string, type  (or nil)
+static int lua_st_asset_archive_get_data(lua_State* L) {
+    AssetArchive& archive = luaL_checkassetarchive(L, 1);
+    size_t length;
+    const char* name = luaL_checklstring(L, 2, &length);
+
+    const AssetArchiveEntry* e = archive.find(name, length);
+    const uint8_t* data = e ? archive.data(*e) : nullptr;
+    if (!data) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)data, e->rawSize);
+    lua_pushinteger(L, e->type);
+    return 2;
+}
+
+// asset.archiveList(archive) -> {name, ...} in name order
+static int lua_st_asset_archive_list(lua_State* L) {
+    AssetArchive& archive = luaL_checkassetarchive(L, 1);
+
+    lua_createtable(L, archive.entryCount, 0);
+    for (uint32_t i = 0; i < archive.entryCount; i++) {
+        const AssetArchiveEntry& e = archive.entries[i];
+        lua_pushlstring(L, archive.names + e.nameOffset, e.nameLength);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+// asset.archiveVerify(archive) -> true, or false and the first bad name
+static int lua_st_asset_archive_verify(lua_State* L) {
+    AssetArchive& archive = luaL_checkassetarchive(L, 1);
+
+    for (uint32_t i = 0; i < archive.entryCount; i++) {
+        const AssetArchiveEntry& e = archive.entries[i];
+        const uint8_t* data = archive.data(e);
+        if (!data || xxh64(data, e.rawSize) != e.hash) {
+            lua_pushboolean(L, false);
+            lua_pushlstring(L, archive.names + e.nameOffset, e.nameLength);
+            return 2;
+        }
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// Call visit(data, size, type) with the contents of a named asset, loading it
+// for the call if it is not already resident. Caller holds g_assetMutex.
+template <typename Visit>
+static bool assetWithData(const std::string& alias, Visit visit) {
+    std::string name = g_assetDedup.resolve(alias.c_str());
+    STAssetID asset = g_assetResidency.find(name);
+    bool loadedHere = asset < 0;
+    if (loadedHere) {
+        asset = st_asset_load(name.c_str());
+        if (asset < 0) {
+            return false;
+        }
+    }
+
+    const uint8_t* data = (const uint8_t*)st_asset_get_data(asset);
+    size_t size = st_asset_get_size(asset);
+    bool ok = data || size == 0;
+    if (ok) {
+        visit(data, size, st_asset_get_type(asset));
+    }
+
+    if (loadedHere) {
+        st_asset_unload(asset);
+    }
+    return ok;
+}
+
+// Names from an optional table argument, or every asset in the database;
+// sorted and unique. Caller holds g_assetMutex.
+static void assetCollectNames(lua_State* L, int idx, std::vector<std::string>& names) {
+    if (!lua_isnoneornil(L, idx)) {
+        luaL_checknamelist(L, idx, names);
+    } else {
+        g_assetNameIndex.ensure();
+        for (size_t i = 0; i < g_assetNameIndex.size(); i++) {
+            const AssetNameIndex::Entry& e = g_assetNameIndex.entry(i);
+            names.emplace_back(g_assetNameIndex.name(e), e.length);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+// Whether a named asset holds exactly these bytes; a matching content key
+// only nominates the pair. Caller holds g_assetMutex.
+static bool assetHasContents(const std::string& name, const uint8_t* data, size_t size) {
+    bool same = false;
+    assetWithData(name, [&](const uint8_t* other, size_t otherSize, int) {
+        same = otherSize == size && (size == 0 || memcmp(other, data, size) == 0);
+    });
+    return same;
+}
+
+// asset.exportArchive(path[, names[, compress]]) -> entries, payloads,
+//     bytes saved by dedup; or nil
+// Packs the named assets (default: every asset in the database) from the
+// current database. With compress, entries are stored as LZ4 when smaller.
+static int lua_st_asset_export_archive(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    bool compress = lua_toboolean(L, 3);
+
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+
+    std::vector<std::string> names;
+    assetCollectNames(L, 2, names);
+
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    std::string nameBlob;
+    for (const std::string& name : names) {
+        nameBlob += name;
+    }
+    uint64_t namesOffset = sizeof(AssetArchiveHeader) + names.size() * sizeof(AssetArchiveEntry);
+    uint64_t offset = (namesOffset + nameBlob.size() + 15) & ~(uint64_t)15;
+
+    std::vector<AssetArchiveEntry> entries;
+    entries.reserve(names.size());
+    std::vector<uint8_t> packed;
+    static const uint8_t padding[16] = {};
+    bool ok = fseek(out, (long)offset, SEEK_SET) == 0;
+    uint32_t nameOffset = 0;
+
+    // Payload already written for each distinct content, and the index of
+    // the name it was written for
+    std::unordered_map<AssetContentKey, std::pair<AssetArchiveEntry, size_t>, AssetContentKeyHash> payloads;
+    size_t payloadCount = 0;
+    uint64_t bytesSaved = 0;
+
+    for (size_t i = 0; i < names.size() && ok; i++) {
+        const std::string& name = names[i];
+        uint32_t thisNameOffset = nameOffset;
+        nameOffset += (uint32_t)name.size();
+
+        assetWithData(name, [&](const uint8_t* data, size_t size, int type) {
+            AssetContentKey key = assetContentKey(data, size);
+
+            AssetArchiveEntry entry;
+            entry.nameOffset = thisNameOffset;
+            entry.nameLength = (uint32_t)name.size();
+            entry.rawSize = size;
+            entry.hash = key.hash;
+            entry.type = type;
+
+            auto shared = payloads.find(key);
+            if (shared != payloads.end() && assetHasContents(names[shared->second.second], data, size)) {
+                entry.dataOffset = shared->second.first.dataOffset;
+                entry.storedSize = shared->second.first.storedSize;
+                entry.encoding = shared->second.first.encoding;
+                bytesSaved += entry.storedSize;
+                entries.push_back(entry);
+                return;
+            }
+
+            const uint8_t* stored = data;
+            entry.dataOffset = offset;
+            entry.storedSize = size;
+            entry.encoding = ASSET_ARCHIVE_RAW;
+            if (compress && size > 0) {
+                lz4EncodeBlock(data, size, packed);
+                if (packed.size() < size) {
+                    stored = packed.data();
+                    entry.storedSize = packed.size();
+                    entry.encoding = ASSET_ARCHIVE_LZ4;
+                }
+            }
+
+            size_t pad = (size_t)((16 - (entry.storedSize & 15)) & 15);
+            ok = (entry.storedSize == 0 || fwrite(stored, 1, entry.storedSize, out) == entry.storedSize) &&
+                 (pad == 0 || fwrite(padding, 1, pad, out) == pad);
+            offset += entry.storedSize + pad;
+            payloads.emplace(key, std::make_pair(entry, i));
+            payloadCount++;
+            entries.push_back(entry);
+        });
+    }
+
+    AssetArchiveHeader header;
+    memcpy(header.magic, "STPK", 4);
+    header.version = ASSET_ARCHIVE_VERSION;
+    header.entryCount = (uint32_t)entries.size();
+    header.reserved = 0;
+    header.namesOffset = sizeof(AssetArchiveHeader) + entries.size() * sizeof(AssetArchiveEntry);
+    header.namesSize = nameBlob.size();
+
+    // Skipped names leave the table shorter than reserved; the name blob
+    // moves up to follow it directly
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, out) == 1 &&
+         (entries.empty() || fwrite(entries.data(), sizeof(AssetArchiveEntry), entries.size(), out) == entries.size()) &&
+         (nameBlob.empty() || fwrite(nameBlob.data(), 1, nameBlob.size(), out) == nameBlob.size());
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok) {
+        remove(path);
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, (lua_Integer)entries.size());
+    lua_pushinteger(L, (lua_Integer)payloadCount);
+    lua_pushinteger(L, (lua_Integer)bytesSaved);
+    return 3;
+}
+
+// asset.findDuplicates([names]) -> { {name, name, ...}, ... }, bytes saved
+// Groups assets with identical contents (default: the whole database). Each
+// group lists names in order; bytes saved is what storing each distinct
+// blob once would save.
+static int lua_st_asset_find_duplicates(lua_State* L) {
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+
+    std::vector<std::string> names;
+    assetCollectNames(L, 1, names);
+
+    std::unordered_map<AssetContentKey, std::vector<uint32_t>, AssetContentKeyHash> groups;
+    std::vector<AssetContentKey> order;
+    for (uint32_t i = 0; i < names.size(); i++) {
+        assetWithData(names[i], [&](const uint8_t* data, size_t size, int) {
+            AssetContentKey key = assetContentKey(data, size);
+            std::vector<uint32_t>& members = groups[key];
+            if (members.empty()) {
+                order.push_back(key);
+            } else if (!assetHasContents(names[members[0]], data, size)) {
+                return;
+            }
+            members.push_back(i);
+        });
+    }
+
+    lua_newtable(L);
+    int groupCount = 0;
+    uint64_t bytesSaved = 0;
+    for (const AssetContentKey& key : order) {
+        const std::vector<uint32_t>& members = groups[key];
+        if (members.size() < 2) {
+            continue;
+        }
+        bytesSaved += key.size * (members.size() - 1);
+        lua_createtable(L, (int)members.size(), 0);
+        for (size_t m = 0; m < members.size(); m++) {
+            const std::string& name = names[members[m]];
+            lua_pushlstring(L, name.data(), name.size());
+            lua_rawseti(L, -2, (int)m + 1);
+        }
+        lua_rawseti(L, -2, ++groupCount);
+    }
+    lua_pushinteger(L, (lua_Integer)bytesSaved);
+    return 2;
+}
+
+// =============================================================================
+// Tilemap API
+// =============================================================================
+
+// Dimensions of each tilemap and the tilemap bound to each layer, recorded as
+// they pass through the bindings so native queries can walk a layer's tiles.
+struct TilemapInfo {
+    int32_t width = 0, height = 0;
+    int32_t tileWidth = 0, tileHeight = 0;
+};
+
+static std::unordered_map<STTilemapID, TilemapInfo> g_tilemapInfo;
+static std::unordered_map<STLayerID, STTilemapID> g_layerTilemap;
+
+static const TilemapInfo* findLayerTilemap(STLayerID layer) {
+    auto it = g_layerTilemap.find(layer);
+    if (it == g_layerTilemap.end()) {
+        return nullptr;
+    }
+    auto info = g_tilemapInfo.find(it->second);
+    return info != g_tilemapInfo.end() ? &info->second : nullptr;
+}
+
+// View state mirrored from the tilemap bindings, used to report how much of
+// each layer a strict chunk-granular cull would draw. Every tile write made
+// through the bindings is counted as upload traffic for the current frame.
+struct TilemapLayerView {
+    float parallaxX = 1.0f, parallaxY = 1.0f;
+    float scrollX = 0.0f, scrollY = 0.0f;
+    float scrollOffsetX = 0.0f, scrollOffsetY = 0.0f;
+    bool visible = true;
+};
+
+struct TilemapViewState {
+    float viewportWidth = 0.0f, viewportHeight = 0.0f;
+    float zoom = 1.0f;
+    float shakeMagnitude = 0.0f, shakeRemaining = 0.0f;
+    uint64_t tileWrites = 0;
+    uint64_t lastFrameTileWrites = 0;
+};
+
+static std::unordered_map<STLayerID, TilemapLayerView> g_layerView;
+static TilemapViewState g_tilemapView;
+
+static void tilemapWriteTile(STLayerID layer, int32_t x, int32_t y, uint16_t tile) {
+    st_tilemap_set_tile(layer, x, y, tile);
+    g_tilemapView.tileWrites++;
+}
+
+// Tile animations are defined per tileset and evaluated in tilemap.update.
+// Each layer keeps an index of its cells that hold a frame of an animation;
+// only those cells are rewritten, and only when their animation changes
+// frame. Single-tile writes keep the index current; bulk writes record the
+// rectangle they touched and only that area is rescanned on the next update.
+// Too many pending rectangles, or a tileset change, rescan the whole layer.
+struct TileAnimation {
+    std::vector<uint16_t> frames;
+    std::vector<float> durations;
+    float totalDuration = 0.0f;
+    int currentFrame = 0;
+    bool changed = false;
+};
+
+struct TilesetAnimations {
+    std::vector<TileAnimation> animations;
+    std::unordered_map<uint16_t, uint32_t> animationOfTile;
+};
+
+struct TileDirtyRect {
+    int32_t x0, y0, x1, y1;    // half-open, clipped to the tilemap
+};
+
+static const size_t TILE_ANIMATION_MAX_DIRTY_RECTS = 32;
+
+struct LayerAnimationState {
+    std::unordered_map<uint64_t, uint32_t> cells;    // packed (x, y) -> animation
+    std::vector<TileDirtyRect> dirtyRects;
+    bool dirty = true;
+};
+
+static std::unordered_map<STTilesetID, TilesetAnimations> g_tilesetAnimations;
+static std::unordered_map<STLayerID, STTilesetID> g_layerTileset;
+static std::unordered_map<STLayerID, LayerAnimationState> g_layerAnimations;
+static double g_tileAnimationClock = 0.0;
+
+static uint64_t tileCellKey(int32_t x, int32_t y) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+}
+
+static TilesetAnimations* findLayerAnimations(STLayerID layer) {
+    auto it = g_layerTileset.find(layer);
+    if (it == g_layerTileset.end()) {
+        return nullptr;
+    }
+    auto anims = g_tilesetAnimations.find(it->second);
+    return anims != g_tilesetAnimations.end() ? &anims->second : nullptr;
+}
+
+static void tileAnimationsInvalidate(STLayerID layer) {
+    auto it = g_layerAnimations.find(layer);
+    if (it != g_layerAnimations.end()) {
+        it->second.dirty = true;
+    }
+}
+
+// Mark the tiles [x0, x1) x [y0, y1) of a layer for a rescan
+static void tileAnimationsInvalidateRect(STLayerID layer, int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    auto it = g_layerAnimations.find(layer);
+    if (it == g_layerAnimations.end() || it->second.dirty) {
+        return;
+    }
+    LayerAnimationState& state = it->second;
+    const TilemapInfo* info = findLayerTilemap(layer);
+    if (!info) {
+        state.dirty = true;
+        return;
+    }
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, info->width);
+    y1 = std::min(y1, info->height);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    if (state.dirtyRects.size() >= TILE_ANIMATION_MAX_DIRTY_RECTS) {
+        state.dirty = true;
+        state.dirtyRects.clear();
+        return;
+    }
+    state.dirtyRects.push_back({x0, y0, x1, y1});
+}
+
+static void tileAnimationsTouch(STLayerID layer, int32_t x, int32_t y, uint16_t tile) {
+    auto it = g_layerAnimations.find(layer);
+    if (it == g_layerAnimations.end() || it->second.dirty) {
+        return;
+    }
+    if (TilesetAnimations* anims = findLayerAnimations(layer)) {
+        auto anim = anims->animationOfTile.find(tile);
+        if (anim != anims->animationOfTile.end()) {
+            it->second.cells[tileCellKey(x, y)] = anim->second;
+            return;
+        }
+    }
+    it->second.cells.erase(tileCellKey(x, y));
+}
+
+static void tileAnimationsAdvance(float dt) {
+    g_tileAnimationClock += dt;
+
+    for (auto& entry : g_tilesetAnimations) {
+        for (TileAnimation& anim : entry.second.animations) {
+            float t = (float)fmod(g_tileAnimationClock, (double)anim.totalDuration);
+            int frame = 0;
+            while (frame + 1 < (int)anim.frames.size() && t >= anim.durations[frame]) {
+                t -= anim.durations[frame];
+                frame++;
+            }
+            anim.changed = (frame != anim.currentFrame);
+            anim.currentFrame = frame;
+        }
+    }
+
+    for (auto& entry : g_layerTileset) {
+        STLayerID layer = entry.first;
+        TilesetAnimations* anims = findLayerAnimations(layer);
+        if (!anims || anims->animations.empty()) {
+            continue;
+        }
+
+        LayerAnimationState& state = g_layerAnimations[layer];
+        bool rescanned = false;
+        if (state.dirty) {
+            const TilemapInfo* info = findLayerTilemap(layer);
+            if (!info) {
+                continue;
+            }
+            state.cells.clear();
+            for (int32_t y = 0; y < info->height; y++) {
+                for (int32_t x = 0; x < info->width; x++) {
+                    auto anim = anims->animationOfTile.find(st_tilemap_get_tile(layer, x, y));
+                    if (anim != anims->animationOfTile.end()) {
+                        state.cells[tileCellKey(x, y)] = anim->second;
+                    }
+                }
+            }
+            state.dirty = false;
+            state.dirtyRects.clear();
+            rescanned = true;
+        }
+
+        // Cells found in a dirty rectangle are brought to the current frame
+        // here; the loop below only rewrites cells whose animation advanced
+        for (const TileDirtyRect& rect : state.dirtyRects) {
+            for (int32_t y = rect.y0; y < rect.y1; y++) {
+                for (int32_t x = rect.x0; x < rect.x1; x++) {
+                    uint64_t key = tileCellKey(x, y);
+                    auto anim = anims->animationOfTile.find(st_tilemap_get_tile(layer, x, y));
+                    if (anim == anims->animationOfTile.end()) {
+                        state.cells.erase(key);
+                        continue;
+                    }
+                    state.cells[key] = anim->second;
+                    const TileAnimation& current = anims->animations[anim->second];
+                    if (!current.changed) {
+                        tilemapWriteTile(layer, x, y, current.frames[current.currentFrame]);
+                    }
+                }
+            }
+        }
+        state.dirtyRects.clear();
+
+        for (const auto& cell : state.cells) {
+            const TileAnimation& anim = anims->animations[cell.second];
+            if (rescanned || anim.changed) {
+                int32_t x = (int32_t)(cell.first >> 32);
+                int32_t y = (int32_t)(uint32_t)cell.first;
+                tilemapWriteTile(layer, x, y, anim.frames[anim.currentFrame]);
+            }
+        }
+    }
+}
+
+static int lua_st_tilemap_init(lua_State* L) {
+    float width = (float)luaL_checknumber(L, 1);
+    float height = (float)luaL_checknumber(L, 2);
+    bool result = st_tilemap_init(width, height);
+    g_tilemapView.viewportWidth = width;
+    g_tilemapView.viewportHeight = height;
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_st_tilemap_shutdown(lua_State* L) {
+    (void)L;
+    st_tilemap_shutdown();
+    return 0;
+}
+
+static int lua_st_tilemap_create(lua_State* L) {
+    int32_t width = (int32_t)luaL_checkinteger(L, 1);
+    int32_t height = (int32_t)luaL_checkinteger(L, 2);
+    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 3);
+    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 4);
+    STTilemapID id = st_tilemap_create(width, height, tileWidth, tileHeight);
+    if (id >= 0) {
+        g_tilemapInfo[id] = {width, height, tileWidth, tileHeight};
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int lua_st_tilemap_destroy(lua_State* L) {
+    STTilemapID id = (STTilemapID)luaL_checkinteger(L, 1);
+    st_tilemap_destroy(id);
+    g_tilemapInfo.erase(id);
+    return 0;
+}
+
+static int lua_st_tilemap_get_size(lua_State* L) {
+    STTilemapID id = (STTilemapID)luaL_checkinteger(L, 1);
+    int32_t width, height;
+    st_tilemap_get_size(id, &width, &height);
+    lua_pushinteger(L, width);
+    lua_pushinteger(L, height);
+    return 2;
+}
+
+static int lua_st_tilemap_create_layer(lua_State* L) {
+    const char* name = lua_isstring(L, 1) ? lua_tostring(L, 1) : nullptr;
+    STLayerID id = st_tilemap_create_layer(name);
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int lua_st_tilemap_destroy_layer(lua_State* L) {
+    STLayerID id = (STLayerID)luaL_checkinteger(L, 1);
     st_tilemap_destroy_layer(id);
+    g_layerTilemap.erase(id);
+    g_layerTileset.erase(id);
+    g_layerAnimations.erase(id);
+    g_layerView.erase(id);
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_tilemap(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    STTilemapID tilemap = (STTilemapID)luaL_checkinteger(L, 2);
+    st_tilemap_layer_set_tilemap(layer, tilemap);
+    g_layerTilemap[layer] = tilemap;
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_parallax(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    float parallaxX = (float)luaL_checknumber(L, 2);
+    float parallaxY = (float)luaL_checknumber(L, 3);
+    st_tilemap_layer_set_parallax(layer, parallaxX, parallaxY);
+    g_layerView[layer].parallaxX = parallaxX;
+    g_layerView[layer].parallaxY = parallaxY;
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_opacity(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    float opacity = (float)luaL_checknumber(L, 2);
+    st_tilemap_layer_set_opacity(layer, opacity);
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_visible(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    bool visible = lua_toboolean(L, 2);
+    st_tilemap_layer_set_visible(layer, visible);
+    g_layerView[layer].visible = visible;
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_z_order(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t zOrder = (int32_t)luaL_checkinteger(L, 2);
+    st_tilemap_layer_set_z_order(layer, zOrder);
+    return 0;
+}
+
+static int lua_st_tilemap_layer_set_auto_scroll(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    float scrollX = (float)luaL_checknumber(L, 2);
+    float scrollY = (float)luaL_checknumber(L, 3);
+    st_tilemap_layer_set_auto_scroll(layer, scrollX, scrollY);
+    g_layerView[layer].scrollX = scrollX;
+    g_layerView[layer].scrollY = scrollY;
+    return 0;
+}
+
+static int lua_st_tilemap_set_tile(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    uint16_t tileID = (uint16_t)luaL_checkinteger(L, 4);
+    tilemapWriteTile(layer, x, y, tileID);
+    tileAnimationsTouch(layer, x, y, tileID);
+    return 0;
+}
+
+static int lua_st_tilemap_get_tile(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    uint16_t tileID = st_tilemap_get_tile(layer, x, y);
+    lua_pushinteger(L, tileID);
+    return 1;
+}
+
+static int lua_st_tilemap_fill_rect(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    int32_t width = (int32_t)luaL_checkinteger(L, 4);
+    int32_t height = (int32_t)luaL_checkinteger(L, 5);
+    uint16_t tileID = (uint16_t)luaL_checkinteger(L, 6);
+    st_tilemap_fill_rect(layer, x, y, width, height, tileID);
+    g_tilemapView.tileWrites += (uint64_t)std::max(0, width) * (uint64_t)std::max(0, height);
+    tileAnimationsInvalidateRect(layer, x, y, (int32_t)std::min<int64_t>((int64_t)x + width, INT32_MAX),
+                                 (int32_t)std::min<int64_t>((int64_t)y + height, INT32_MAX));
+    return 0;
+}
+
+// Clip a w x h tile rectangle at (x, y) to the layer's tilemap, if known
+static void clipTileRect(STLayerID layer, int32_t& x0, int32_t& y0, int32_t& x1, int32_t& y1) {
+    const TilemapInfo* info = findLayerTilemap(layer);
+    if (info) {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, info->width);
+        y1 = std::min(y1, info->height);
+    }
+}
+
+// tilemap.setTiles(layer, x, y, w, h, data) -> tiles changed
+// data holds w * h row-major tile IDs as a table, a packed little-endian
+// uint16 string or an FFI uint16_t array. Tiles that already hold the new
+// value are not written, so untouched regions are not re-uploaded.
+static int lua_st_tilemap_set_tiles(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    int32_t width = (int32_t)luaL_checkinteger(L, 4);
+    int32_t height = (int32_t)luaL_checkinteger(L, 5);
+    luaL_argcheck(L, width >= 0, 4, "width must not be negative");
+    luaL_argcheck(L, height >= 0, 5, "height must not be negative");
+
+    static std::vector<uint16_t> tileScratch;
+    LuaBufferView<uint16_t> data = luaL_checkbuffer(L, 6, tileScratch, (size_t)width * height);
+    luaL_argcheck(L, data.count >= (size_t)width * height, 6, "data smaller than w * h tiles");
+
+    int32_t x0 = x, y0 = y;
+    int32_t x1 = (int32_t)std::min<int64_t>((int64_t)x + width, INT32_MAX);
+    int32_t y1 = (int32_t)std::min<int64_t>((int64_t)y + height, INT32_MAX);
+    clipTileRect(layer, x0, y0, x1, y1);
+
+    int changed = 0;
+    for (int32_t ty = y0; ty < y1; ty++) {
+        const uint16_t* row = data.data + (size_t)(ty - y) * width;
+        for (int32_t tx = x0; tx < x1; tx++) {
+            uint16_t tileID = row[tx - x];
+            if (st_tilemap_get_tile(layer, tx, ty) != tileID) {
+                tilemapWriteTile(layer, tx, ty, tileID);
+                changed++;
+            }
+        }
+    }
+
+    if (changed) {
+        tileAnimationsInvalidateRect(layer, x0, y0, x1, y1);
+    }
+    lua_pushinteger(L, changed);
+    return 1;
+}
+
+// tilemap.getTiles(layer, x, y, w, h) -> packed uint16 string
+// tilemap.getTiles(layer, x, y, w, h, out, capacity) writes w * h uint16s to
+// an FFI array or pointer with room for capacity tiles
+// Tiles outside the tilemap read as 0.
+static int lua_st_tilemap_get_tiles(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    int32_t width = (int32_t)luaL_checkinteger(L, 4);
+    int32_t height = (int32_t)luaL_checkinteger(L, 5);
+    luaL_argcheck(L, width >= 0, 4, "width must not be negative");
+    luaL_argcheck(L, height >= 0, 5, "height must not be negative");
+
+    static std::vector<uint16_t> tileScratch;
+    bool toPointer = lua_isbufferpointer(L, 6);
+    uint16_t* out = nullptr;
+    if (toPointer) {
+        lua_Integer capacity = luaL_checkinteger(L, 7);
+        luaL_argcheck(L, capacity >= 0 && (uint64_t)capacity >= (uint64_t)width * height, 7,
+                      "capacity smaller than w * h tiles");
+        out = (uint16_t*)luaL_checkbufferpointer(L, 6);
+    }
+    if (!out) {
+        tileScratch.resize((size_t)width * height);
+        out = tileScratch.data();
+    }
+    memset(out, 0, (size_t)width * height * sizeof(uint16_t));
+
+    int32_t x0 = x, y0 = y;
+    int32_t x1 = (int32_t)std::min<int64_t>((int64_t)x + width, INT32_MAX);
+    int32_t y1 = (int32_t)std::min<int64_t>((int64_t)y + height, INT32_MAX);
+    clipTileRect(layer, x0, y0, x1, y1);
+
+    for (int32_t ty = y0; ty < y1; ty++) {
+        uint16_t* row = out + (size_t)(ty - y) * width;
+        for (int32_t tx = x0; tx < x1; tx++) {
+            row[tx - x] = st_tilemap_get_tile(layer, tx, ty);
+        }
+    }
+
+    if (toPointer) {
+        return 0;
+    }
+    lua_pushlstring(L, (const char*)out, (size_t)width * height * sizeof(uint16_t));
+    return 1;
+}
+
+static int lua_st_tilemap_clear(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    st_tilemap_clear(layer);
+
+    // A cleared layer holds only tile 0, so the index is empty unless tile 0
+    // is itself an animation frame
+    auto it = g_layerAnimations.find(layer);
+    if (it != g_layerAnimations.end()) {
+        TilesetAnimations* anims = findLayerAnimations(layer);
+        if (anims && anims->animationOfTile.count(0)) {
+            it->second.dirty = true;
+        } else {
+            it->second.cells.clear();
+            it->second.dirtyRects.clear();
+        }
+    }
+    return 0;
+}
+
+static int lua_st_tilemap_set_camera(lua_State* L) {
+    float x = (float)luaL_checknumber(L, 1);
+    float y = (float)luaL_checknumber(L, 2);
+    st_tilemap_set_camera(x, y);
+    return 0;
+}
+
+static int lua_st_tilemap_move_camera(lua_State* L) {
+    float dx = (float)luaL_checknumber(L, 1);
+    float dy = (float)luaL_checknumber(L, 2);
+    st_tilemap_move_camera(dx, dy);
+    return 0;
+}
+
+static int lua_st_tilemap_get_camera(lua_State* L) {
+    float x, y;
+    st_tilemap_get_camera(&x, &y);
+    lua_pushnumber(L, x);
+    lua_pushnumber(L, y);
+    return 2;
+}
+
+static int lua_st_tilemap_set_zoom(lua_State* L) {
+    float zoom = (float)luaL_checknumber(L, 1);
+    st_tilemap_set_zoom(zoom);
+    if (zoom > 0.0f) {
+        g_tilemapView.zoom = zoom;
+    }
+    return 0;
+}
+
+static int lua_st_tilemap_camera_follow(lua_State* L) {
+    float targetX = (float)luaL_checknumber(L, 1);
+    float targetY = (float)luaL_checknumber(L, 2);
+    float smoothness = (float)luaL_checknumber(L, 3);
+    st_tilemap_camera_follow(targetX, targetY, smoothness);
+    return 0;
+}
+
+static int lua_st_tilemap_set_camera_bounds(lua_State* L) {
+    float x = (float)luaL_checknumber(L, 1);
+    float y = (float)luaL_checknumber(L, 2);
+    float width = (float)luaL_checknumber(L, 3);
+    float height = (float)luaL_checknumber(L, 4);
+    st_tilemap_set_camera_bounds(x, y, width, height);
+    return 0;
+}
+
+static int lua_st_tilemap_camera_shake(lua_State* L) {
+    float magnitude = (float)luaL_checknumber(L, 1);
+    float duration = (float)luaL_checknumber(L, 2);
+    st_tilemap_camera_shake(magnitude, duration);
+    g_tilemapView.shakeMagnitude = magnitude;
+    g_tilemapView.shakeRemaining = duration;
+    return 0;
+}
+
+static int lua_st_tilemap_update(lua_State* L) {
+    float dt = (float)luaL_checknumber(L, 1);
+    st_tilemap_update(dt);
+    tileAnimationsAdvance(dt);
+
+    TilemapViewState& view = g_tilemapView;
+    view.shakeRemaining = std::max(0.0f, view.shakeRemaining - dt);
+    for (auto& entry : g_layerView) {
+        entry.second.scrollOffsetX += entry.second.scrollX * dt;
+        entry.second.scrollOffsetY += entry.second.scrollY * dt;
+    }
+    view.lastFrameTileWrites = view.tileWrites;
+    view.tileWrites = 0;
+    return 0;
+}
+
+// Chunk-granular visibility of one layer for the current camera, estimated
+// from the camera, zoom and parallax state mirrored by the bindings
+struct TilemapLayerCull {
+    uint64_t visibleTiles = 0;
+    uint64_t visibleChunks = 0;
+    uint64_t cullableChunks = 0;
+};
+
+static TilemapLayerCull tilemapCullLayer(STLayerID layer, const TilemapInfo& info, int32_t chunkSize,
+                                         float cameraX, float cameraY) {
+    TilemapLayerCull cull;
+    int64_t chunksX = (info.width + chunkSize - 1) / chunkSize;
+    int64_t chunksY = (info.height + chunkSize - 1) / chunkSize;
+    int64_t total = chunksX * chunksY;
+
+    auto viewIt = g_layerView.find(layer);
+    TilemapLayerView layerView = (viewIt != g_layerView.end()) ? viewIt->second : TilemapLayerView();
+    const TilemapViewState& view = g_tilemapView;
+    if (!layerView.visible || info.tileWidth <= 0 || info.tileHeight <= 0) {
+        cull.cullableChunks = (uint64_t)total;
+        return cull;
+    }
+
+    int64_t cx0 = 0, cy0 = 0, cx1 = chunksX - 1, cy1 = chunksY - 1;
+    if (view.viewportWidth > 0.0f && view.viewportHeight > 0.0f) {
+        // Camera shake can displace the view by up to its magnitude either way
+        float margin = (view.shakeRemaining > 0.0f) ? view.shakeMagnitude : 0.0f;
+        float x0 = cameraX * layerView.parallaxX + layerView.scrollOffsetX - margin;
+        float y0 = cameraY * layerView.parallaxY + layerView.scrollOffsetY - margin;
+        float x1 = x0 + view.viewportWidth / view.zoom + 2.0f * margin;
+        float y1 = y0 + view.viewportHeight / view.zoom + 2.0f * margin;
+
+        float chunkW = (float)chunkSize * info.tileWidth;
+        float chunkH = (float)chunkSize * info.tileHeight;
+        cx0 = std::max<int64_t>(cx0, (int64_t)floorf(x0 / chunkW));
+        cy0 = std::max<int64_t>(cy0, (int64_t)floorf(y0 / chunkH));
+        cx1 = std::min<int64_t>(cx1, (int64_t)ceilf(x1 / chunkW) - 1);
+        cy1 = std::min<int64_t>(cy1, (int64_t)ceilf(y1 / chunkH) - 1);
+    }
+
+    if (cx0 <= cx1 && cy0 <= cy1) {
+        cull.visibleChunks = (uint64_t)((cx1 - cx0 + 1) * (cy1 - cy0 + 1));
+        int64_t tilesX = std::min<int64_t>((cx1 + 1) * chunkSize, info.width) - cx0 * chunkSize;
+        int64_t tilesY = std::min<int64_t>((cy1 + 1) * chunkSize, info.height) - cy0 * chunkSize;
+        cull.visibleTiles = (uint64_t)(tilesX * tilesY);
+    }
+    cull.cullableChunks = (uint64_t)total - cull.visibleChunks;
+    return cull;
+}
+
+// tilemap.getStats([chunkSize]) -> {visibleTiles, visibleChunks, cullableChunks,
+//                                   uploadBytes, layers = {[layerID] = {...}}}
+// Estimates, not renderer measurements: the counts are what a strict cull at
+// chunkSize (default 16) tiles would keep and skip for the current camera,
+// computed from view state mirrored by the bindings. The renderer does its
+// own drawing. uploadBytes covers the tile writes made through the bindings
+// in the last frame.
+static int lua_st_tilemap_get_stats(lua_State* L) {
+    int32_t chunkSize = (int32_t)luaL_optinteger(L, 1, 16);
+    luaL_argcheck(L, chunkSize > 0, 1, "chunk size must be positive");
+
+    float cameraX, cameraY;
+    st_tilemap_get_camera(&cameraX, &cameraY);
+
+    TilemapLayerCull totals;
+    lua_createtable(L, 0, 5);
+    lua_createtable(L, 0, (int)g_layerTilemap.size());
+    for (const auto& entry : g_layerTilemap) {
+        const TilemapInfo* info = findLayerTilemap(entry.first);
+        if (!info) {
+            continue;
+        }
+        TilemapLayerCull cull = tilemapCullLayer(entry.first, *info, chunkSize, cameraX, cameraY);
+        totals.visibleTiles += cull.visibleTiles;
+        totals.visibleChunks += cull.visibleChunks;
+        totals.cullableChunks += cull.cullableChunks;
+
+        lua_createtable(L, 0, 3);
+        lua_pushinteger(L, (lua_Integer)cull.visibleTiles);
+        lua_setfield(L, -2, "visibleTiles");
+        lua_pushinteger(L, (lua_Integer)cull.visibleChunks);
+        lua_setfield(L, -2, "visibleChunks");
+        lua_pushinteger(L, (lua_Integer)cull.cullableChunks);
+        lua_setfield(L, -2, "cullableChunks");
+        lua_rawseti(L, -2, entry.first);
+    }
+    lua_setfield(L, -2, "layers");
+
+    lua_pushinteger(L, (lua_Integer)totals.visibleTiles);
+    lua_setfield(L, -2, "visibleTiles");
+    lua_pushinteger(L, (lua_Integer)totals.visibleChunks);
+    lua_setfield(L, -2, "visibleChunks");
+    lua_pushinteger(L, (lua_Integer)totals.cullableChunks);
+    lua_setfield(L, -2, "cullableChunks");
+    lua_pushinteger(L, (lua_Integer)(g_tilemapView.lastFrameTileWrites * sizeof(uint16_t)));
+    lua_setfield(L, -2, "uploadBytes");
+    return 1;
+}
+
+static int lua_st_tilemap_world_to_tile(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    float worldX = (float)luaL_checknumber(L, 2);
+    float worldY = (float)luaL_checknumber(L, 3);
+    int32_t tileX, tileY;
+    st_tilemap_world_to_tile(layer, worldX, worldY, &tileX, &tileY);
+    lua_pushinteger(L, tileX);
+    lua_pushinteger(L, tileY);
+    return 2;
+}
+
+static int lua_st_tilemap_tile_to_world(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    int32_t tileX = (int32_t)luaL_checkinteger(L, 2);
+    int32_t tileY = (int32_t)luaL_checkinteger(L, 3);
+    float worldX, worldY;
+    st_tilemap_tile_to_world(layer, tileX, tileY, &worldX, &worldY);
+    lua_pushnumber(L, worldX);
+    lua_pushnumber(L, worldY);
+    return 2;
+}
+
+// Error handling API
+static int lua_st_get_error(lua_State* L) {
+    const char* error = st_get_last_error();
+    if (error && error[0] != '\0') {
+        lua_pushstring(L, error);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int lua_st_clear_error(lua_State* L) {
+    (void)L;
+    st_clear_error();
+    return 0;
+}
+
+// Tileset API
+static int lua_st_tileset_load(lua_State* L) {
+    const char* imagePath = luaL_checkstring(L, 1);
+    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 2);
+    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 3);
+    int32_t margin = (int32_t)luaL_optinteger(L, 4, 0);
+    int32_t spacing = (int32_t)luaL_optinteger(L, 5, 0);
+    STTilesetID id = st_tileset_load(imagePath, tileWidth, tileHeight, margin, spacing);
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int lua_st_tileset_load_asset(lua_State* L) {
+    const char* assetName = luaL_checkstring(L, 1);
+    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 2);
+    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 3);
+    int32_t margin = (int32_t)luaL_optinteger(L, 4, 0);
+    int32_t spacing = (int32_t)luaL_optinteger(L, 5, 0);
+    STTilesetID id = st_tileset_load_asset(assetName, tileWidth, tileHeight, margin, spacing);
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int lua_st_tileset_destroy(lua_State* L) {
+    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
+    st_tileset_destroy(id);
+    return 0;
+}
+
+static int lua_st_tileset_get_tile_count(lua_State* L) {
+    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
+    int32_t count = st_tileset_get_tile_count(id);
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int lua_st_tileset_get_dimensions(lua_State* L) {
+    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
+    int32_t columns, rows;
+    st_tileset_get_dimensions(id, &columns, &rows);
+    lua_pushinteger(L, columns);
+    lua_pushinteger(L, rows);
+    return 2;
+}
+
+static int lua_st_tilemap_layer_set_tileset(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 2);
+    st_tilemap_layer_set_tileset(layer, tileset);
+    g_layerTileset[layer] = tileset;
+    tileAnimationsInvalidate(layer);
+    return 0;
+}
+
+// tilemap.defineAnimation(tileset, {tile, ...}, duration | {duration, ...}) -> index
+// Any cell on a layer using the tileset that holds one of the frames is
+// animated through the whole sequence. Durations are in seconds.
+static int lua_st_tilemap_define_animation(lua_State* L) {
+    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    TileAnimation anim;
+    for (int i = 1; ; i++) {
+        lua_rawgeti(L, 2, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        anim.frames.push_back((uint16_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+    }
+    luaL_argcheck(L, !anim.frames.empty(), 2, "animation needs at least one frame");
+
+    for (size_t i = 0; i < anim.frames.size(); i++) {
+        float duration;
+        if (lua_istable(L, 3)) {
+            lua_rawgeti(L, 3, (int)i + 1);
+            duration = (float)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        } else {
+            duration = (float)luaL_checknumber(L, 3);
+        }
+        luaL_argcheck(L, duration > 0.0f, 3, "frame durations must be positive");
+        anim.durations.push_back(duration);
+        anim.totalDuration += duration;
+    }
+
+    TilesetAnimations& anims = g_tilesetAnimations[tileset];
+    uint32_t index = (uint32_t)anims.animations.size();
+    for (uint16_t frame : anim.frames) {
+        anims.animationOfTile[frame] = index;
+    }
+    anims.animations.push_back(std::move(anim));
+
+    for (auto& entry : g_layerTileset) {
+        if (entry.second == tileset) {
+            g_layerAnimations[entry.first].dirty = true;
+        }
+    }
+
+    lua_pushinteger(L, index);
+    return 1;
+}
+
+// tilemap.clearAnimations(tileset) - stops animating; cells keep their current frame
+static int lua_st_tilemap_clear_animations(lua_State* L) {
+    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 1);
+    g_tilesetAnimations.erase(tileset);
+    for (auto& entry : g_layerTileset) {
+        if (entry.second == tileset) {
+            g_layerAnimations.erase(entry.first);
+        }
+    }
+    return 0;
+}
+
+// =============================================================================
+// DisplayText API Bindings
+// =============================================================================
+
+static int lua_st_text_display_at(lua_State* L) {
+    float x = (float)luaL_checknumber(L, 1);
+    float y = (float)luaL_checknumber(L, 2);
+    const char* text = luaL_checkstring(L, 3);
+    float scale_x = (float)luaL_optnumber(L, 4, 1.0);
+    float scale_y = (float)luaL_optnumber(L, 5, 1.0);
+    float rotation = (float)luaL_optnumber(L, 6, 0.0);
+    uint32_t color = (uint32_t)luaL_optinteger(L, 7, 0xFFFFFFFF);
+    STTextAlignment alignment = (STTextAlignment)luaL_optinteger(L, 8, 0); // ST_ALIGN_LEFT
+    int layer = (int)luaL_optinteger(L, 9, 0);
+
+    int item_id = st_text_display_at(x, y, text, scale_x, scale_y, rotation, color, alignment, layer);
+    lua_pushinteger(L, item_id);
+    return 1;
+}
+
+static int lua_st_text_display_shear(lua_State* L) {
+    float x = (float)luaL_checknumber(L, 1);
+    float y = (float)luaL_checknumber(L, 2);
+    const char* text = luaL_checkstring(L, 3);
+    float scale_x = (float)luaL_optnumber(L, 4, 1.0);
+    float scale_y = (float)luaL_optnumber(L, 5, 1.0);
+    float rotation = (float)luaL_optnumber(L, 6, 0.0);
+    float shear_x = (float)luaL_optnumber(L, 7, 0.0);
+    float shear_y = (float)luaL_optnumber(L, 8, 0.0);
+    uint32_t color = (uint32_t)luaL_optinteger(L, 9, 0xFFFFFFFF);
+    STTextAlignment alignment = (STTextAlignment)luaL_optinteger(L, 10, 0); // ST_ALIGN_LEFT
+    int layer = (int)luaL_optinteger(L, 11, 0);
+
+    int item_id = st_text_display_shear(x, y, text, scale_x, scale_y, rotation, shear_x, shear_y, color, alignment, layer);
+    lua_pushinteger(L, item_id);
+    return 1;
+}
+
+static int lua_st_text_display_update(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    const char* text = luaL_checkstring(L, 2);
+    float x = (float)luaL_optnumber(L, 3, -1.0);
+    float y = (float)luaL_optnumber(L, 4, -1.0);
+    int result = st_text_update_item(item_id, text, x, y);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_st_text_display_set_visible(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    int visible = lua_toboolean(L, 2);
+    int result = st_text_set_item_visible(item_id, visible);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_st_text_display_clear(lua_State* L) {
+    (void)L;
+    st_text_clear_displayed();
+    return 0;
+}
+
+static int lua_st_text_update_item(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    const char* text = luaL_optstring(L, 2, nullptr);
+    float x = (float)luaL_optnumber(L, 3, -1.0);
+    float y = (float)luaL_optnumber(L, 4, -1.0);
+
+    st_text_update_item(item_id, text, x, y);
+    return 0;
+}
+
+static int lua_st_text_remove_item(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    st_text_remove_item(item_id);
+    return 0;
+}
+
+static int lua_st_text_clear_displayed(lua_State* L) {
+    (void)L;
+    st_text_clear_displayed();
+    return 0;
+}
+
+static int lua_st_text_set_item_visible(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    bool visible = lua_toboolean(L, 2);
+    st_text_set_item_visible(item_id, visible);
+    return 0;
+}
+
+static int lua_st_text_set_item_layer(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    int layer = (int)luaL_checkinteger(L, 2);
+    st_text_set_item_layer(item_id, layer);
+    return 0;
+}
+
+static int lua_st_text_set_item_color(lua_State* L) {
+    int item_id = (int)luaL_checkinteger(L, 1);
+    uint32_t color = (uint32_t)luaL_checkinteger(L, 2);
+    st_text_set_item_color(item_id, color);
     return 0;
 }
 
-static int lua_st_tilemap_layer_set_tilemap(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    STTilemapID tilemap = (STTilemapID)luaL_checkinteger(L, 2);
-    st_tilemap_layer_set_tilemap(layer, tilemap);
-    return 0;
+static int lua_st_text_get_item_count(lua_State* L) {
+    int count = st_text_get_item_count();
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int lua_st_text_get_visible_count(lua_State* L) {
+    int count = st_text_get_visible_count();
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+// =============================================================================
+// Collision Detection API Bindings
+// =============================================================================
+
+static int lua_collision_circle_circle(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float r1 = (float)luaL_checknumber(L, 3);
+    float x2 = (float)luaL_checknumber(L, 4);
+    float y2 = (float)luaL_checknumber(L, 5);
+    float r2 = (float)luaL_checknumber(L, 6);
+
+    int result = st_collision_circle_circle(x1, y1, r1, x2, y2, r2);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_circle_rect(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float rx = (float)luaL_checknumber(L, 4);
+    float ry = (float)luaL_checknumber(L, 5);
+    float rw = (float)luaL_checknumber(L, 6);
+    float rh = (float)luaL_checknumber(L, 7);
+
+    int result = st_collision_circle_rect(cx, cy, radius, rx, ry, rw, rh);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_circle_rect_bottom(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float rx = (float)luaL_checknumber(L, 4);
+    float ry = (float)luaL_checknumber(L, 5);
+    float rw = (float)luaL_checknumber(L, 6);
+    float rh = (float)luaL_checknumber(L, 7);
+
+    int result = st_collision_circle_rect_bottom(cx, cy, radius, rx, ry, rw, rh);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_rect_rect(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float w1 = (float)luaL_checknumber(L, 3);
+    float h1 = (float)luaL_checknumber(L, 4);
+    float x2 = (float)luaL_checknumber(L, 5);
+    float y2 = (float)luaL_checknumber(L, 6);
+    float w2 = (float)luaL_checknumber(L, 7);
+    float h2 = (float)luaL_checknumber(L, 8);
+
+    int result = st_collision_rect_rect(x1, y1, w1, h1, x2, y2, w2, h2);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_point_in_circle(lua_State* L) {
+    float px = (float)luaL_checknumber(L, 1);
+    float py = (float)luaL_checknumber(L, 2);
+    float cx = (float)luaL_checknumber(L, 3);
+    float cy = (float)luaL_checknumber(L, 4);
+    float radius = (float)luaL_checknumber(L, 5);
+
+    int result = st_collision_point_in_circle(px, py, cx, cy, radius);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_point_in_rect(lua_State* L) {
+    float px = (float)luaL_checknumber(L, 1);
+    float py = (float)luaL_checknumber(L, 2);
+    float rx = (float)luaL_checknumber(L, 3);
+    float ry = (float)luaL_checknumber(L, 4);
+    float rw = (float)luaL_checknumber(L, 5);
+    float rh = (float)luaL_checknumber(L, 6);
+
+    int result = st_collision_point_in_rect(px, py, rx, ry, rw, rh);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+static int lua_collision_circle_rect_info(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float rx = (float)luaL_checknumber(L, 4);
+    float ry = (float)luaL_checknumber(L, 5);
+    float rw = (float)luaL_checknumber(L, 6);
+    float rh = (float)luaL_checknumber(L, 7);
+
+    st_collision_info info;
+    st_collision_circle_rect_info(cx, cy, radius, rx, ry, rw, rh, &info);
+
+    // Optional 8th argument: a table to fill and return instead of a new one,
+    // or an FFI float[4] receiving colliding (0/1), depth, normalX, normalY
+    int type = lua_type(L, 8);
+    if (lua_isbufferpointer(L, 8)) {
+        float* out = (float*)luaL_checkbufferpointer(L, 8);
+        if (out) {
+            out[0] = info.colliding ? 1.0f : 0.0f;
+            out[1] = info.penetrationDepth;
+            out[2] = info.normalX;
+            out[3] = info.normalY;
+        }
+        lua_pushboolean(L, info.colliding);
+        return 1;
+    }
+
+    if (type == LUA_TTABLE) {
+        lua_pushvalue(L, 8);
+    } else {
+        lua_createtable(L, 0, 4);
+    }
+    lua_pushboolean(L, info.colliding);
+    lua_setfield(L, -2, "colliding");
+    lua_pushnumber(L, info.penetrationDepth);
+    lua_setfield(L, -2, "penetrationDepth");
+    lua_pushnumber(L, info.normalX);
+    lua_setfield(L, -2, "normalX");
+    lua_pushnumber(L, info.normalY);
+    lua_setfield(L, -2, "normalY");
+
+    return 1;
+}
+
+// collision_circle_rect_contact(...) -> colliding, depth, normalX, normalY
+// Multi-return form of collision_circle_rect_info; allocates nothing.
+static int lua_collision_circle_rect_contact(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float rx = (float)luaL_checknumber(L, 4);
+    float ry = (float)luaL_checknumber(L, 5);
+    float rw = (float)luaL_checknumber(L, 6);
+    float rh = (float)luaL_checknumber(L, 7);
+
+    st_collision_info info;
+    st_collision_circle_rect_info(cx, cy, radius, rx, ry, rw, rh, &info);
+
+    lua_pushboolean(L, info.colliding);
+    lua_pushnumber(L, info.penetrationDepth);
+    lua_pushnumber(L, info.normalX);
+    lua_pushnumber(L, info.normalY);
+    return 4;
+}
+
+static int lua_collision_circle_circle_penetration(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float r1 = (float)luaL_checknumber(L, 3);
+    float x2 = (float)luaL_checknumber(L, 4);
+    float y2 = (float)luaL_checknumber(L, 5);
+    float r2 = (float)luaL_checknumber(L, 6);
+
+    float penetration = st_collision_circle_circle_penetration(x1, y1, r1, x2, y2, r2);
+    lua_pushnumber(L, penetration);
+    return 1;
+}
+
+static int lua_collision_rect_rect_overlap(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float w1 = (float)luaL_checknumber(L, 3);
+    float h1 = (float)luaL_checknumber(L, 4);
+    float x2 = (float)luaL_checknumber(L, 5);
+    float y2 = (float)luaL_checknumber(L, 6);
+    float w2 = (float)luaL_checknumber(L, 7);
+    float h2 = (float)luaL_checknumber(L, 8);
+
+    float overlapX, overlapY;
+    st_collision_rect_rect_overlap(x1, y1, w1, h1, x2, y2, w2, h2, &overlapX, &overlapY);
+
+    lua_pushnumber(L, overlapX);
+    lua_pushnumber(L, overlapY);
+    return 2;
+}
+
+static int lua_collision_swept_circle_rect(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float vx = (float)luaL_checknumber(L, 4);
+    float vy = (float)luaL_checknumber(L, 5);
+    float rx = (float)luaL_checknumber(L, 6);
+    float ry = (float)luaL_checknumber(L, 7);
+    float rw = (float)luaL_checknumber(L, 8);
+    float rh = (float)luaL_checknumber(L, 9);
+
+    int result = st_collision_swept_circle_rect(cx, cy, radius, vx, vy, rx, ry, rw, rh);
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Continuous collision. Each sweep moves the first shape by (vx, vy) over one
+// step against a static second shape and reports the time of impact in [0, 1]
+// with the contact normal pointing from the obstacle towards the mover.
+// Shapes already overlapping at the start report toi 0.
+
+struct SweepHit {
+    float toi = 1.0f;
+    float nx = 0.0f, ny = 0.0f;
+};
+
+// Ray from (px, py) along (vx, vy) against a box. Returns false when the ray
+// misses within the step or starts inside the box (no entering face).
+static bool sweepRayBox(float px, float py, float vx, float vy,
+                        float x0, float y0, float x1, float y1, SweepHit& hit) {
+    float tEnter = -1.0f, tExit = 1.0f;
+    float nx = 0.0f, ny = 0.0f;
+
+    if (vx == 0.0f) {
+        if (px < x0 || px > x1) return false;
+    } else {
+        float t0 = (x0 - px) / vx, t1 = (x1 - px) / vx;
+        float n = -1.0f;
+        if (t0 > t1) { std::swap(t0, t1); n = 1.0f; }
+        if (t0 > tEnter) { tEnter = t0; nx = n; ny = 0.0f; }
+        tExit = std::min(tExit, t1);
+    }
+
+    if (vy == 0.0f) {
+        if (py < y0 || py > y1) return false;
+    } else {
+        float t0 = (y0 - py) / vy, t1 = (y1 - py) / vy;
+        float n = -1.0f;
+        if (t0 > t1) { std::swap(t0, t1); n = 1.0f; }
+        if (t0 > tEnter) { tEnter = t0; nx = 0.0f; ny = n; }
+        tExit = std::min(tExit, t1);
+    }
+
+    if (tEnter < 0.0f || tEnter > tExit || (nx == 0.0f && ny == 0.0f)) {
+        return false;
+    }
+    hit.toi = tEnter;
+    hit.nx = nx;
+    hit.ny = ny;
+    return true;
+}
+
+// Normal along the axis of least penetration for a point inside a box
+static void boxEscapeNormal(float px, float py, float x0, float y0, float x1, float y1, SweepHit& hit) {
+    float left = px - x0, right = x1 - px, top = py - y0, bottom = y1 - py;
+    float m = std::min(std::min(left, right), std::min(top, bottom));
+    hit.toi = 0.0f;
+    hit.nx = (m == left) ? -1.0f : (m == right) ? 1.0f : 0.0f;
+    hit.ny = (hit.nx != 0.0f) ? 0.0f : (m == top) ? -1.0f : 1.0f;
+}
+
+static bool sweepAABB(float ax, float ay, float aw, float ah, float vx, float vy,
+                      float bx, float by, float bw, float bh, SweepHit& hit) {
+    // Minkowski difference: the mover's top-left corner against the box grown by its size
+    float x0 = bx - aw, y0 = by - ah, x1 = bx + bw, y1 = by + bh;
+    if (ax > x0 && ax < x1 && ay > y0 && ay < y1) {
+        boxEscapeNormal(ax, ay, x0, y0, x1, y1, hit);
+        return true;
+    }
+    return sweepRayBox(ax, ay, vx, vy, x0, y0, x1, y1, hit);
+}
+
+// Earliest t in [0, 1] where a point moving from (px, py) by (vx, vy) reaches
+// distance r from (kx, ky).
+static bool sweepPointCircle(float px, float py, float vx, float vy, float kx, float ky, float r, float& t) {
+    float dx = px - kx, dy = py - ky;
+    float a = vx * vx + vy * vy;
+    float b = dx * vx + dy * vy;
+    float c = dx * dx + dy * dy - r * r;
+    if (a == 0.0f || b >= 0.0f) {
+        return false;
+    }
+    float disc = b * b - a * c;
+    if (disc < 0.0f) {
+        return false;
+    }
+    t = (-b - sqrtf(disc)) / a;
+    return t >= 0.0f && t <= 1.0f;
+}
+
+static bool sweepCircleCircle(float x1, float y1, float r1, float vx, float vy,
+                              float x2, float y2, float r2, SweepHit& hit) {
+    float r = r1 + r2;
+    float dx = x1 - x2, dy = y1 - y2;
+    float t = 0.0f;
+    if (dx * dx + dy * dy >= r * r && !sweepPointCircle(x1, y1, vx, vy, x2, y2, r, t)) {
+        return false;
+    }
+
+    float hx = x1 + vx * t - x2, hy = y1 + vy * t - y2;
+    float len = sqrtf(hx * hx + hy * hy);
+    hit.toi = t;
+    hit.nx = (len > 0.0f) ? hx / len : 0.0f;
+    hit.ny = (len > 0.0f) ? hy / len : -1.0f;
+    return true;
+}
+
+static bool sweepCircleRect(float cx, float cy, float r, float vx, float vy,
+                            float rx, float ry, float rw, float rh, SweepHit& hit) {
+    float x1 = rx + rw, y1 = ry + rh;
+
+    float px = std::min(std::max(cx, rx), x1);
+    float py = std::min(std::max(cy, ry), y1);
+    float dx = cx - px, dy = cy - py;
+    float d2 = dx * dx + dy * dy;
+    if (d2 < r * r) {
+        if (d2 > 0.0f) {
+            float d = sqrtf(d2);
+            hit.toi = 0.0f;
+            hit.nx = dx / d;
+            hit.ny = dy / d;
+        } else {
+            boxEscapeNormal(cx, cy, rx, ry, x1, y1, hit);
+        }
+        return true;
+    }
+
+    // Sweep the centre against the rect grown by r, then round the corners.
+    // A centre starting inside the grown rect but clear of the circle can only
+    // be in a corner region, so it is tested against that corner alone.
+    float hx = cx, hy = cy;
+    bool insideGrown = cx > rx - r && cx < x1 + r && cy > ry - r && cy < y1 + r;
+    if (!insideGrown) {
+        if (!sweepRayBox(cx, cy, vx, vy, rx - r, ry - r, x1 + r, y1 + r, hit)) {
+            return false;
+        }
+        hx = cx + vx * hit.toi;
+        hy = cy + vy * hit.toi;
+        bool outsideX = hx < rx || hx > x1;
+        bool outsideY = hy < ry || hy > y1;
+        if (!(outsideX && outsideY)) {
+            return true;
+        }
+    }
+
+    float kx = (hx < rx) ? rx : x1;
+    float ky = (hy < ry) ? ry : y1;
+    float t;
+    if (!sweepPointCircle(cx, cy, vx, vy, kx, ky, r, t)) {
+        return false;
+    }
+    hit.toi = t;
+    hit.nx = (cx + vx * t - kx) / r;
+    hit.ny = (cy + vy * t - ky) / r;
+    return true;
+}
+
+static int lua_pushsweephit(lua_State* L, bool hitFound, const SweepHit& hit) {
+    lua_pushboolean(L, hitFound);
+    lua_pushnumber(L, hitFound ? hit.toi : 1.0f);
+    lua_pushnumber(L, hitFound ? hit.nx : 0.0f);
+    lua_pushnumber(L, hitFound ? hit.ny : 0.0f);
+    return 4;
+}
+
+// collision_sweep_circle_rect(cx, cy, r, vx, vy, rx, ry, rw, rh) -> hit, toi, nx, ny
+static int lua_collision_sweep_circle_rect(lua_State* L) {
+    float cx = (float)luaL_checknumber(L, 1);
+    float cy = (float)luaL_checknumber(L, 2);
+    float radius = (float)luaL_checknumber(L, 3);
+    float vx = (float)luaL_checknumber(L, 4);
+    float vy = (float)luaL_checknumber(L, 5);
+    float rx = (float)luaL_checknumber(L, 6);
+    float ry = (float)luaL_checknumber(L, 7);
+    float rw = (float)luaL_checknumber(L, 8);
+    float rh = (float)luaL_checknumber(L, 9);
+
+    SweepHit hit;
+    bool found = sweepCircleRect(cx, cy, radius, vx, vy, rx, ry, rw, rh, hit);
+    return lua_pushsweephit(L, found, hit);
+}
+
+// collision_sweep_circle_circle(x1, y1, r1, vx1, vy1, x2, y2, r2 [, vx2, vy2]) -> hit, toi, nx, ny
+static int lua_collision_sweep_circle_circle(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float r1 = (float)luaL_checknumber(L, 3);
+    float vx1 = (float)luaL_checknumber(L, 4);
+    float vy1 = (float)luaL_checknumber(L, 5);
+    float x2 = (float)luaL_checknumber(L, 6);
+    float y2 = (float)luaL_checknumber(L, 7);
+    float r2 = (float)luaL_checknumber(L, 8);
+    float vx2 = (float)luaL_optnumber(L, 9, 0.0);
+    float vy2 = (float)luaL_optnumber(L, 10, 0.0);
+
+    SweepHit hit;
+    bool found = sweepCircleCircle(x1, y1, r1, vx1 - vx2, vy1 - vy2, x2, y2, r2, hit);
+    return lua_pushsweephit(L, found, hit);
+}
+
+// collision_sweep_aabb(x1, y1, w1, h1, vx, vy, x2, y2, w2, h2) -> hit, toi, nx, ny
+static int lua_collision_sweep_aabb(lua_State* L) {
+    float x1 = (float)luaL_checknumber(L, 1);
+    float y1 = (float)luaL_checknumber(L, 2);
+    float w1 = (float)luaL_checknumber(L, 3);
+    float h1 = (float)luaL_checknumber(L, 4);
+    float vx = (float)luaL_checknumber(L, 5);
+    float vy = (float)luaL_checknumber(L, 6);
+    float x2 = (float)luaL_checknumber(L, 7);
+    float y2 = (float)luaL_checknumber(L, 8);
+    float w2 = (float)luaL_checknumber(L, 9);
+    float h2 = (float)luaL_checknumber(L, 10);
+
+    SweepHit hit;
+    bool found = sweepAABB(x1, y1, w1, h1, vx, vy, x2, y2, w2, h2, hit);
+    return lua_pushsweephit(L, found, hit);
+}
+
+// Integral tile coordinate t clamped to [-1, limit] before the int
+// conversion so far-off coordinates stay defined; NaN maps to -1.
+static int tileCoordClamped(float t, int limit) {
+    if (!(t >= -1.0f)) {
+        return -1;
+    }
+    return (int)std::min(t, (float)limit);
+}
+
+// Tile index of world coordinate v, clamped as tileCoordClamped
+static int tileIndexClamped(float v, float tileSize, int limit) {
+    return tileCoordClamped(floorf(v / tileSize), limit);
+}
+
+// Sweep one box against the solid cells of a gridW x gridH tile grid with its
+// origin at (0, 0); solid(tx, ty) says whether a cell blocks. Cells the box
+// already overlaps are ignored so movers can always leave a wall they start in.
+// Non-finite input never hits.
+template <typename Solid>
+static SweepHit sweepAABBTiles(float x, float y, float w, float h, float vx, float vy,
+                               int gridW, int gridH, float tileW, float tileH, Solid solid) {
+    SweepHit best;
+    float sx0 = std::min(x, x + vx), sy0 = std::min(y, y + vy);
+    float sx1 = std::max(x, x + vx) + w, sy1 = std::max(y, y + vy) + h;
+    if (!std::isfinite(sx0) || !std::isfinite(sy0) || !std::isfinite(sx1) || !std::isfinite(sy1)) {
+        return best;
+    }
+    int tx0 = std::max(0, tileIndexClamped(sx0, tileW, gridW));
+    int ty0 = std::max(0, tileIndexClamped(sy0, tileH, gridH));
+    int tx1 = std::min(gridW - 1, tileIndexClamped(sx1, tileW, gridW));
+    int ty1 = std::min(gridH - 1, tileIndexClamped(sy1, tileH, gridH));
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            if (!solid(tx, ty)) {
+                continue;
+            }
+            float bx = tx * tileW, by = ty * tileH;
+            if (x < bx + tileW && x + w > bx && y < by + tileH && y + h > by) {
+                continue;
+            }
+            SweepHit hit;
+            if (sweepRayBox(x, y, vx, vy, bx - w, by - h, bx + tileW, by + tileH, hit) &&
+                hit.toi < best.toi) {
+                best = hit;
+            }
+        }
+    }
+    return best;
+}
+
+// collision_sweep_grid(movers, grid, gridW, gridH, tileSize [, count [, out, capacity]])
+// movers holds x,y,w,h,vx,vy per box; grid holds one byte per cell (non-zero
+// is solid, row-major from the origin). Produces toi,nx,ny per mover (toi 1
+// and a zero normal for no hit) as packed floats, or writes them to out,
+// which has room for capacity movers (3 floats each).
+static int lua_collision_sweep_grid(lua_State* L) {
+    int gridW = luaL_checkinteger(L, 3);
+    int gridH = luaL_checkinteger(L, 4);
+    float tileSize = (float)luaL_checknumber(L, 5);
+    size_t count = (size_t)luaL_optinteger(L, 6, 0);
+    luaL_argcheck(L, gridW > 0 && gridH > 0, 3, "grid dimensions must be positive");
+    luaL_argcheck(L, tileSize > 0.0f, 5, "tile size must be positive");
+
+    static std::vector<uint8_t> gridScratch;
+    LuaBufferView<float> movers = luaL_checkbuffer(L, 1, g_bulkValues, count * 6);
+    LuaBufferView<uint8_t> grid = luaL_checkbuffer(L, 2, gridScratch, (size_t)gridW * gridH);
+    luaL_argcheck(L, grid.count >= (size_t)gridW * gridH, 2, "grid smaller than gridW * gridH");
+    size_t n = movers.count / 6;
+
+    static std::vector<float> results;
+    results.resize(n * 3);
+    for (size_t i = 0; i < n; i++) {
+        const float* m = movers.data + i * 6;
+        SweepHit hit = sweepAABBTiles(m[0], m[1], m[2], m[3], m[4], m[5], gridW, gridH, tileSize, tileSize,
+                                      [&](int tx, int ty) { return grid.data[ty * gridW + tx] != 0; });
+        results[i * 3] = hit.toi;
+        results[i * 3 + 1] = hit.nx;
+        results[i * 3 + 2] = hit.ny;
+    }
+
+    if (lua_isbufferpointer(L, 7)) {
+        lua_Integer capacityArg = luaL_checkinteger(L, 8);
+        luaL_argcheck(L, capacityArg >= 0, 8, "capacity must not be negative");
+        size_t capacity = (size_t)capacityArg;
+        float* out = (float*)luaL_checkbufferpointer(L, 7);
+        if (out && capacity > 0) {
+            memcpy(out, results.data(), std::min(capacity, n) * 3 * sizeof(float));
+        }
+        lua_pushinteger(L, (lua_Integer)n);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)results.data(), results.size() * sizeof(float));
+    lua_pushinteger(L, (lua_Integer)n);
+    return 2;
 }
 
-static int lua_st_tilemap_layer_set_parallax(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    float parallaxX = (float)luaL_checknumber(L, 2);
-    float parallaxY = (float)luaL_checknumber(L, 3);
-    st_tilemap_layer_set_parallax(layer, parallaxX, parallaxY);
-    return 0;
+// Batch narrow-phase kernels. Inputs are unpacked into SoA scratch columns and
+// tested in straight-line loops the compiler can vectorise; results come back
+// as one packed buffer instead of a Lua value per test.
+
+static std::vector<float> g_batchX, g_batchY, g_batchR;
+static std::vector<uint8_t> g_batchHits;
+static std::vector<int32_t> g_batchIndices;
+static std::vector<uint8_t> g_batchMask;
+
+static size_t collisionCirclesVsRectKernel(const float* xs, const float* ys, const float* rs, size_t n,
+                                           float rx0, float ry0, float rx1, float ry1, uint8_t* hits) {
+    size_t hitCount = 0;
+    for (size_t i = 0; i < n; i++) {
+        float px = std::min(std::max(xs[i], rx0), rx1);
+        float py = std::min(std::max(ys[i], ry0), ry1);
+        float dx = xs[i] - px;
+        float dy = ys[i] - py;
+        uint8_t hit = (dx * dx + dy * dy) <= rs[i] * rs[i];
+        hits[i] = hit;
+        hitCount += hit;
+    }
+    return hitCount;
+}
+
+static size_t collisionPointsInRectsKernel(const float* xs, const float* ys, const float* rects,
+                                           size_t rectStride, size_t n, uint8_t* hits) {
+    size_t hitCount = 0;
+    for (size_t i = 0; i < n; i++) {
+        const float* r = rects + i * rectStride;
+        uint8_t hit = (xs[i] >= r[0]) & (xs[i] <= r[0] + r[2]) &
+                      (ys[i] >= r[1]) & (ys[i] <= r[1] + r[3]);
+        hits[i] = hit;
+        hitCount += hit;
+    }
+    return hitCount;
+}
+
+// collision_circles_vs_rect_batch(circles, rect [, count [, out, capacity]])
+// circles holds x,y,radius triplets and rect is {x, y, w, h}. Returns the
+// zero-based indices of the hitting circles as packed int32s plus the hit
+// count, or writes up to capacity indices to out and returns the hit count.
+static int lua_collision_circles_vs_rect_batch(lua_State* L) {
+    size_t count = (size_t)luaL_optinteger(L, 3, 0);
+
+    static std::vector<float> rectScratch;
+    LuaBufferView<float> circles = luaL_checkbuffer(L, 1, g_bulkValues, count * 3);
+    LuaBufferView<float> rect = luaL_checkbuffer(L, 2, rectScratch, 4);
+    luaL_argcheck(L, rect.count >= 4, 2, "rect needs x, y, w, h");
+    size_t n = circles.count / 3;
+
+    g_batchX.resize(n);
+    g_batchY.resize(n);
+    g_batchR.resize(n);
+    g_batchHits.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        g_batchX[i] = circles.data[i * 3];
+        g_batchY[i] = circles.data[i * 3 + 1];
+        g_batchR[i] = circles.data[i * 3 + 2];
+    }
+
+    size_t hitCount = collisionCirclesVsRectKernel(g_batchX.data(), g_batchY.data(), g_batchR.data(), n,
+                                                   rect.data[0], rect.data[1],
+                                                   rect.data[0] + rect.data[2], rect.data[1] + rect.data[3],
+                                                   g_batchHits.data());
+
+    g_batchIndices.clear();
+    for (size_t i = 0; i < n; i++) {
+        if (g_batchHits[i]) {
+            g_batchIndices.push_back((int32_t)i);
+        }
+    }
+
+    if (lua_isbufferpointer(L, 4)) {
+        size_t capacity = (size_t)luaL_checkinteger(L, 5);
+        int32_t* out = (int32_t*)luaL_checkbufferpointer(L, 4);
+        if (out && capacity > 0) {
+            memcpy(out, g_batchIndices.data(), std::min(capacity, hitCount) * sizeof(int32_t));
+        }
+        lua_pushinteger(L, (lua_Integer)hitCount);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)g_batchIndices.data(), g_batchIndices.size() * sizeof(int32_t));
+    lua_pushinteger(L, (lua_Integer)hitCount);
+    return 2;
 }
 
-static int lua_st_tilemap_layer_set_opacity(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    float opacity = (float)luaL_checknumber(L, 2);
-    st_tilemap_layer_set_opacity(layer, opacity);
-    return 0;
+// collision_points_in_rects_batch(points, rects [, count [, rectCount [, out, capacity]]])
+// Tests point i (x,y pairs) against rect i (x,y,w,h quads); a single rect is
+// tested against every point. rectCount sizes a pointer rects buffer and
+// defaults to count, so pass 1 to test one rect from a pointer. Returns a
+// packed bitmask with bit i set for a hit (LSB first) plus the hit count, or
+// writes up to capacity mask bytes to out and returns the hit count.
+static int lua_collision_points_in_rects_batch(lua_State* L) {
+    size_t count = (size_t)luaL_optinteger(L, 3, 0);
+    size_t rectCountArg = (size_t)luaL_optinteger(L, 4, (lua_Integer)count);
+
+    static std::vector<float> rectScratch;
+    LuaBufferView<float> points = luaL_checkbuffer(L, 1, g_bulkValues, count * 2);
+    size_t n = points.count / 2;
+    LuaBufferView<float> rects = luaL_checkbuffer(L, 2, rectScratch, rectCountArg * 4);
+    size_t rectCount = rects.count / 4;
+    luaL_argcheck(L, rectCount == 1 || rectCount >= n, 2, "need one rect or one rect per point");
+    size_t rectStride = (rectCount == 1) ? 0 : 4;
+
+    g_batchX.resize(n);
+    g_batchY.resize(n);
+    g_batchHits.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        g_batchX[i] = points.data[i * 2];
+        g_batchY[i] = points.data[i * 2 + 1];
+    }
+
+    size_t hitCount = collisionPointsInRectsKernel(g_batchX.data(), g_batchY.data(), rects.data,
+                                                   rectStride, n, g_batchHits.data());
+
+    std::vector<uint8_t>& mask = g_batchMask;
+    mask.assign((n + 7) / 8, 0);
+    for (size_t i = 0; i < n; i++) {
+        mask[i >> 3] |= (uint8_t)(g_batchHits[i] << (i & 7));
+    }
+
+    if (lua_isbufferpointer(L, 5)) {
+        size_t capacity = (size_t)luaL_checkinteger(L, 6);
+        uint8_t* out = (uint8_t*)luaL_checkbufferpointer(L, 5);
+        if (out && capacity > 0) {
+            memcpy(out, mask.data(), std::min(capacity, mask.size()));
+        }
+        lua_pushinteger(L, (lua_Integer)hitCount);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)mask.data(), mask.size());
+    lua_pushinteger(L, (lua_Integer)hitCount);
+    return 2;
 }
 
-static int lua_st_tilemap_layer_set_visible(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    bool visible = lua_toboolean(L, 2);
-    st_tilemap_layer_set_visible(layer, visible);
-    return 0;
+// =============================================================================
+// Collision World API Bindings
+// =============================================================================
+
+// Native broadphase over many bodies. Bodies are uploaded in bulk, binned into
+// a uniform spatial hash and tested only against bodies sharing a cell, so a
+// scene of thousands of bullets and enemies costs one call per frame instead
+// of an O(n^2) loop in Lua. Bodies spanning more than
+// COLLISION_MAX_BODY_CELLS cells are kept out of the hash and tested against
+// every other body, and bodies with non-finite bounds are skipped.
+
+static const int64_t COLLISION_MAX_BODY_CELLS = 64;
+
+enum CollisionBodyShape {
+    BODY_RECT = 0,
+    BODY_CIRCLE = 1
+};
+
+struct CollisionCellEntry {
+    uint64_t key;
+    uint32_t body;
+
+    bool operator<(const CollisionCellEntry& other) const {
+        return key < other.key || (key == other.key && body < other.body);
+    }
+};
+
+struct CollisionWorld {
+    float cellSize = 64.0f;
+    std::vector<int32_t> ids;
+    std::vector<uint8_t> shape;
+    std::vector<float> minX, minY, maxX, maxY;
+    std::vector<float> cx, cy, radius;
+    std::vector<uint32_t> layer, mask;
+    std::unordered_map<int32_t, uint32_t> slotOf;
+
+    // Scratch reused between queries
+    std::vector<CollisionCellEntry> entries;
+    std::vector<uint32_t> oversized;
+    std::vector<int32_t> pairs;
+    size_t lastCells = 0;
+    size_t lastTests = 0;
+    size_t lastRejected = 0;
+
+    uint32_t slot(int32_t id) {
+        auto it = slotOf.find(id);
+        if (it != slotOf.end()) {
+            return it->second;
+        }
+        uint32_t s = (uint32_t)ids.size();
+        ids.push_back(id);
+        shape.push_back(BODY_RECT);
+        minX.push_back(0.0f);
+        minY.push_back(0.0f);
+        maxX.push_back(0.0f);
+        maxY.push_back(0.0f);
+        cx.push_back(0.0f);
+        cy.push_back(0.0f);
+        radius.push_back(0.0f);
+        layer.push_back(1);
+        mask.push_back(0xFFFFFFFF);
+        slotOf[id] = s;
+        return s;
+    }
+
+    bool remove(int32_t id) {
+        auto it = slotOf.find(id);
+        if (it == slotOf.end()) {
+            return false;
+        }
+        uint32_t s = it->second;
+        slotOf.erase(it);
+        swapRemove(ids, s);
+        swapRemove(shape, s);
+        swapRemove(minX, s);
+        swapRemove(minY, s);
+        swapRemove(maxX, s);
+        swapRemove(maxY, s);
+        swapRemove(cx, s);
+        swapRemove(cy, s);
+        swapRemove(radius, s);
+        swapRemove(layer, s);
+        swapRemove(mask, s);
+        if (s < ids.size()) {
+            slotOf[ids[s]] = s;
+        }
+        return true;
+    }
+
+    void clear() {
+        ids.clear();
+        shape.clear();
+        minX.clear();
+        minY.clear();
+        maxX.clear();
+        maxY.clear();
+        cx.clear();
+        cy.clear();
+        radius.clear();
+        layer.clear();
+        mask.clear();
+        slotOf.clear();
+    }
+
+    // Callers pass finite values; the clamp keeps the cast defined for
+    // coordinates far outside any reasonable grid.
+    int32_t cellOf(float v) const {
+        double c = std::floor((double)v / (double)cellSize);
+        return (int32_t)std::min(std::max(c, -1073741824.0), 1073741823.0);
+    }
+};
+
+static SlotMap<CollisionWorld> g_collisionWorlds;
+
+static CollisionWorld& luaL_checkcollisionworld(lua_State* L, int idx) {
+    int id = luaL_checkinteger(L, idx);
+    CollisionWorld* world = id > 0 ? g_collisionWorlds.get((uint32_t)id) : nullptr;
+    if (!world) {
+        luaL_argerror(L, idx, "invalid collision world id");
+    }
+    return *world;
 }
 
-static int lua_st_tilemap_layer_set_z_order(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    int32_t zOrder = (int32_t)luaL_checkinteger(L, 2);
-    st_tilemap_layer_set_z_order(layer, zOrder);
-    return 0;
+static uint64_t collisionCellKey(int32_t ix, int32_t iy) {
+    return ((uint64_t)(uint32_t)ix << 32) | (uint32_t)iy;
 }
 
-static int lua_st_tilemap_layer_set_auto_scroll(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    float scrollX = (float)luaL_checknumber(L, 2);
-    float scrollY = (float)luaL_checknumber(L, 3);
-    st_tilemap_layer_set_auto_scroll(layer, scrollX, scrollY);
-    return 0;
+static bool collisionBodiesFilter(const CollisionWorld& w, uint32_t a, uint32_t b) {
+    return (w.layer[a] & w.mask[b]) && (w.layer[b] & w.mask[a]);
 }
 
-static int lua_st_tilemap_set_tile(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    int32_t x = (int32_t)luaL_checkinteger(L, 2);
-    int32_t y = (int32_t)luaL_checkinteger(L, 3);
-    uint16_t tileID = (uint16_t)luaL_checkinteger(L, 4);
-    st_tilemap_set_tile(layer, x, y, tileID);
-    return 0;
+static bool collisionBodiesOverlap(const CollisionWorld& w, uint32_t a, uint32_t b) {
+    if (w.maxX[a] < w.minX[b] || w.maxX[b] < w.minX[a] ||
+        w.maxY[a] < w.minY[b] || w.maxY[b] < w.minY[a]) {
+        return false;
+    }
+
+    if (w.shape[a] == BODY_RECT && w.shape[b] == BODY_RECT) {
+        return true;
+    }
+
+    if (w.shape[a] == BODY_CIRCLE && w.shape[b] == BODY_CIRCLE) {
+        float dx = w.cx[a] - w.cx[b];
+        float dy = w.cy[a] - w.cy[b];
+        float r = w.radius[a] + w.radius[b];
+        return dx * dx + dy * dy <= r * r;
+    }
+
+    uint32_t circle = (w.shape[a] == BODY_CIRCLE) ? a : b;
+    uint32_t rect = (circle == a) ? b : a;
+    float px = std::min(std::max(w.cx[circle], w.minX[rect]), w.maxX[rect]);
+    float py = std::min(std::max(w.cy[circle], w.minY[rect]), w.maxY[rect]);
+    float dx = w.cx[circle] - px;
+    float dy = w.cy[circle] - py;
+    return dx * dx + dy * dy <= w.radius[circle] * w.radius[circle];
+}
+
+// Rebuild the spatial hash and collect every overlapping pair as id pairs.
+static void collisionWorldFindPairs(CollisionWorld& w) {
+    w.entries.clear();
+    w.oversized.clear();
+    w.pairs.clear();
+
+    size_t rejected = 0;
+    for (uint32_t i = 0; i < w.ids.size(); i++) {
+        if (!std::isfinite(w.minX[i]) || !std::isfinite(w.minY[i]) ||
+            !std::isfinite(w.maxX[i]) || !std::isfinite(w.maxY[i]) ||
+            (w.shape[i] == BODY_CIRCLE && !std::isfinite(w.radius[i]))) {
+            rejected++;
+            continue;
+        }
+        int32_t x0 = w.cellOf(w.minX[i]), x1 = w.cellOf(w.maxX[i]);
+        int32_t y0 = w.cellOf(w.minY[i]), y1 = w.cellOf(w.maxY[i]);
+        int64_t span = ((int64_t)x1 - x0 + 1) * ((int64_t)y1 - y0 + 1);
+        if (span > COLLISION_MAX_BODY_CELLS) {
+            w.oversized.push_back(i);
+            continue;
+        }
+        for (int32_t iy = y0; iy <= y1; iy++) {
+            for (int32_t ix = x0; ix <= x1; ix++) {
+                w.entries.push_back({collisionCellKey(ix, iy), i});
+            }
+        }
+    }
+    std::sort(w.entries.begin(), w.entries.end());
+
+    size_t cells = 0;
+    size_t tests = 0;
+    size_t begin = 0;
+    while (begin < w.entries.size()) {
+        uint64_t key = w.entries[begin].key;
+        size_t end = begin + 1;
+        while (end < w.entries.size() && w.entries[end].key == key) {
+            end++;
+        }
+        cells++;
+
+        int32_t ix = (int32_t)(uint32_t)(key >> 32);
+        int32_t iy = (int32_t)(uint32_t)key;
+        for (size_t i = begin; i < end; i++) {
+            uint32_t a = w.entries[i].body;
+            for (size_t j = i + 1; j < end; j++) {
+                uint32_t b = w.entries[j].body;
+                if (!collisionBodiesFilter(w, a, b)) {
+                    continue;
+                }
+                // Pairs sharing several cells are reported only from the cell
+                // holding the top-left corner of their bounds intersection
+                if (w.cellOf(std::max(w.minX[a], w.minX[b])) != ix ||
+                    w.cellOf(std::max(w.minY[a], w.minY[b])) != iy) {
+                    continue;
+                }
+                tests++;
+                if (collisionBodiesOverlap(w, a, b)) {
+                    w.pairs.push_back(w.ids[a]);
+                    w.pairs.push_back(w.ids[b]);
+                }
+            }
+        }
+        begin = end;
+    }
+
+    // Oversized bodies are not in the hash: test each against every hashed
+    // body once, and against the oversized bodies after it in the list.
+    for (size_t k = 0; k < w.oversized.size(); k++) {
+        uint32_t a = w.oversized[k];
+        for (size_t e = 0; e < w.entries.size(); e++) {
+            uint32_t b = w.entries[e].body;
+            // Visit each hashed body once, from the entry for the cell
+            // holding its top-left corner.
+            if (w.cellOf(w.minX[b]) != (int32_t)(uint32_t)(w.entries[e].key >> 32) ||
+                w.cellOf(w.minY[b]) != (int32_t)(uint32_t)w.entries[e].key) {
+                continue;
+            }
+            if (!collisionBodiesFilter(w, a, b)) {
+                continue;
+            }
+            tests++;
+            if (collisionBodiesOverlap(w, a, b)) {
+                w.pairs.push_back(w.ids[a]);
+                w.pairs.push_back(w.ids[b]);
+            }
+        }
+        for (size_t m = k + 1; m < w.oversized.size(); m++) {
+            uint32_t b = w.oversized[m];
+            if (!collisionBodiesFilter(w, a, b)) {
+                continue;
+            }
+            tests++;
+            if (collisionBodiesOverlap(w, a, b)) {
+                w.pairs.push_back(w.ids[a]);
+                w.pairs.push_back(w.ids[b]);
+            }
+        }
+    }
+
+    w.lastCells = cells;
+    w.lastTests = tests;
+    w.lastRejected = rejected;
 }
 
-static int lua_st_tilemap_get_tile(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    int32_t x = (int32_t)luaL_checkinteger(L, 2);
-    int32_t y = (int32_t)luaL_checkinteger(L, 3);
-    uint16_t tileID = st_tilemap_get_tile(layer, x, y);
-    lua_pushinteger(L, tileID);
+// collision_world_create([cellSize]) -> world id
+static int lua_collision_world_create(lua_State* L) {
+    float cellSize = (float)luaL_optnumber(L, 1, 64.0);
+    luaL_argcheck(L, cellSize > 0.0f, 1, "cell size must be positive");
+
+    CollisionWorld world;
+    world.cellSize = cellSize;
+    uint32_t id = g_collisionWorlds.insert(std::move(world));
+    if (id == 0) {
+        return luaL_error(L, "collision_world_create: world limit reached");
+    }
+    lua_pushinteger(L, (lua_Integer)id);
     return 1;
 }
 
-static int lua_st_tilemap_fill_rect(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    int32_t x = (int32_t)luaL_checkinteger(L, 2);
-    int32_t y = (int32_t)luaL_checkinteger(L, 3);
-    int32_t width = (int32_t)luaL_checkinteger(L, 4);
-    int32_t height = (int32_t)luaL_checkinteger(L, 5);
-    uint16_t tileID = (uint16_t)luaL_checkinteger(L, 6);
-    st_tilemap_fill_rect(layer, x, y, width, height, tileID);
-    return 0;
+static int lua_collision_world_destroy(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushboolean(L, id > 0 && g_collisionWorlds.erase((uint32_t)id));
+    return 1;
 }
 
-static int lua_st_tilemap_clear(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    st_tilemap_clear(layer);
+static int lua_collision_world_clear(lua_State* L) {
+    luaL_checkcollisionworld(L, 1).clear();
     return 0;
 }
 
-static int lua_st_tilemap_set_camera(lua_State* L) {
-    float x = (float)luaL_checknumber(L, 1);
-    float y = (float)luaL_checknumber(L, 2);
-    st_tilemap_set_camera(x, y);
-    return 0;
-}
+// collision_world_set_rects(world, ids, xywh [, count]) - insert or update boxes
+static int lua_collision_world_set_rects(lua_State* L) {
+    CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
 
-static int lua_st_tilemap_move_camera(lua_State* L) {
-    float dx = (float)luaL_checknumber(L, 1);
-    float dy = (float)luaL_checknumber(L, 2);
-    st_tilemap_move_camera(dx, dy);
-    return 0;
-}
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<float> values = luaL_checkbuffer(L, 3, g_bulkValues, count * 4);
+    size_t n = std::min(ids.count, values.count / 4);
 
-static int lua_st_tilemap_get_camera(lua_State* L) {
-    float x, y;
-    st_tilemap_get_camera(&x, &y);
-    lua_pushnumber(L, x);
-    lua_pushnumber(L, y);
-    return 2;
-}
+    for (size_t i = 0; i < n; i++) {
+        const float* v = values.data + i * 4;
+        uint32_t s = w.slot(ids.data[i]);
+        w.shape[s] = BODY_RECT;
+        w.minX[s] = v[0];
+        w.minY[s] = v[1];
+        w.maxX[s] = v[0] + v[2];
+        w.maxY[s] = v[1] + v[3];
+    }
 
-static int lua_st_tilemap_set_zoom(lua_State* L) {
-    float zoom = (float)luaL_checknumber(L, 1);
-    st_tilemap_set_zoom(zoom);
-    return 0;
+    lua_pushinteger(L, (lua_Integer)n);
+    return 1;
 }
 
-static int lua_st_tilemap_camera_follow(lua_State* L) {
-    float targetX = (float)luaL_checknumber(L, 1);
-    float targetY = (float)luaL_checknumber(L, 2);
-    float smoothness = (float)luaL_checknumber(L, 3);
-    st_tilemap_camera_follow(targetX, targetY, smoothness);
-    return 0;
-}
+// collision_world_set_circles(world, ids, xyr [, count]) - insert or update circles
+static int lua_collision_world_set_circles(lua_State* L) {
+    CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 4, 0);
 
-static int lua_st_tilemap_set_camera_bounds(lua_State* L) {
-    float x = (float)luaL_checknumber(L, 1);
-    float y = (float)luaL_checknumber(L, 2);
-    float width = (float)luaL_checknumber(L, 3);
-    float height = (float)luaL_checknumber(L, 4);
-    st_tilemap_set_camera_bounds(x, y, width, height);
-    return 0;
-}
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<float> values = luaL_checkbuffer(L, 3, g_bulkValues, count * 3);
+    size_t n = std::min(ids.count, values.count / 3);
 
-static int lua_st_tilemap_camera_shake(lua_State* L) {
-    float magnitude = (float)luaL_checknumber(L, 1);
-    float duration = (float)luaL_checknumber(L, 2);
-    st_tilemap_camera_shake(magnitude, duration);
-    return 0;
-}
+    for (size_t i = 0; i < n; i++) {
+        const float* v = values.data + i * 3;
+        uint32_t s = w.slot(ids.data[i]);
+        w.shape[s] = BODY_CIRCLE;
+        w.cx[s] = v[0];
+        w.cy[s] = v[1];
+        w.radius[s] = v[2];
+        w.minX[s] = v[0] - v[2];
+        w.minY[s] = v[1] - v[2];
+        w.maxX[s] = v[0] + v[2];
+        w.maxY[s] = v[1] + v[2];
+    }
 
-static int lua_st_tilemap_update(lua_State* L) {
-    float dt = (float)luaL_checknumber(L, 1);
-    st_tilemap_update(dt);
-    return 0;
+    lua_pushinteger(L, (lua_Integer)n);
+    return 1;
 }
 
-static int lua_st_tilemap_world_to_tile(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    float worldX = (float)luaL_checknumber(L, 2);
-    float worldY = (float)luaL_checknumber(L, 3);
-    int32_t tileX, tileY;
-    st_tilemap_world_to_tile(layer, worldX, worldY, &tileX, &tileY);
-    lua_pushinteger(L, tileX);
-    lua_pushinteger(L, tileY);
-    return 2;
-}
+// collision_world_set_filters(world, ids, layers, masks [, count])
+// Two bodies are paired only when each one's layer is in the other's mask.
+static int lua_collision_world_set_filters(lua_State* L) {
+    CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 5, 0);
 
-static int lua_st_tilemap_tile_to_world(lua_State* L) {
-    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    int32_t tileX = (int32_t)luaL_checkinteger(L, 2);
-    int32_t tileY = (int32_t)luaL_checkinteger(L, 3);
-    float worldX, worldY;
-    st_tilemap_tile_to_world(layer, tileX, tileY, &worldX, &worldY);
-    lua_pushnumber(L, worldX);
-    lua_pushnumber(L, worldY);
-    return 2;
+    static std::vector<uint32_t> layerScratch, maskScratch;
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    LuaBufferView<uint32_t> layers = luaL_checkbuffer(L, 3, layerScratch, count);
+    LuaBufferView<uint32_t> masks = luaL_checkbuffer(L, 4, maskScratch, count);
+    size_t n = std::min(ids.count, std::min(layers.count, masks.count));
+
+    int updated = 0;
+    for (size_t i = 0; i < n; i++) {
+        auto it = w.slotOf.find(ids.data[i]);
+        if (it != w.slotOf.end()) {
+            w.layer[it->second] = layers.data[i];
+            w.mask[it->second] = masks.data[i];
+            updated++;
+        }
+    }
+
+    lua_pushinteger(L, updated);
+    return 1;
 }
 
-// Error handling API
-static int lua_st_get_error(lua_State* L) {
-    const char* error = st_get_last_error();
-    if (error && error[0] != '\0') {
-        lua_pushstring(L, error);
-    } else {
-        lua_pushnil(L);
+// collision_world_remove(world, ids [, count])
+static int lua_collision_world_remove(lua_State* L) {
+    CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+    size_t count = (size_t)luaL_optinteger(L, 3, 0);
+
+    LuaBufferView<int32_t> ids = luaL_checkbuffer(L, 2, g_bulkIds, count);
+    int removed = 0;
+    for (size_t i = 0; i < ids.count; i++) {
+        if (w.remove(ids.data[i])) {
+            removed++;
+        }
     }
+
+    lua_pushinteger(L, removed);
     return 1;
 }
 
-static int lua_st_clear_error(lua_State* L) {
-    (void)L;
-    st_clear_error();
-    return 0;
+// collision_world_query_pairs(world) -> packed int32 id pairs, pairCount
+// collision_world_query_pairs(world, out, capacity) -> pairCount
+// With an output pointer, up to capacity pairs (2 * capacity int32s) are
+// written and the total number of overlapping pairs is returned.
+static int lua_collision_world_query_pairs(lua_State* L) {
+    CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+    collisionWorldFindPairs(w);
+    size_t pairCount = w.pairs.size() / 2;
+
+    if (lua_isbufferpointer(L, 2)) {
+        size_t capacity = (size_t)luaL_checkinteger(L, 3);
+        int32_t* out = (int32_t*)luaL_checkbufferpointer(L, 2);
+        if (out && capacity > 0) {
+            memcpy(out, w.pairs.data(), std::min(capacity, pairCount) * 2 * sizeof(int32_t));
+        }
+        lua_pushinteger(L, (lua_Integer)pairCount);
+        return 1;
+    }
+
+    lua_pushlstring(L, (const char*)w.pairs.data(), w.pairs.size() * sizeof(int32_t));
+    lua_pushinteger(L, (lua_Integer)pairCount);
+    return 2;
 }
 
-// Tileset API
-static int lua_st_tileset_load(lua_State* L) {
-    const char* imagePath = luaL_checkstring(L, 1);
-    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 2);
-    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 3);
-    int32_t margin = (int32_t)luaL_optinteger(L, 4, 0);
-    int32_t spacing = (int32_t)luaL_optinteger(L, 5, 0);
-    STTilesetID id = st_tileset_load(imagePath, tileWidth, tileHeight, margin, spacing);
-    lua_pushinteger(L, id);
+static int lua_collision_world_get_stats(lua_State* L) {
+    const CollisionWorld& w = luaL_checkcollisionworld(L, 1);
+
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)w.ids.size());
+    lua_setfield(L, -2, "bodies");
+    lua_pushinteger(L, (lua_Integer)w.oversized.size());
+    lua_setfield(L, -2, "oversized");
+    lua_pushinteger(L, (lua_Integer)w.lastRejected);
+    lua_setfield(L, -2, "rejected");
+    lua_pushinteger(L, (lua_Integer)w.lastCells);
+    lua_setfield(L, -2, "cells");
+    lua_pushinteger(L, (lua_Integer)w.entries.size());
+    lua_setfield(L, -2, "cellEntries");
+    lua_pushinteger(L, (lua_Integer)w.lastTests);
+    lua_setfield(L, -2, "narrowTests");
+    lua_pushinteger(L, (lua_Integer)(w.pairs.size() / 2));
+    lua_setfield(L, -2, "pairs");
     return 1;
 }
 
-static int lua_st_tileset_load_asset(lua_State* L) {
-    const char* assetName = luaL_checkstring(L, 1);
-    int32_t tileWidth = (int32_t)luaL_checkinteger(L, 2);
-    int32_t tileHeight = (int32_t)luaL_checkinteger(L, 3);
-    int32_t margin = (int32_t)luaL_optinteger(L, 4, 0);
-    int32_t spacing = (int32_t)luaL_optinteger(L, 5, 0);
-    STTilesetID id = st_tileset_load_asset(assetName, tileWidth, tileHeight, margin, spacing);
-    lua_pushinteger(L, id);
-    return 1;
+// =============================================================================
+// Tilemap Collision Query API Bindings
+// =============================================================================
+
+// Native collision against a tile layer. Queries take a solidity mask table,
+// either a list of solid tile IDs ({1, 2, 7}) or a set ({[1] = true, ...}),
+// and read the layer directly instead of one tilemap.getTile call per cell.
+// World coordinates have the tilemap origin at (0, 0).
+//
+// The bit mask built from a solidity table is cached against that table
+// (weakly, so it is dropped with the table). Call tilemap.refreshSolid(solid)
+// after editing a table that has already been used in a query.
+
+struct TileSolidMask {
+    uint64_t bits[65536 / 64];
+
+    bool test(uint16_t tile) const {
+        return (bits[tile >> 6] >> (tile & 63)) & 1;
+    }
+};
+
+static int g_tileMaskCacheRef = LUA_NOREF;
+
+// Push the weak-keyed table mapping solidity tables to their mask userdata
+static void pushTileMaskCache(lua_State* L) {
+    if (g_tileMaskCacheRef != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, g_tileMaskCacheRef);
+        return;
+    }
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    g_tileMaskCacheRef = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+static const TileSolidMask& luaL_checktilemask(lua_State* L, int idx) {
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    pushTileMaskCache(L);
+    lua_pushvalue(L, idx);
+    lua_rawget(L, -2);
+    if (lua_type(L, -1) == LUA_TUSERDATA) {
+        // The cache entry lives as long as the table at idx, which is on the stack
+        const TileSolidMask* cached = (const TileSolidMask*)lua_touserdata(L, -1);
+        lua_pop(L, 2);
+        return *cached;
+    }
+    lua_pop(L, 1);
+
+    TileSolidMask& mask = *(TileSolidMask*)lua_newuserdata(L, sizeof(TileSolidMask));
+    memset(mask.bits, 0, sizeof(mask.bits));
+
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        lua_Integer tile = -1;
+        if (lua_type(L, -1) == LUA_TNUMBER) {
+            tile = lua_tointeger(L, -1);
+        } else if (lua_toboolean(L, -1) && lua_type(L, -2) == LUA_TNUMBER) {
+            tile = lua_tointeger(L, -2);
+        }
+        if (tile >= 0 && tile <= 0xFFFF) {
+            mask.bits[tile >> 6] |= (uint64_t)1 << (tile & 63);
+        }
+        lua_pop(L, 1);
+    }
+
+    // cache[solid] = mask
+    lua_pushvalue(L, idx);
+    lua_insert(L, -2);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    return mask;
 }
 
-static int lua_st_tileset_destroy(lua_State* L) {
-    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
-    st_tileset_destroy(id);
+// tilemap.refreshSolid(solid) - rebuild the cached mask after editing solid
+static int lua_st_tilemap_refresh_solid(lua_State* L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    pushTileMaskCache(L);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
     return 0;
 }
 
-static int lua_st_tileset_get_tile_count(lua_State* L) {
-    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
-    int32_t count = st_tileset_get_tile_count(id);
-    lua_pushinteger(L, count);
-    return 1;
+static const TilemapInfo& luaL_checktilelayer(lua_State* L, int idx) {
+    const TilemapInfo* info = findLayerTilemap((STLayerID)luaL_checkinteger(L, idx));
+    if (!info) {
+        luaL_argerror(L, idx, "layer has no tilemap");
+    }
+    return *info;
 }
 
-static int lua_st_tileset_get_dimensions(lua_State* L) {
-    STTilesetID id = (STTilesetID)luaL_checkinteger(L, 1);
-    int32_t columns, rows;
-    st_tileset_get_dimensions(id, &columns, &rows);
-    lua_pushinteger(L, columns);
-    lua_pushinteger(L, rows);
-    return 2;
+static bool tileLayerSolid(STLayerID layer, const TilemapInfo& info, const TileSolidMask& mask, int tx, int ty) {
+    if (tx < 0 || ty < 0 || tx >= info.width || ty >= info.height) {
+        return false;
+    }
+    return mask.test(st_tilemap_get_tile(layer, tx, ty));
 }
 
-static int lua_st_tilemap_layer_set_tileset(lua_State* L) {
+// tilemap.overlapAABB(layer, solid, x, y, w, h) -> hit, tileX, tileY, count
+// tileX/tileY name the first solid tile found (row-major) and count is the
+// number of solid tiles the box overlaps.
+static int lua_st_tilemap_overlap_aabb(lua_State* L) {
     STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
-    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 2);
-    st_tilemap_layer_set_tileset(layer, tileset);
-    return 0;
+    const TilemapInfo& info = luaL_checktilelayer(L, 1);
+    const TileSolidMask& mask = luaL_checktilemask(L, 2);
+    float x = (float)luaL_checknumber(L, 3);
+    float y = (float)luaL_checknumber(L, 4);
+    float w = (float)luaL_checknumber(L, 5);
+    float h = (float)luaL_checknumber(L, 6);
+
+    if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(x + w) || !std::isfinite(y + h)) {
+        return luaL_argerror(L, 3, "box must be finite");
+    }
+
+    // Half-open on the far edge so a box resting on a tile does not overlap
+    // it; the range is clamped to the map so off-map area costs nothing
+    int tx0 = std::max(0, tileCoordClamped(floorf(x / info.tileWidth), info.width));
+    int ty0 = std::max(0, tileCoordClamped(floorf(y / info.tileHeight), info.height));
+    int tx1 = std::min(info.width - 1, tileCoordClamped(ceilf((x + w) / info.tileWidth) - 1.0f, info.width));
+    int ty1 = std::min(info.height - 1, tileCoordClamped(ceilf((y + h) / info.tileHeight) - 1.0f, info.height));
+
+    int count = 0;
+    int firstX = -1, firstY = -1;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            if (tileLayerSolid(layer, info, mask, tx, ty)) {
+                if (count == 0) {
+                    firstX = tx;
+                    firstY = ty;
+                }
+                count++;
+            }
+        }
+    }
+
+    lua_pushboolean(L, count > 0);
+    lua_pushinteger(L, firstX);
+    lua_pushinteger(L, firstY);
+    lua_pushinteger(L, count);
+    return 4;
 }
 
-// =============================================================================
-// DisplayText API Bindings
-// =============================================================================
+// tilemap.sweepAABB(layer, solid, x, y, w, h, vx, vy) -> x, y, normalX, normalY
+// Moves the box by (vx, vy), stopping at solid tiles and sliding along them.
+// normalX/normalY are the last contact normal on each axis (0 for none), so
+// normalY == -1 means the box landed on the ground.
+static int lua_st_tilemap_sweep_aabb(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    const TilemapInfo& info = luaL_checktilelayer(L, 1);
+    const TileSolidMask& mask = luaL_checktilemask(L, 2);
+    float x = (float)luaL_checknumber(L, 3);
+    float y = (float)luaL_checknumber(L, 4);
+    float w = (float)luaL_checknumber(L, 5);
+    float h = (float)luaL_checknumber(L, 6);
+    float vx = (float)luaL_checknumber(L, 7);
+    float vy = (float)luaL_checknumber(L, 8);
+
+    const float skin = 0.001f;
+    float normalX = 0.0f, normalY = 0.0f;
+    auto solid = [&](int tx, int ty) { return tileLayerSolid(layer, info, mask, tx, ty); };
+
+    // Each contact removes one axis of motion, so three passes always finish
+    for (int pass = 0; pass < 3 && (vx != 0.0f || vy != 0.0f); pass++) {
+        SweepHit hit = sweepAABBTiles(x, y, w, h, vx, vy, info.width, info.height,
+                                      (float)info.tileWidth, (float)info.tileHeight, solid);
+        if (hit.toi >= 1.0f) {
+            x += vx;
+            y += vy;
+            break;
+        }
 
-static int lua_st_text_display_at(lua_State* L) {
-    float x = (float)luaL_checknumber(L, 1);
-    float y = (float)luaL_checknumber(L, 2);
-    const char* text = luaL_checkstring(L, 3);
-    float scale_x = (float)luaL_optnumber(L, 4, 1.0);
-    float scale_y = (float)luaL_optnumber(L, 5, 1.0);
-    float rotation = (float)luaL_optnumber(L, 6, 0.0);
-    uint32_t color = (uint32_t)luaL_optinteger(L, 7, 0xFFFFFFFF);
-    STTextAlignment alignment = (STTextAlignment)luaL_optinteger(L, 8, 0); // ST_ALIGN_LEFT
-    int layer = (int)luaL_optinteger(L, 9, 0);
+        float t = std::max(0.0f, hit.toi);
+        x += vx * t + hit.nx * skin;
+        y += vy * t + hit.ny * skin;
+        vx *= (1.0f - t);
+        vy *= (1.0f - t);
+        if (hit.nx != 0.0f) {
+            normalX = hit.nx;
+            vx = 0.0f;
+        }
+        if (hit.ny != 0.0f) {
+            normalY = hit.ny;
+            vy = 0.0f;
+        }
+    }
 
-    int item_id = st_text_display_at(x, y, text, scale_x, scale_y, rotation, color, alignment, layer);
-    lua_pushinteger(L, item_id);
-    return 1;
+    lua_pushnumber(L, x);
+    lua_pushnumber(L, y);
+    lua_pushnumber(L, normalX);
+    lua_pushnumber(L, normalY);
+    return 4;
 }
 
-static int lua_st_text_display_shear(lua_State* L) {
-    float x = (float)luaL_checknumber(L, 1);
-    float y = (float)luaL_checknumber(L, 2);
-    const char* text = luaL_checkstring(L, 3);
-    float scale_x = (float)luaL_optnumber(L, 4, 1.0);
-    float scale_y = (float)luaL_optnumber(L, 5, 1.0);
-    float rotation = (float)luaL_optnumber(L, 6, 0.0);
-    float shear_x = (float)luaL_optnumber(L, 7, 0.0);
-    float shear_y = (float)luaL_optnumber(L, 8, 0.0);
-    uint32_t color = (uint32_t)luaL_optinteger(L, 9, 0xFFFFFFFF);
-    STTextAlignment alignment = (STTextAlignment)luaL_optinteger(L, 10, 0); // ST_ALIGN_LEFT
-    int layer = (int)luaL_optinteger(L, 11, 0);
+// tilemap.raycast(layer, solid, x, y, dirX, dirY, maxDistance)
+//   -> hit, tileX, tileY, hitX, hitY, distance, normalX, normalY
+// The ray is first clipped to the map, then walks the tiles inside it with a
+// DDA and stops at the first solid one.
+static int lua_st_tilemap_raycast(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    const TilemapInfo& info = luaL_checktilelayer(L, 1);
+    const TileSolidMask& mask = luaL_checktilemask(L, 2);
+    float ox = (float)luaL_checknumber(L, 3);
+    float oy = (float)luaL_checknumber(L, 4);
+    float dx = (float)luaL_checknumber(L, 5);
+    float dy = (float)luaL_checknumber(L, 6);
+    float maxDistance = (float)luaL_checknumber(L, 7);
+
+    if (!std::isfinite(ox) || !std::isfinite(oy) || !std::isfinite(dx) || !std::isfinite(dy)) {
+        return luaL_argerror(L, 3, "ray must be finite");
+    }
+    // Scale before normalising so large directions cannot overflow
+    float scale = std::max(fabsf(dx), fabsf(dy));
+    if (scale == 0.0f || !(maxDistance >= 0.0f)) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    dx /= scale;
+    dy /= scale;
+    float len = sqrtf(dx * dx + dy * dy);
+    dx /= len;
+    dy /= len;
+
+    // Slab test against the map bounds; a ray starting off the map begins at
+    // the point where it enters, with that edge's normal
+    float tw = (float)info.tileWidth, th = (float)info.tileHeight;
+    float mapW = info.width * tw, mapH = info.height * th;
+    float tEnter = 0.0f, tExit = maxDistance;
+    float nx = 0.0f, ny = 0.0f;
+    if (dx != 0.0f) {
+        float t0 = (0.0f - ox) / dx, t1 = (mapW - ox) / dx;
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > tEnter) {
+            tEnter = t0;
+            nx = dx > 0.0f ? -1.0f : 1.0f;
+        }
+        tExit = std::min(tExit, t1);
+    } else if (ox < 0.0f || ox >= mapW) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    if (dy != 0.0f) {
+        float t0 = (0.0f - oy) / dy, t1 = (mapH - oy) / dy;
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > tEnter) {
+            tEnter = t0;
+            nx = 0.0f;
+            ny = dy > 0.0f ? -1.0f : 1.0f;
+        }
+        tExit = std::min(tExit, t1);
+    } else if (oy < 0.0f || oy >= mapH) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    if (tEnter > tExit) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
 
-    int item_id = st_text_display_shear(x, y, text, scale_x, scale_y, rotation, shear_x, shear_y, color, alignment, layer);
-    lua_pushinteger(L, item_id);
-    return 1;
-}
+    float px = ox + dx * tEnter, py = oy + dy * tEnter;
+    int tx = tileIndexClamped(px, tw, info.width);
+    int ty = tileIndexClamped(py, th, info.height);
+    if (tEnter > 0.0f) {
+        // The entry point lies on the map edge; take the tile just inside
+        tx = std::max(0, std::min(info.width - 1, tx));
+        ty = std::max(0, std::min(info.height - 1, ty));
+    }
+    int stepX = (dx > 0.0f) ? 1 : -1;
+    int stepY = (dy > 0.0f) ? 1 : -1;
+    float tDeltaX = (dx != 0.0f) ? fabsf(tw / dx) : INFINITY;
+    float tDeltaY = (dy != 0.0f) ? fabsf(th / dy) : INFINITY;
+    float tMaxX = (dx != 0.0f) ? ((tx + (stepX > 0 ? 1 : 0)) * tw - ox) / dx : INFINITY;
+    float tMaxY = (dy != 0.0f) ? ((ty + (stepY > 0 ? 1 : 0)) * th - oy) / dy : INFINITY;
+
+    float t = tEnter;
+    while (t <= maxDistance) {
+        if (tileLayerSolid(layer, info, mask, tx, ty)) {
+            lua_pushboolean(L, true);
+            lua_pushinteger(L, tx);
+            lua_pushinteger(L, ty);
+            lua_pushnumber(L, ox + dx * t);
+            lua_pushnumber(L, oy + dy * t);
+            lua_pushnumber(L, t);
+            lua_pushnumber(L, nx);
+            lua_pushnumber(L, ny);
+            return 8;
+        }
 
-static int lua_st_text_display_update(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    const char* text = luaL_checkstring(L, 2);
-    float x = (float)luaL_optnumber(L, 3, -1.0);
-    float y = (float)luaL_optnumber(L, 4, -1.0);
-    int result = st_text_update_item(item_id, text, x, y);
-    lua_pushboolean(L, result);
-    return 1;
-}
+        // Stop once the ray has left the map in the direction it travels
+        if ((stepX > 0 ? tx >= info.width : tx < 0) && dx != 0.0f) break;
+        if ((stepY > 0 ? ty >= info.height : ty < 0) && dy != 0.0f) break;
+
+        if (tMaxX < tMaxY) {
+            t = tMaxX;
+            tMaxX += tDeltaX;
+            tx += stepX;
+            nx = (float)-stepX;
+            ny = 0.0f;
+        } else {
+            t = tMaxY;
+            tMaxY += tDeltaY;
+            ty += stepY;
+            nx = 0.0f;
+            ny = (float)-stepY;
+        }
+    }
 
-static int lua_st_text_display_set_visible(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    int visible = lua_toboolean(L, 2);
-    int result = st_text_set_item_visible(item_id, visible);
-    lua_pushboolean(L, result);
+    lua_pushboolean(L, false);
     return 1;
 }
 
-static int lua_st_text_display_clear(lua_State* L) {
-    (void)L;
-    st_text_clear_displayed();
-    return 0;
+// =============================================================================
+// Tilemap Auto-tiling API Bindings
+// =============================================================================
+
+// A rule set names the tiles that make up one terrain and maps a
+// neighbour bitmask to the tile to place. "wang4" masks use the edge
+// neighbours N=1, E=2, S=4, W=8; "blob8" masks add the corners
+// (N=1, NE=2, E=4, SE=8, S=16, SW=32, W=64, NW=128), with a corner counted
+// only when both edges beside it are set. Cells outside the map count as
+// connected so terrain runs cleanly off the edges.
+struct AutotileRuleSet {
+    bool blob = false;
+    int32_t ruleTile[256];
+};
+
+struct TilesetAutotile {
+    std::vector<AutotileRuleSet> sets;
+    std::vector<int16_t> setOfTile;    // tile ID -> rule set, -1 for none
+};
+
+static std::unordered_map<STTilesetID, TilesetAutotile> g_tilesetAutotile;
+
+static uint8_t autotileMask(const int16_t* member, int32_t stride, int16_t set, bool blob) {
+    bool n = member[-stride] == set, s = member[stride] == set;
+    bool e = member[1] == set, w = member[-1] == set;
+    if (!blob) {
+        return (uint8_t)(n | (e << 1) | (s << 2) | (w << 3));
+    }
+    bool ne = n && e && member[-stride + 1] == set;
+    bool se = s && e && member[stride + 1] == set;
+    bool sw = s && w && member[stride - 1] == set;
+    bool nw = n && w && member[-stride - 1] == set;
+    return (uint8_t)(n | (ne << 1) | (e << 2) | (se << 3) | (s << 4) | (sw << 5) | (w << 6) | (nw << 7));
 }
 
-static int lua_st_text_update_item(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    const char* text = luaL_optstring(L, 2, nullptr);
-    float x = (float)luaL_optnumber(L, 3, -1.0);
-    float y = (float)luaL_optnumber(L, 4, -1.0);
+// Integer value at idx within [0, limit], or -1 for anything else
+static lua_Integer autotileInteger(lua_State* L, int idx, lua_Integer limit) {
+    if (lua_type(L, idx) != LUA_TNUMBER) {
+        return -1;
+    }
+    lua_Number value = lua_tonumber(L, idx);
+    lua_Integer integer = lua_tointeger(L, idx);
+    return (lua_Number)integer == value && integer >= 0 && integer <= limit ? integer : -1;
+}
+
+// tilemap.defineAutotile(tileset, "wang4" | "blob8", {terrainTile, ...}, {[mask] = tile, ...}) -> index
+// Tiles produced by the rules are part of the terrain automatically. Masks
+// and tiles must be integers in range; anything else raises an error before
+// the tileset is changed.
+static int lua_st_tilemap_define_autotile(lua_State* L) {
+    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 1);
+    const char* mode = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    luaL_checktype(L, 4, LUA_TTABLE);
 
-    st_text_update_item(item_id, text, x, y);
-    return 0;
-}
+    AutotileRuleSet rules;
+    if (strcmp(mode, "blob8") == 0) {
+        rules.blob = true;
+    } else if (strcmp(mode, "wang4") != 0) {
+        return luaL_argerror(L, 2, "mode must be 'wang4' or 'blob8'");
+    }
+    std::fill(rules.ruleTile, rules.ruleTile + 256, -1);
 
-static int lua_st_text_remove_item(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    st_text_remove_item(item_id);
-    return 0;
-}
+    std::vector<uint16_t> terrain;
+    lua_pushnil(L);
+    while (lua_next(L, 4) != 0) {
+        lua_Integer mask = autotileInteger(L, -2, rules.blob ? 255 : 15);
+        lua_Integer tile = autotileInteger(L, -1, 0xFFFF);
+        if (mask < 0) {
+            return luaL_argerror(L, 4, rules.blob ? "rule masks must be integers 0-255"
+                                                  : "rule masks must be integers 0-15");
+        }
+        if (tile < 0) {
+            return luaL_argerror(L, 4, "rule tiles must be integers 0-65535");
+        }
+        rules.ruleTile[mask] = (int32_t)tile;
+        terrain.push_back((uint16_t)tile);
+        lua_pop(L, 1);
+    }
 
-static int lua_st_text_clear_displayed(lua_State* L) {
-    (void)L;
-    st_text_clear_displayed();
-    return 0;
-}
+    for (int i = 1; ; i++) {
+        lua_rawgeti(L, 3, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        lua_Integer tile = autotileInteger(L, -1, 0xFFFF);
+        if (tile < 0) {
+            return luaL_argerror(L, 3, "terrain tiles must be integers 0-65535");
+        }
+        terrain.push_back((uint16_t)tile);
+        lua_pop(L, 1);
+    }
 
-static int lua_st_text_set_item_visible(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    bool visible = lua_toboolean(L, 2);
-    st_text_set_item_visible(item_id, visible);
-    return 0;
+    TilesetAutotile& autotile = g_tilesetAutotile[tileset];
+    luaL_argcheck(L, autotile.sets.size() < 0x7FFF, 1, "too many rule sets");
+    if (autotile.setOfTile.empty()) {
+        autotile.setOfTile.assign(65536, -1);
+    }
+    int16_t index = (int16_t)autotile.sets.size();
+    for (uint16_t tile : terrain) {
+        autotile.setOfTile[tile] = index;
+    }
+    autotile.sets.push_back(rules);
+    lua_pushinteger(L, index);
+    return 1;
 }
 
-static int lua_st_text_set_item_layer(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    int layer = (int)luaL_checkinteger(L, 2);
-    st_text_set_item_layer(item_id, layer);
+static int lua_st_tilemap_clear_autotile(lua_State* L) {
+    STTilesetID tileset = (STTilesetID)luaL_checkinteger(L, 1);
+    g_tilesetAutotile.erase(tileset);
     return 0;
 }
 
-static int lua_st_text_set_item_color(lua_State* L) {
-    int item_id = (int)luaL_checkinteger(L, 1);
-    uint32_t color = (uint32_t)luaL_checkinteger(L, 2);
-    st_text_set_item_color(item_id, color);
-    return 0;
-}
+// tilemap.autotile(layer, x, y, w, h) -> tiles changed
+// Re-tiles every terrain cell in the rectangle and the ring of cells around
+// it, since their neighbourhoods may have changed too.
+static int lua_st_tilemap_autotile(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    const TilemapInfo& info = luaL_checktilelayer(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    int32_t width = (int32_t)luaL_checkinteger(L, 4);
+    int32_t height = (int32_t)luaL_checkinteger(L, 5);
 
-static int lua_st_text_get_item_count(lua_State* L) {
-    int count = st_text_get_item_count();
-    lua_pushinteger(L, count);
-    return 1;
-}
+    auto tilesetIt = g_layerTileset.find(layer);
+    auto autotileIt = (tilesetIt != g_layerTileset.end()) ? g_tilesetAutotile.find(tilesetIt->second)
+                                                          : g_tilesetAutotile.end();
+    if (autotileIt == g_tilesetAutotile.end() || width <= 0 || height <= 0) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+    const TilesetAutotile& autotile = autotileIt->second;
 
-static int lua_st_text_get_visible_count(lua_State* L) {
-    int count = st_text_get_visible_count();
-    lua_pushinteger(L, count);
+    // Cells to re-tile, clipped to the map
+    int32_t x0 = std::max(x - 1, 0), y0 = std::max(y - 1, 0);
+    int32_t x1 = std::min(x + width + 1, info.width), y1 = std::min(y + height + 1, info.height);
+    if (x0 >= x1 || y0 >= y1) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    // Terrain membership for those cells plus a one-cell border. Off-map
+    // border cells are filled in below once the cell they border is known.
+    int32_t stride = (x1 - x0) + 2;
+    int32_t rows = (y1 - y0) + 2;
+    static std::vector<int16_t> member;
+    static std::vector<uint16_t> current;
+    member.assign((size_t)stride * rows, -1);
+    current.assign((size_t)stride * rows, 0);
+    for (int32_t ty = y0 - 1; ty <= y1; ty++) {
+        for (int32_t tx = x0 - 1; tx <= x1; tx++) {
+            if (tx < 0 || ty < 0 || tx >= info.width || ty >= info.height) {
+                continue;
+            }
+            size_t i = (size_t)(ty - y0 + 1) * stride + (tx - x0 + 1);
+            current[i] = st_tilemap_get_tile(layer, tx, ty);
+            member[i] = autotile.setOfTile[current[i]];
+        }
+    }
+
+    int changed = 0;
+    for (int32_t ty = y0; ty < y1; ty++) {
+        for (int32_t tx = x0; tx < x1; tx++) {
+            size_t i = (size_t)(ty - y0 + 1) * stride + (tx - x0 + 1);
+            int16_t set = member[i];
+            if (set < 0) {
+                continue;
+            }
+
+            // Treat off-map neighbours as the same terrain
+            int16_t neighbourhood[9];
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    bool offMap = tx + dx < 0 || ty + dy < 0 || tx + dx >= info.width || ty + dy >= info.height;
+                    neighbourhood[(dy + 1) * 3 + (dx + 1)] = offMap ? set : member[i + dy * stride + dx];
+                }
+            }
+
+            const AutotileRuleSet& rules = autotile.sets[set];
+            int32_t tile = rules.ruleTile[autotileMask(neighbourhood + 4, 3, set, rules.blob)];
+            if (tile >= 0 && tile != current[i]) {
+                tilemapWriteTile(layer, tx, ty, (uint16_t)tile);
+                tileAnimationsTouch(layer, tx, ty, (uint16_t)tile);
+                changed++;
+            }
+        }
+    }
+
+    lua_pushinteger(L, changed);
     return 1;
 }
 
 // =============================================================================
-// Collision Detection API Bindings
+// Chunked Tilemap API Bindings
 // =============================================================================
 
-static int lua_collision_circle_circle(lua_State* L) {
-    float x1 = (float)luaL_checknumber(L, 1);
-    float y1 = (float)luaL_checknumber(L, 2);
-    float r1 = (float)luaL_checknumber(L, 3);
-    float x2 = (float)luaL_checknumber(L, 4);
-    float y2 = (float)luaL_checknumber(L, 5);
-    float r2 = (float)luaL_checknumber(L, 6);
+// Worlds far larger than a framework tilemap. Tiles live in fixed-size square
+// chunks in a sparse memory-mapped file laid out chunk by chunk, so a chunk
+// costs disk space only once written. Without a path the file is an unlinked
+// temporary. A framework layer of normal size acts as a window onto the
+// world: as the camera moves the window origin is shifted in whole chunks and
+// only the chunks under it are streamed into the layer. Chunks that leave the
+// window, or were written while outside it, are written back and their pages
+// released, so memory follows the view instead of the world size.
+//
+// File layout: ChunkedWorldHeader padded to CHUNKED_WORLD_DATA_OFFSET, then
+// chunksX * chunksY chunks of chunkSize^2 uint16 tiles, row-major.
+
+struct ChunkedWorldHeader {
+    char magic[8];           // "STCHUNKW"
+    uint32_t version;        // CHUNKED_WORLD_VERSION
+    int32_t worldWidth;
+    int32_t worldHeight;
+    int32_t chunkSize;
+};
+
+static const char CHUNKED_WORLD_MAGIC[8] = {'S', 'T', 'C', 'H', 'U', 'N', 'K', 'W'};
+static const uint32_t CHUNKED_WORLD_VERSION = 1;
+static const size_t CHUNKED_WORLD_DATA_OFFSET = 4096;
+
+struct ChunkedTilemap {
+    STLayerID layer = 0;
+    int32_t worldWidth = 0, worldHeight = 0;
+    int32_t chunkSize = 64;
+    int32_t chunksX = 0, chunksY = 0;
+
+    // Window origin in tiles; the framework layer shows [origin, origin + window)
+    int32_t originX = 0, originY = 0;
+    bool windowValid = false;
+
+    MappedFile file;
+
+    // Chunks written outside the window since the last release
+    std::unordered_set<size_t> touched;
+
+    uint64_t rebases = 0;
+    uint64_t tilesStreamed = 0;
+    uint64_t chunksReleased = 0;
+
+    size_t chunkTiles() const {
+        return (size_t)chunkSize * chunkSize;
+    }
 
-    int result = st_collision_circle_circle(x1, y1, r1, x2, y2, r2);
-    lua_pushboolean(L, result);
+    size_t chunkIndex(int32_t cx, int32_t cy) const {
+        return (size_t)cy * chunksX + cx;
+    }
+
+    size_t chunkOffset(size_t index) const {
+        return CHUNKED_WORLD_DATA_OFFSET + index * chunkTiles() * sizeof(uint16_t);
+    }
+
+    uint16_t* chunkData(int32_t cx, int32_t cy) {
+        return (uint16_t*)(file.data() + chunkOffset(chunkIndex(cx, cy)));
+    }
+
+    void releaseChunk(size_t index) {
+        file.release(chunkOffset(index), chunkTiles() * sizeof(uint16_t));
+        chunksReleased++;
+    }
+
+    // Whether chunk (cx, cy) overlaps the window of width x height tiles
+    bool chunkInWindow(int32_t cx, int32_t cy, int32_t width, int32_t height) const {
+        return cx >= originX / chunkSize && cx <= (originX + width - 1) / chunkSize &&
+               cy >= originY / chunkSize && cy <= (originY + height - 1) / chunkSize;
+    }
+
+    bool inWorld(int32_t x, int32_t y) const {
+        return x >= 0 && y >= 0 && x < worldWidth && y < worldHeight;
+    }
+
+    uint16_t getTile(int32_t x, int32_t y) {
+        if (!inWorld(x, y)) {
+            return 0;
+        }
+        return chunkData(x / chunkSize, y / chunkSize)[(y % chunkSize) * chunkSize + (x % chunkSize)];
+    }
+
+    void setTile(int32_t x, int32_t y, uint16_t tile) {
+        if (!inWorld(x, y)) {
+            return;
+        }
+        chunkData(x / chunkSize, y / chunkSize)[(y % chunkSize) * chunkSize + (x % chunkSize)] = tile;
+    }
+};
+
+// Validate the header of an existing world file against the requested layout.
+// A missing or empty file is accepted and gets a header once mapped.
+static bool chunkedWorldFileMatches(const char* path, const ChunkedWorldHeader& expected) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return true;
+    }
+    ChunkedWorldHeader header;
+    size_t got = fread(&header, 1, sizeof(header), f);
+    fclose(f);
+    if (got == 0) {
+        return true;
+    }
+    return got == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0;
+}
+
+static SlotMap<ChunkedTilemap> g_chunkedTilemaps;
+
+static ChunkedTilemap& luaL_checkchunkedtilemap(lua_State* L, int idx) {
+    int id = luaL_checkinteger(L, idx);
+    ChunkedTilemap* map = id > 0 ? g_chunkedTilemaps.get((uint32_t)id) : nullptr;
+    if (!map) {
+        luaL_argerror(L, idx, "invalid chunked tilemap id");
+    }
+    return *map;
+}
+
+// Copy the world tiles under the window into the framework layer; only the
+// bounds of the tiles that changed are rescanned for animations
+static void chunkedTilemapStream(ChunkedTilemap& map, const TilemapInfo& window) {
+    int32_t x0 = window.width, y0 = window.height, x1 = 0, y1 = 0;
+    for (int32_t ty = 0; ty < window.height; ty++) {
+        for (int32_t tx = 0; tx < window.width; tx++) {
+            uint16_t tile = map.getTile(map.originX + tx, map.originY + ty);
+            if (!map.windowValid || st_tilemap_get_tile(map.layer, tx, ty) != tile) {
+                tilemapWriteTile(map.layer, tx, ty, tile);
+                map.tilesStreamed++;
+                x0 = std::min(x0, tx);
+                y0 = std::min(y0, ty);
+                x1 = std::max(x1, tx + 1);
+                y1 = std::max(y1, ty + 1);
+            }
+        }
+    }
+    map.windowValid = true;
+    tileAnimationsInvalidateRect(map.layer, x0, y0, x1, y1);
+}
+
+// Release chunks written outside the window since the last call
+static void chunkedTilemapReleaseTouched(ChunkedTilemap& map, const TilemapInfo& window) {
+    for (size_t index : map.touched) {
+        int32_t cx = (int32_t)(index % map.chunksX), cy = (int32_t)(index / map.chunksX);
+        if (!map.chunkInWindow(cx, cy, window.width, window.height)) {
+            map.releaseChunk(index);
+        }
+    }
+    map.touched.clear();
+}
+
+// Release the chunks of the old window [ox, ox + width) x [oy, oy + height)
+// that the current window no longer covers
+static void chunkedTilemapReleaseWindow(ChunkedTilemap& map, const TilemapInfo& window, int32_t ox, int32_t oy) {
+    int32_t cx0 = ox / map.chunkSize, cx1 = std::min(map.chunksX - 1, (ox + window.width - 1) / map.chunkSize);
+    int32_t cy0 = oy / map.chunkSize, cy1 = std::min(map.chunksY - 1, (oy + window.height - 1) / map.chunkSize);
+    for (int32_t cy = cy0; cy <= cy1; cy++) {
+        for (int32_t cx = cx0; cx <= cx1; cx++) {
+            if (!map.chunkInWindow(cx, cy, window.width, window.height)) {
+                map.releaseChunk(map.chunkIndex(cx, cy));
+            }
+        }
+    }
+}
+
+// tilemap.createChunked(layer, worldWidth, worldHeight [, chunkSize [, path]]) -> id
+// layer must already have a tilemap; its size is the streaming window. With a
+// path the world is stored in (and reloaded from) that file; an existing file
+// must have been created with the same world size and chunk size, otherwise
+// nil is returned.
+static int lua_st_tilemap_create_chunked(lua_State* L) {
+    STLayerID layer = (STLayerID)luaL_checkinteger(L, 1);
+    luaL_checktilelayer(L, 1);
+    int32_t worldWidth = (int32_t)luaL_checkinteger(L, 2);
+    int32_t worldHeight = (int32_t)luaL_checkinteger(L, 3);
+    int32_t chunkSize = (int32_t)luaL_optinteger(L, 4, 64);
+    const char* path = luaL_optstring(L, 5, nullptr);
+    luaL_argcheck(L, worldWidth > 0, 2, "world width must be positive");
+    luaL_argcheck(L, worldHeight > 0, 3, "world height must be positive");
+    luaL_argcheck(L, chunkSize >= 8 && chunkSize <= 1024, 4, "chunk size must be between 8 and 1024");
+
+    ChunkedTilemap map;
+    map.layer = layer;
+    map.worldWidth = worldWidth;
+    map.worldHeight = worldHeight;
+    map.chunkSize = chunkSize;
+    map.chunksX = (worldWidth + chunkSize - 1) / chunkSize;
+    map.chunksY = (worldHeight + chunkSize - 1) / chunkSize;
+
+    size_t chunkBytes = map.chunkTiles() * sizeof(uint16_t);
+    size_t chunkCount = (size_t)map.chunksX * map.chunksY;
+    luaL_argcheck(L, chunkCount <= (SIZE_MAX - CHUNKED_WORLD_DATA_OFFSET) / chunkBytes, 2, "world too large");
+    size_t bytes = CHUNKED_WORLD_DATA_OFFSET + chunkCount * chunkBytes;
+
+    ChunkedWorldHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHUNKED_WORLD_MAGIC, sizeof(header.magic));
+    header.version = CHUNKED_WORLD_VERSION;
+    header.worldWidth = worldWidth;
+    header.worldHeight = worldHeight;
+    header.chunkSize = chunkSize;
+
+    bool opened = path ? chunkedWorldFileMatches(path, header) && map.file.openWrite(path, bytes)
+                       : map.file.openTemporary(bytes);
+    if (!opened) {
+        lua_pushnil(L);
+        return 1;
+    }
+    memcpy(map.file.data(), &header, sizeof(header));
+
+    uint32_t id = g_chunkedTilemaps.insert(std::move(map));
+    if (id == 0) {
+        return luaL_error(L, "tilemap.createChunked: chunked tilemap limit reached");
+    }
+    lua_pushinteger(L, (lua_Integer)id);
     return 1;
 }
 
-static int lua_collision_circle_rect(lua_State* L) {
-    float cx = (float)luaL_checknumber(L, 1);
-    float cy = (float)luaL_checknumber(L, 2);
-    float radius = (float)luaL_checknumber(L, 3);
-    float rx = (float)luaL_checknumber(L, 4);
-    float ry = (float)luaL_checknumber(L, 5);
-    float rw = (float)luaL_checknumber(L, 6);
-    float rh = (float)luaL_checknumber(L, 7);
-
-    int result = st_collision_circle_rect(cx, cy, radius, rx, ry, rw, rh);
-    lua_pushboolean(L, result);
+static int lua_st_tilemap_destroy_chunked(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushboolean(L, id > 0 && g_chunkedTilemaps.erase((uint32_t)id));
     return 1;
 }
 
-static int lua_collision_circle_rect_bottom(lua_State* L) {
-    float cx = (float)luaL_checknumber(L, 1);
-    float cy = (float)luaL_checknumber(L, 2);
-    float radius = (float)luaL_checknumber(L, 3);
-    float rx = (float)luaL_checknumber(L, 4);
-    float ry = (float)luaL_checknumber(L, 5);
-    float rw = (float)luaL_checknumber(L, 6);
-    float rh = (float)luaL_checknumber(L, 7);
+// tilemap.chunkedSetTile(id, x, y, tile) - world tile coordinates
+static int lua_st_tilemap_chunked_set_tile(lua_State* L) {
+    ChunkedTilemap& map = luaL_checkchunkedtilemap(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    uint16_t tile = (uint16_t)luaL_checkinteger(L, 4);
 
-    int result = st_collision_circle_rect_bottom(cx, cy, radius, rx, ry, rw, rh);
-    lua_pushboolean(L, result);
-    return 1;
+    if (!map.inWorld(x, y)) {
+        return 0;
+    }
+    map.setTile(x, y, tile);
+
+    const TilemapInfo* window = findLayerTilemap(map.layer);
+    int32_t wx = x - map.originX, wy = y - map.originY;
+    if (map.windowValid && window && wx >= 0 && wy >= 0 && wx < window->width && wy < window->height) {
+        tilemapWriteTile(map.layer, wx, wy, tile);
+        tileAnimationsTouch(map.layer, wx, wy, tile);
+    } else {
+        map.touched.insert(map.chunkIndex(x / map.chunkSize, y / map.chunkSize));
+    }
+    return 0;
 }
 
-static int lua_collision_rect_rect(lua_State* L) {
-    float x1 = (float)luaL_checknumber(L, 1);
-    float y1 = (float)luaL_checknumber(L, 2);
-    float w1 = (float)luaL_checknumber(L, 3);
-    float h1 = (float)luaL_checknumber(L, 4);
-    float x2 = (float)luaL_checknumber(L, 5);
-    float y2 = (float)luaL_checknumber(L, 6);
-    float w2 = (float)luaL_checknumber(L, 7);
-    float h2 = (float)luaL_checknumber(L, 8);
+static int lua_st_tilemap_chunked_get_tile(lua_State* L) {
+    ChunkedTilemap& map = luaL_checkchunkedtilemap(L, 1);
+    int32_t x = (int32_t)luaL_checkinteger(L, 2);
+    int32_t y = (int32_t)luaL_checkinteger(L, 3);
+    lua_pushinteger(L, map.getTile(x, y));
+    return 1;
+}
+
+// tilemap.chunkedSetCamera(id, x, y [, viewWidth, viewHeight]) -> offsetX, offsetY
+// Positions the camera in world pixels. When the view centre drifts more than
+// a chunk from the window centre, the window is moved to re-centre it and the
+// newly covered tiles are streamed in. The framework camera is set relative
+// to the window; the returned offset (window origin in pixels) must be
+// subtracted from world positions of anything else drawn over the map.
+static int lua_st_tilemap_chunked_set_camera(lua_State* L) {
+    ChunkedTilemap& map = luaL_checkchunkedtilemap(L, 1);
+    float x = (float)luaL_checknumber(L, 2);
+    float y = (float)luaL_checknumber(L, 3);
+    float viewWidth = (float)luaL_optnumber(L, 4, 0.0);
+    float viewHeight = (float)luaL_optnumber(L, 5, 0.0);
+
+    const TilemapInfo* window = findLayerTilemap(map.layer);
+    if (!window) {
+        return luaL_error(L, "tilemap.chunkedSetCamera: layer has no tilemap");
+    }
 
-    int result = st_collision_rect_rect(x1, y1, w1, h1, x2, y2, w2, h2);
-    lua_pushboolean(L, result);
-    return 1;
+    float focusX = (x + viewWidth * 0.5f) / window->tileWidth;
+    float focusY = (y + viewHeight * 0.5f) / window->tileHeight;
+    float centreX = map.originX + window->width * 0.5f;
+    float centreY = map.originY + window->height * 0.5f;
+
+    if (!map.windowValid || fabsf(focusX - centreX) > map.chunkSize || fabsf(focusY - centreY) > map.chunkSize) {
+        int32_t maxX = std::max(0, map.worldWidth - window->width);
+        int32_t maxY = std::max(0, map.worldHeight - window->height);
+        int32_t ox = (int32_t)floorf((focusX - window->width * 0.5f) / map.chunkSize) * map.chunkSize;
+        int32_t oy = (int32_t)floorf((focusY - window->height * 0.5f) / map.chunkSize) * map.chunkSize;
+        ox = std::min(std::max(ox, 0), maxX);
+        oy = std::min(std::max(oy, 0), maxY);
+
+        if (!map.windowValid || ox != map.originX || oy != map.originY) {
+            int32_t oldX = map.originX, oldY = map.originY;
+            bool hadWindow = map.windowValid;
+            map.originX = ox;
+            map.originY = oy;
+            map.rebases++;
+            chunkedTilemapStream(map, *window);
+            if (hadWindow) {
+                chunkedTilemapReleaseWindow(map, *window, oldX, oldY);
+            }
+        }
+    }
+    if (!map.touched.empty()) {
+        chunkedTilemapReleaseTouched(map, *window);
+    }
+
+    float offsetX = (float)map.originX * window->tileWidth;
+    float offsetY = (float)map.originY * window->tileHeight;
+    st_tilemap_set_camera(x - offsetX, y - offsetY);
+
+    lua_pushnumber(L, offsetX);
+    lua_pushnumber(L, offsetY);
+    return 2;
 }
 
-static int lua_collision_point_in_circle(lua_State* L) {
-    float px = (float)luaL_checknumber(L, 1);
-    float py = (float)luaL_checknumber(L, 2);
-    float cx = (float)luaL_checknumber(L, 3);
-    float cy = (float)luaL_checknumber(L, 4);
-    float radius = (float)luaL_checknumber(L, 5);
+// tilemap.chunkedFlush(id) - schedule write-back of a file-backed world
+static int lua_st_tilemap_chunked_flush(lua_State* L) {
+    luaL_checkchunkedtilemap(L, 1).file.flush();
+    return 0;
+}
 
-    int result = st_collision_point_in_circle(px, py, cx, cy, radius);
-    lua_pushboolean(L, result);
+// tilemap.chunkedGetStats(id) -> {chunks, rebases, tilesStreamed, chunksReleased}
+static int lua_st_tilemap_chunked_get_stats(lua_State* L) {
+    const ChunkedTilemap& map = luaL_checkchunkedtilemap(L, 1);
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer)map.chunksX * map.chunksY);
+    lua_setfield(L, -2, "chunks");
+    lua_pushinteger(L, (lua_Integer)map.rebases);
+    lua_setfield(L, -2, "rebases");
+    lua_pushinteger(L, (lua_Integer)map.tilesStreamed);
+    lua_setfield(L, -2, "tilesStreamed");
+    lua_pushinteger(L, (lua_Integer)map.chunksReleased);
+    lua_setfield(L, -2, "chunksReleased");
     return 1;
 }
 
-static int lua_collision_point_in_rect(lua_State* L) {
-    float px = (float)luaL_checknumber(L, 1);
-    float py = (float)luaL_checknumber(L, 2);
-    float rx = (float)luaL_checknumber(L, 3);
-    float ry = (float)luaL_checknumber(L, 4);
-    float rw = (float)luaL_checknumber(L, 5);
-    float rh = (float)luaL_checknumber(L, 6);
+// =============================================================================
+// Tilemap Level File API Bindings
+// =============================================================================
 
-    int result = st_collision_point_in_rect(px, py, rx, ry, rw, rh);
-    lua_pushboolean(L, result);
-    return 1;
+// Binary level format, little-endian:
+//   LevelFileHeader
+//   LevelFileLayer[layerCount]
+//   per layer: LevelFileChunk[chunksX * chunksY], row-major
+//   chunk payloads: chunkSize * chunkSize uint16 tile IDs, raw or LZ4
+// Empty chunks have no payload. Loading maps the file and writes tiles into
+// new framework layers directly, with no Lua involvement per tile.
+
+static const uint16_t LEVEL_FILE_VERSION = 1;
+
+enum LevelChunkEncoding {
+    LEVEL_CHUNK_EMPTY = 0,
+    LEVEL_CHUNK_RAW = 1,
+    LEVEL_CHUNK_LZ4 = 2
+};
+
+struct LevelFileHeader {
+    char magic[4];          // "STLV"
+    uint16_t version;
+    uint16_t layerCount;
+    uint32_t chunkSize;
+    uint32_t reserved;
+};
+
+struct LevelFileLayer {
+    char name[32];
+    uint32_t width, height;
+    uint16_t tileWidth, tileHeight;
+    uint32_t chunksX, chunksY;
+    uint32_t reserved;
+    uint64_t chunkIndexOffset;
+};
+
+struct LevelFileChunk {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t encoding;
+};
+
+static_assert(sizeof(LevelFileHeader) == 16, "level header layout");
+static_assert(sizeof(LevelFileLayer) == 64, "level layer layout");
+static_assert(sizeof(LevelFileChunk) == 16, "level chunk layout");
+
+// Whether a layer record describes a map the framework can hold and a chunk
+// index that lies inside the image
+static bool levelLayerValid(const LevelFileLayer& info, size_t chunkSize, size_t baseSize) {
+    if (info.width == 0 || info.height == 0 || info.width > INT32_MAX || info.height > INT32_MAX ||
+        info.tileWidth == 0 || info.tileHeight == 0) {
+        return false;
+    }
+    if (info.chunksX != (info.width + chunkSize - 1) / chunkSize ||
+        info.chunksY != (info.height + chunkSize - 1) / chunkSize) {
+        return false;
+    }
+    // chunksX, chunksY < 2^31 so the count fits; the byte size is checked by division
+    uint64_t chunkCount = (uint64_t)info.chunksX * info.chunksY;
+    return info.chunkIndexOffset <= baseSize &&
+           chunkCount <= (baseSize - info.chunkIndexOffset) / sizeof(LevelFileChunk);
+}
+
+// Destroy layers created by a level load that is being abandoned
+static void tilemapUnloadLevelLayers(const std::vector<std::pair<STLayerID, STTilemapID>>& created) {
+    for (const auto& entry : created) {
+        st_tilemap_destroy_layer(entry.first);
+        g_layerTilemap.erase(entry.first);
+        st_tilemap_destroy(entry.second);
+        g_tilemapInfo.erase(entry.second);
+    }
 }
 
-static int lua_collision_circle_rect_info(lua_State* L) {
-    float cx = (float)luaL_checknumber(L, 1);
-    float cy = (float)luaL_checknumber(L, 2);
-    float radius = (float)luaL_checknumber(L, 3);
-    float rx = (float)luaL_checknumber(L, 4);
-    float ry = (float)luaL_checknumber(L, 5);
-    float rw = (float)luaL_checknumber(L, 6);
-    float rh = (float)luaL_checknumber(L, 7);
+// Create layers from an in-memory level image and push their IDs as a table,
+// or nil if the image is not a valid level. Every layer record is validated
+// before any layer is created, so a bad image creates nothing.
+static int tilemapLoadLevel(lua_State* L, const uint8_t* base, size_t baseSize) {
+    if (!base || baseSize < sizeof(LevelFileHeader)) {
+        lua_pushnil(L);
+        return 1;
+    }
 
-    st_collision_info info;
-    st_collision_circle_rect_info(cx, cy, radius, rx, ry, rw, rh, &info);
+    LevelFileHeader header;
+    memcpy(&header, base, sizeof(header));
+    size_t layersEnd = sizeof(header) + (size_t)header.layerCount * sizeof(LevelFileLayer);
+    if (memcmp(header.magic, "STLV", 4) != 0 || header.version != LEVEL_FILE_VERSION ||
+        header.chunkSize == 0 || header.chunkSize > 1024 || layersEnd > baseSize) {
+        lua_pushnil(L);
+        return 1;
+    }
 
-    lua_newtable(L);
-    lua_pushboolean(L, info.colliding);
-    lua_setfield(L, -2, "colliding");
-    lua_pushnumber(L, info.penetrationDepth);
-    lua_setfield(L, -2, "penetrationDepth");
-    lua_pushnumber(L, info.normalX);
-    lua_setfield(L, -2, "normalX");
-    lua_pushnumber(L, info.normalY);
-    lua_setfield(L, -2, "normalY");
+    const size_t chunkSize = header.chunkSize;
+    std::vector<LevelFileLayer> layers(header.layerCount);
+    for (uint16_t li = 0; li < header.layerCount; li++) {
+        LevelFileLayer& info = layers[li];
+        memcpy(&info, base + sizeof(header) + li * sizeof(LevelFileLayer), sizeof(info));
+        info.name[sizeof(info.name) - 1] = '\0';
+        if (!levelLayerValid(info, chunkSize, baseSize)) {
+            lua_pushnil(L);
+            return 1;
+        }
+    }
 
-    return 1;
-}
+    static std::vector<uint16_t> chunkTiles;
+    chunkTiles.resize(chunkSize * chunkSize);
+
+    std::vector<std::pair<STLayerID, STTilemapID>> created;
+    lua_createtable(L, header.layerCount, 0);
+    for (uint16_t li = 0; li < header.layerCount; li++) {
+        const LevelFileLayer& info = layers[li];
+        size_t chunkCount = (size_t)info.chunksX * info.chunksY;
+
+        STTilemapID tilemap = st_tilemap_create((int32_t)info.width, (int32_t)info.height,
+                                                info.tileWidth, info.tileHeight);
+        STLayerID layer = tilemap >= 0 ? st_tilemap_create_layer(info.name[0] ? info.name : nullptr) : -1;
+        if (layer < 0) {
+            if (tilemap >= 0) {
+                st_tilemap_destroy(tilemap);
+            }
+            tilemapUnloadLevelLayers(created);
+            lua_pop(L, 1);
+            lua_pushnil(L);
+            return 1;
+        }
+        created.push_back({layer, tilemap});
+        st_tilemap_layer_set_tilemap(layer, tilemap);
+        g_tilemapInfo[tilemap] = {(int32_t)info.width, (int32_t)info.height, info.tileWidth, info.tileHeight};
+        g_layerTilemap[layer] = tilemap;
+
+        for (size_t ci = 0; ci < chunkCount; ci++) {
+            LevelFileChunk chunk;
+            memcpy(&chunk, base + info.chunkIndexOffset + ci * sizeof(LevelFileChunk), sizeof(chunk));
+            if (chunk.encoding == LEVEL_CHUNK_EMPTY ||
+                chunk.offset > baseSize || chunk.size > baseSize - chunk.offset) {
+                continue;
+            }
 
-static int lua_collision_circle_circle_penetration(lua_State* L) {
-    float x1 = (float)luaL_checknumber(L, 1);
-    float y1 = (float)luaL_checknumber(L, 2);
-    float r1 = (float)luaL_checknumber(L, 3);
-    float x2 = (float)luaL_checknumber(L, 4);
-    float y2 = (float)luaL_checknumber(L, 5);
-    float r2 = (float)luaL_checknumber(L, 6);
+            const uint8_t* payload = base + chunk.offset;
+            size_t bytes = chunkTiles.size() * sizeof(uint16_t);
+            if (chunk.encoding == LEVEL_CHUNK_RAW && chunk.size == bytes) {
+                memcpy(chunkTiles.data(), payload, bytes);
+            } else if (chunk.encoding != LEVEL_CHUNK_LZ4 ||
+                       !lz4DecodeBlock(payload, chunk.size, (uint8_t*)chunkTiles.data(), bytes)) {
+                continue;
+            }
 
-    float penetration = st_collision_circle_circle_penetration(x1, y1, r1, x2, y2, r2);
-    lua_pushnumber(L, penetration);
+            // New tilemaps start empty, so only non-zero tiles are written
+            uint32_t x0 = (uint32_t)(ci % info.chunksX) * chunkSize;
+            uint32_t y0 = (uint32_t)(ci / info.chunksX) * chunkSize;
+            uint32_t x1 = std::min<uint32_t>(x0 + chunkSize, info.width);
+            uint32_t y1 = std::min<uint32_t>(y0 + chunkSize, info.height);
+            for (uint32_t y = y0; y < y1; y++) {
+                const uint16_t* row = chunkTiles.data() + (y - y0) * chunkSize;
+                for (uint32_t x = x0; x < x1; x++) {
+                    if (row[x - x0]) {
+                        tilemapWriteTile(layer, (int32_t)x, (int32_t)y, row[x - x0]);
+                    }
+                }
+            }
+        }
+
+        lua_pushinteger(L, layer);
+        lua_rawseti(L, -2, li + 1);
+    }
     return 1;
 }
 
-static int lua_collision_rect_rect_overlap(lua_State* L) {
-    float x1 = (float)luaL_checknumber(L, 1);
-    float y1 = (float)luaL_checknumber(L, 2);
-    float w1 = (float)luaL_checknumber(L, 3);
-    float h1 = (float)luaL_checknumber(L, 4);
-    float x2 = (float)luaL_checknumber(L, 5);
-    float y2 = (float)luaL_checknumber(L, 6);
-    float w2 = (float)luaL_checknumber(L, 7);
-    float h2 = (float)luaL_checknumber(L, 8);
+// tilemap.loadFile(path) -> {layerID, ...} in file order, or nil
+static int lua_st_tilemap_load_file(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
 
-    float overlapX, overlapY;
-    st_collision_rect_rect_overlap(x1, y1, w1, h1, x2, y2, w2, h2, &overlapX, &overlapY);
+    MappedFile file;
+    if (!file.openRead(path)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    return tilemapLoadLevel(L, file.data(), file.size());
+}
 
-    lua_pushnumber(L, overlapX);
-    lua_pushnumber(L, overlapY);
-    return 2;
+// tilemap.loadAsset(assetID) -> {layerID, ...}, reading the level in place
+static int lua_st_tilemap_load_asset(lua_State* L) {
+    STAssetID asset = luaL_checkinteger(L, 1);
+    std::lock_guard<std::mutex> lock(g_assetMutex);
+    return tilemapLoadLevel(L, (const uint8_t*)st_asset_get_data(asset), st_asset_get_size(asset));
 }
 
-static int lua_collision_swept_circle_rect(lua_State* L) {
-    float cx = (float)luaL_checknumber(L, 1);
-    float cy = (float)luaL_checknumber(L, 2);
-    float radius = (float)luaL_checknumber(L, 3);
-    float vx = (float)luaL_checknumber(L, 4);
-    float vy = (float)luaL_checknumber(L, 5);
-    float rx = (float)luaL_checknumber(L, 6);
-    float ry = (float)luaL_checknumber(L, 7);
-    float rw = (float)luaL_checknumber(L, 8);
-    float rh = (float)luaL_checknumber(L, 9);
+// tilemap.saveFile(path, {layerID, ...} [, compress [, chunkSize]]) -> success
+// Layers must have been bound with layerSetTilemap through these bindings.
+static int lua_st_tilemap_save_file(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    bool compress = lua_isnoneornil(L, 3) ? true : lua_toboolean(L, 3);
+    uint32_t chunkSize = (uint32_t)luaL_optinteger(L, 4, 64);
+    luaL_argcheck(L, chunkSize >= 8 && chunkSize <= 1024, 4, "chunk size must be between 8 and 1024");
+
+    std::vector<STLayerID> layers;
+    for (int i = 1; ; i++) {
+        lua_rawgeti(L, 2, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        STLayerID layer = (STLayerID)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        if (!findLayerTilemap(layer)) {
+            return luaL_argerror(L, 2, "layer has no tilemap");
+        }
+        layers.push_back(layer);
+    }
+    luaL_argcheck(L, !layers.empty() && layers.size() <= 0xFFFF, 2, "expected 1 to 65535 layers");
+
+    LevelFileHeader header = {};
+    memcpy(header.magic, "STLV", 4);
+    header.version = LEVEL_FILE_VERSION;
+    header.layerCount = (uint16_t)layers.size();
+    header.chunkSize = chunkSize;
+
+    std::vector<LevelFileLayer> layerRecords(layers.size());
+    std::vector<std::vector<LevelFileChunk>> chunkIndices(layers.size());
+    uint64_t offset = sizeof(header) + layers.size() * sizeof(LevelFileLayer);
+    for (size_t li = 0; li < layers.size(); li++) {
+        const TilemapInfo* info = findLayerTilemap(layers[li]);
+        LevelFileLayer& record = layerRecords[li];
+        memset(&record, 0, sizeof(record));
+        record.width = (uint32_t)info->width;
+        record.height = (uint32_t)info->height;
+        record.tileWidth = (uint16_t)info->tileWidth;
+        record.tileHeight = (uint16_t)info->tileHeight;
+        record.chunksX = (record.width + chunkSize - 1) / chunkSize;
+        record.chunksY = (record.height + chunkSize - 1) / chunkSize;
+        record.chunkIndexOffset = offset;
+        chunkIndices[li].resize((size_t)record.chunksX * record.chunksY);
+        offset += chunkIndices[li].size() * sizeof(LevelFileChunk);
+    }
 
-    int result = st_collision_swept_circle_rect(cx, cy, radius, vx, vy, rx, ry, rw, rh);
-    lua_pushboolean(L, result);
+    std::vector<uint8_t> payloads;
+    std::vector<uint16_t> tiles(chunkSize * chunkSize);
+    std::vector<uint8_t> packed;
+    for (size_t li = 0; li < layers.size(); li++) {
+        const LevelFileLayer& record = layerRecords[li];
+        for (size_t ci = 0; ci < chunkIndices[li].size(); ci++) {
+            uint32_t x0 = (uint32_t)(ci % record.chunksX) * chunkSize;
+            uint32_t y0 = (uint32_t)(ci / record.chunksX) * chunkSize;
+            std::fill(tiles.begin(), tiles.end(), 0);
+            bool empty = true;
+            for (uint32_t y = y0; y < std::min(y0 + chunkSize, record.height); y++) {
+                for (uint32_t x = x0; x < std::min(x0 + chunkSize, record.width); x++) {
+                    uint16_t tile = st_tilemap_get_tile(layers[li], (int32_t)x, (int32_t)y);
+                    tiles[(y - y0) * chunkSize + (x - x0)] = tile;
+                    empty = empty && tile == 0;
+                }
+            }
+
+            LevelFileChunk& chunk = chunkIndices[li][ci];
+            if (empty) {
+                chunk = {0, 0, LEVEL_CHUNK_EMPTY};
+                continue;
+            }
+
+            const uint8_t* raw = (const uint8_t*)tiles.data();
+            size_t rawSize = tiles.size() * sizeof(uint16_t);
+            if (compress) {
+                lz4EncodeBlock(raw, rawSize, packed);
+            }
+            bool useLZ4 = compress && packed.size() < rawSize;
+            chunk.offset = offset + payloads.size();
+            chunk.size = (uint32_t)(useLZ4 ? packed.size() : rawSize);
+            chunk.encoding = useLZ4 ? LEVEL_CHUNK_LZ4 : LEVEL_CHUNK_RAW;
+            if (useLZ4) {
+                payloads.insert(payloads.end(), packed.begin(), packed.end());
+            } else {
+                payloads.insert(payloads.end(), raw, raw + rawSize);
+            }
+        }
+    }
+
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(layerRecords.data(), sizeof(LevelFileLayer), layerRecords.size(), out) == layerRecords.size();
+    for (size_t li = 0; ok && li < chunkIndices.size(); li++) {
+        ok = fwrite(chunkIndices[li].data(), sizeof(LevelFileChunk), chunkIndices[li].size(), out) ==
+             chunkIndices[li].size();
+    }
+    ok = ok && (payloads.empty() || fwrite(payloads.data(), 1, payloads.size(), out) == payloads.size());
+    ok = (fclose(out) == 0) && ok;
+
+    lua_pushboolean(L, ok);
     return 1;
 }
 
@@ -6193,6 +14547,34 @@ void registerBindings(lua_State* L) {
     luaL_setglobalnumber(L, "STAR_OUTLINE", 100);
     luaL_setglobalnumber(L, "STAR_DASHED_OUTLINE", 101);
 
+    // Shape Bulk Update API
+    luaL_setglobalfunction(L, "shapes_set_positions", lua_shapes_set_positions);
+    luaL_setglobalfunction(L, "shapes_set_rotations", lua_shapes_set_rotations);
+    luaL_setglobalfunction(L, "shapes_set_colors", lua_shapes_set_colors);
+    luaL_setglobalfunction(L, "shapes_set_visible", lua_shapes_set_visible);
+    luaL_setglobalfunction(L, "shapes_count", lua_shapes_count);
+    luaL_setglobalfunction(L, "shapes_set_modes", lua_shapes_set_modes);
+    luaL_setglobalfunction(L, "shapes_set_parameters", lua_shapes_set_parameters);
+    luaL_setglobalfunction(L, "shapes_get_frame_stats", lua_shapes_get_frame_stats);
+
+    // Shape Group API
+    luaL_setglobalfunction(L, "group_create", lua_group_create);
+    luaL_setglobalfunction(L, "group_add", lua_group_add);
+    luaL_setglobalfunction(L, "group_remove", lua_group_remove);
+    luaL_setglobalfunction(L, "group_set_parent", lua_group_set_parent);
+    luaL_setglobalfunction(L, "group_set_transform", lua_group_set_transform);
+    luaL_setglobalfunction(L, "group_get_transform", lua_group_get_transform);
+    luaL_setglobalfunction(L, "group_delete", lua_group_delete);
+    luaL_setglobalfunction(L, "group_get_stats", lua_group_get_stats);
+    luaL_setglobalfunction(L, "shapes_get_stats", lua_shapes_get_stats);
+
+    // Shape kind constants
+    luaL_setglobalnumber(L, "SHAPE_RECT", SHAPE_RECT);
+    luaL_setglobalnumber(L, "SHAPE_CIRCLE", SHAPE_CIRCLE);
+    luaL_setglobalnumber(L, "SHAPE_LINE", SHAPE_LINE);
+    luaL_setglobalnumber(L, "SHAPE_POLYGON", SHAPE_POLYGON);
+    luaL_setglobalnumber(L, "SHAPE_STAR", SHAPE_STAR);
+
     // Audio API
     // Rectangle gradient mode constants
     luaL_setglobalnumber(L, "GRADIENT_HORIZONTAL", ST_GRADIENT_HORIZONTAL);
@@ -6302,6 +14684,13 @@ void registerBindings(lua_State* L) {
     luaL_setglobalfunction(L, "voice_direct_slot", lua_st_voice_direct_slot);
     luaL_setglobalfunction(L, "vscript_save_to_bank", lua_st_vscript_save_to_bank);
 
+    // Offline voice rendering
+    luaL_setglobalfunction(L, "voices_offline_start", lua_st_voices_offline_start);
+    luaL_setglobalfunction(L, "voices_offline_end", lua_st_voices_offline_end);
+    luaL_setglobalfunction(L, "voices_offline_render", lua_st_voices_offline_render);
+    luaL_setglobalfunction(L, "voices_offline_is_capturing", lua_st_voices_offline_is_capturing);
+    luaL_setglobalfunction(L, "voices_offline_stats", lua_st_voices_offline_stats);
+
     // Voice waveform constants
     luaL_setglobalnumber(L, "WAVE_SILENCE", 0);
     luaL_setglobalnumber(L, "WAVE_SINE", 1);
@@ -6454,6 +14843,8 @@ void registerBindings(lua_State* L) {
     luaL_setglobalfunction(L, "sprite_explode_advanced", lua_sprite_explode_advanced);
     luaL_setglobalfunction(L, "sprite_explode_directional", lua_sprite_explode_directional);
     luaL_setglobalfunction(L, "sprite_explode_mode", lua_sprite_explode_mode);
+    luaL_setglobalfunction(L, "sprite_explode_set_limits", lua_sprite_explode_set_limits);
+    luaL_setglobalfunction(L, "sprite_explode_get_limits", lua_sprite_explode_get_limits);
 
     // Explosion mode constants
     luaL_setglobalnumber(L, "BASIC_EXPLOSION", 1);
@@ -6508,6 +14899,9 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_asset_import_directory);
     lua_setfield(L, -2, "importDirectory");
 
+    lua_pushcfunction(L, lua_st_asset_get_dedup_stats);
+    lua_setfield(L, -2, "getDedupStats");
+
     lua_pushcfunction(L, lua_st_asset_export);
     lua_setfield(L, -2, "export");
 
@@ -6518,6 +14912,12 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_asset_get_data);
     lua_setfield(L, -2, "getData");
 
+    lua_pushcfunction(L, lua_st_asset_get_view);
+    lua_setfield(L, -2, "getView");
+
+    lua_pushcfunction(L, lua_st_asset_release_view);
+    lua_setfield(L, -2, "releaseView");
+
     lua_pushcfunction(L, lua_st_asset_get_size);
     lua_setfield(L, -2, "getSize");
 
@@ -6567,6 +14967,141 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_asset_clear_error);
     lua_setfield(L, -2, "clearError");
 
+    // Async loading
+    lua_pushcfunction(L, lua_st_asset_load_async);
+    lua_setfield(L, -2, "loadAsync");
+
+    lua_pushcfunction(L, lua_st_asset_load_file_async);
+    lua_setfield(L, -2, "loadFileAsync");
+
+    lua_pushcfunction(L, lua_st_asset_import_async);
+    lua_setfield(L, -2, "importAsync");
+
+    lua_pushcfunction(L, lua_st_asset_import_directory_async);
+    lua_setfield(L, -2, "importDirectoryAsync");
+
+    lua_pushcfunction(L, lua_st_asset_poll);
+    lua_setfield(L, -2, "poll");
+
+    lua_pushcfunction(L, lua_st_asset_cancel);
+    lua_setfield(L, -2, "cancel");
+
+    lua_pushcfunction(L, lua_st_asset_update);
+    lua_setfield(L, -2, "update");
+
+    lua_pushcfunction(L, lua_st_asset_get_async_progress);
+    lua_setfield(L, -2, "getAsyncProgress");
+
+    lua_pushcfunction(L, lua_st_asset_set_progress_callback);
+    lua_setfield(L, -2, "setProgressCallback");
+
+    lua_pushcfunction(L, lua_st_asset_set_async_workers);
+    lua_setfield(L, -2, "setAsyncWorkers");
+
+    // Prefetch
+    lua_pushcfunction(L, lua_st_asset_prefetch);
+    lua_setfield(L, -2, "prefetch");
+
+    lua_pushcfunction(L, lua_st_asset_cancel_prefetch);
+    lua_setfield(L, -2, "cancelPrefetch");
+
+    lua_pushcfunction(L, lua_st_asset_define_prefetch_group);
+    lua_setfield(L, -2, "definePrefetchGroup");
+
+    lua_pushcfunction(L, lua_st_asset_prefetch_group);
+    lua_setfield(L, -2, "prefetchGroup");
+
+    lua_pushcfunction(L, lua_st_asset_get_prefetch_group);
+    lua_setfield(L, -2, "getPrefetchGroup");
+
+    lua_pushcfunction(L, lua_st_asset_load_manifest);
+    lua_setfield(L, -2, "loadManifest");
+
+    lua_pushcfunction(L, lua_st_asset_save_manifest);
+    lua_setfield(L, -2, "saveManifest");
+
+    lua_pushcfunction(L, lua_st_asset_trace_start);
+    lua_setfield(L, -2, "traceStart");
+
+    lua_pushcfunction(L, lua_st_asset_trace_stop);
+    lua_setfield(L, -2, "traceStop");
+
+    lua_pushcfunction(L, lua_st_asset_get_prefetch_stats);
+    lua_setfield(L, -2, "getPrefetchStats");
+
+    // Hot reload
+    lua_pushcfunction(L, lua_st_asset_set_hot_reload);
+    lua_setfield(L, -2, "setHotReload");
+
+    lua_pushcfunction(L, lua_st_asset_is_hot_reload_enabled);
+    lua_setfield(L, -2, "isHotReloadEnabled");
+
+    lua_pushcfunction(L, lua_st_asset_watch);
+    lua_setfield(L, -2, "watch");
+
+    lua_pushcfunction(L, lua_st_asset_on_reload);
+    lua_setfield(L, -2, "onReload");
+
+    lua_pushcfunction(L, lua_st_asset_get_hot_reload_stats);
+    lua_setfield(L, -2, "getHotReloadStats");
+
+    // Cache policy
+    lua_pushcfunction(L, lua_st_asset_set_eviction_policy);
+    lua_setfield(L, -2, "setEvictionPolicy");
+
+    lua_pushcfunction(L, lua_st_asset_get_eviction_policy);
+    lua_setfield(L, -2, "getEvictionPolicy");
+
+    lua_pushcfunction(L, lua_st_asset_set_type_budget);
+    lua_setfield(L, -2, "setTypeBudget");
+
+    lua_pushcfunction(L, lua_st_asset_get_type_budget);
+    lua_setfield(L, -2, "getTypeBudget");
+
+    lua_pushcfunction(L, lua_st_asset_get_cache_stats);
+    lua_setfield(L, -2, "getCacheStats");
+
+    lua_pushcfunction(L, lua_st_asset_reset_cache_stats);
+    lua_setfield(L, -2, "resetCacheStats");
+
+    // Index
+    lua_pushcfunction(L, lua_st_asset_iter);
+    lua_setfield(L, -2, "iter");
+
+    lua_pushcfunction(L, lua_st_asset_find);
+    lua_setfield(L, -2, "find");
+
+    lua_pushcfunction(L, lua_st_asset_find_prefix);
+    lua_setfield(L, -2, "findPrefix");
+
+    lua_pushcfunction(L, lua_st_asset_refresh_index);
+    lua_setfield(L, -2, "refreshIndex");
+
+    // Packed archives
+    lua_pushcfunction(L, lua_st_asset_open_archive);
+    lua_setfield(L, -2, "openArchive");
+
+    lua_pushcfunction(L, lua_st_asset_close_archive);
+    lua_setfield(L, -2, "closeArchive");
+
+    lua_pushcfunction(L, lua_st_asset_archive_get_view);
+    lua_setfield(L, -2, "archiveGetView");
+
+    lua_pushcfunction(L, lua_st_asset_archive_get_data);
+    lua_setfield(L, -2, "archiveGetData");
+
+    lua_pushcfunction(L, lua_st_asset_archive_list);
+    lua_setfield(L, -2, "archiveList");
+
+    lua_pushcfunction(L, lua_st_asset_archive_verify);
+    lua_setfield(L, -2, "archiveVerify");
+
+    lua_pushcfunction(L, lua_st_asset_export_archive);
+    lua_setfield(L, -2, "exportArchive");
+
+    lua_pushcfunction(L, lua_st_asset_find_duplicates);
+    lua_setfield(L, -2, "findDuplicates");
+
     // Set the 'asset' global table
     lua_setglobal(L, "asset");
 
@@ -6628,6 +15163,12 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_tilemap_fill_rect);
     lua_setfield(L, -2, "fillRect");
 
+    lua_pushcfunction(L, lua_st_tilemap_set_tiles);
+    lua_setfield(L, -2, "setTiles");
+
+    lua_pushcfunction(L, lua_st_tilemap_get_tiles);
+    lua_setfield(L, -2, "getTiles");
+
     lua_pushcfunction(L, lua_st_tilemap_clear);
     lua_setfield(L, -2, "clear");
 
@@ -6657,6 +15198,9 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_tilemap_update);
     lua_setfield(L, -2, "update");
 
+    lua_pushcfunction(L, lua_st_tilemap_get_stats);
+    lua_setfield(L, -2, "getStats");
+
     // Coordinate conversion
     lua_pushcfunction(L, lua_st_tilemap_world_to_tile);
     lua_setfield(L, -2, "worldToTile");
@@ -6664,6 +15208,61 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_tilemap_tile_to_world);
     lua_setfield(L, -2, "tileToWorld");
 
+    // Collision queries
+    lua_pushcfunction(L, lua_st_tilemap_overlap_aabb);
+    lua_setfield(L, -2, "overlapAABB");
+
+    lua_pushcfunction(L, lua_st_tilemap_sweep_aabb);
+    lua_setfield(L, -2, "sweepAABB");
+
+    lua_pushcfunction(L, lua_st_tilemap_raycast);
+    lua_setfield(L, -2, "raycast");
+
+    lua_pushcfunction(L, lua_st_tilemap_refresh_solid);
+    lua_setfield(L, -2, "refreshSolid");
+
+    // Auto-tiling
+    lua_pushcfunction(L, lua_st_tilemap_define_autotile);
+    lua_setfield(L, -2, "defineAutotile");
+
+    lua_pushcfunction(L, lua_st_tilemap_clear_autotile);
+    lua_setfield(L, -2, "clearAutotile");
+
+    lua_pushcfunction(L, lua_st_tilemap_autotile);
+    lua_setfield(L, -2, "autotile");
+
+    // Chunked streaming worlds
+    lua_pushcfunction(L, lua_st_tilemap_create_chunked);
+    lua_setfield(L, -2, "createChunked");
+
+    lua_pushcfunction(L, lua_st_tilemap_destroy_chunked);
+    lua_setfield(L, -2, "destroyChunked");
+
+    lua_pushcfunction(L, lua_st_tilemap_chunked_set_tile);
+    lua_setfield(L, -2, "chunkedSetTile");
+
+    lua_pushcfunction(L, lua_st_tilemap_chunked_get_tile);
+    lua_setfield(L, -2, "chunkedGetTile");
+
+    lua_pushcfunction(L, lua_st_tilemap_chunked_set_camera);
+    lua_setfield(L, -2, "chunkedSetCamera");
+
+    lua_pushcfunction(L, lua_st_tilemap_chunked_flush);
+    lua_setfield(L, -2, "chunkedFlush");
+
+    lua_pushcfunction(L, lua_st_tilemap_chunked_get_stats);
+    lua_setfield(L, -2, "chunkedGetStats");
+
+    // Binary level files
+    lua_pushcfunction(L, lua_st_tilemap_load_file);
+    lua_setfield(L, -2, "loadFile");
+
+    lua_pushcfunction(L, lua_st_tilemap_load_asset);
+    lua_setfield(L, -2, "loadAsset");
+
+    lua_pushcfunction(L, lua_st_tilemap_save_file);
+    lua_setfield(L, -2, "saveFile");
+
     // Tileset management
     lua_pushcfunction(L, lua_st_tileset_load);
     lua_setfield(L, -2, "loadTileset");
@@ -6680,6 +15279,13 @@ void registerBindings(lua_State* L) {
     lua_pushcfunction(L, lua_st_tileset_get_dimensions);
     lua_setfield(L, -2, "getTilesetDimensions");
 
+    // Tile animation
+    lua_pushcfunction(L, lua_st_tilemap_define_animation);
+    lua_setfield(L, -2, "defineAnimation");
+
+    lua_pushcfunction(L, lua_st_tilemap_clear_animations);
+    lua_setfield(L, -2, "clearAnimations");
+
     // Set the 'tilemap' global table
     lua_setglobal(L, "tilemap");
 
@@ -6691,12 +15297,34 @@ void registerBindings(lua_State* L) {
     luaL_setglobalfunction(L, "collision_point_in_circle", lua_collision_point_in_circle);
     luaL_setglobalfunction(L, "collision_point_in_rect", lua_collision_point_in_rect);
     luaL_setglobalfunction(L, "collision_circle_rect_info", lua_collision_circle_rect_info);
+    luaL_setglobalfunction(L, "collision_circle_rect_contact", lua_collision_circle_rect_contact);
     luaL_setglobalfunction(L, "collision_circle_circle_penetration", lua_collision_circle_circle_penetration);
     luaL_setglobalfunction(L, "collision_rect_rect_overlap", lua_collision_rect_rect_overlap);
     luaL_setglobalfunction(L, "collision_swept_circle_rect", lua_collision_swept_circle_rect);
+    luaL_setglobalfunction(L, "collision_sweep_circle_rect", lua_collision_sweep_circle_rect);
+    luaL_setglobalfunction(L, "collision_sweep_circle_circle", lua_collision_sweep_circle_circle);
+    luaL_setglobalfunction(L, "collision_sweep_aabb", lua_collision_sweep_aabb);
+    luaL_setglobalfunction(L, "collision_sweep_grid", lua_collision_sweep_grid);
+    luaL_setglobalfunction(L, "collision_circles_vs_rect_batch", lua_collision_circles_vs_rect_batch);
+    luaL_setglobalfunction(L, "collision_points_in_rects_batch", lua_collision_points_in_rects_batch);
+
+    // Collision World API
+    luaL_setglobalfunction(L, "collision_world_create", lua_collision_world_create);
+    luaL_setglobalfunction(L, "collision_world_destroy", lua_collision_world_destroy);
+    luaL_setglobalfunction(L, "collision_world_clear", lua_collision_world_clear);
+    luaL_setglobalfunction(L, "collision_world_set_rects", lua_collision_world_set_rects);
+    luaL_setglobalfunction(L, "collision_world_set_circles", lua_collision_world_set_circles);
+    luaL_setglobalfunction(L, "collision_world_set_filters", lua_collision_world_set_filters);
+    luaL_setglobalfunction(L, "collision_world_remove", lua_collision_world_remove);
+    luaL_setglobalfunction(L, "collision_world_query_pairs", lua_collision_world_query_pairs);
+    luaL_setglobalfunction(L, "collision_world_get_stats", lua_collision_world_get_stats);
 
     // Indexed Tile Rendering API
     SuperTerminal::IndexedTileBindings::registerBindings(L);
 }
 
+void frameUpdate(lua_State* L) {
+    assetFrameUpdate(L);
+}
+
 } // namespace LuaRunner2
@@ -314,6 +314,7 @@ extern "C" {
 
             [g_runnerInstance waitForNextFrame];
         }
+        LuaRunner2::frameUpdate(L);
         return 0;
     });
     lua_setglobal(_luaState, "wait_frame");